@@ -12,8 +12,10 @@ mex -largeArrayDims  -c -DWIN ./svm_struct/svm_struct_common.c
 
 %% svm_struct - custom  .o files
 mex -largeArrayDims  -c -DWIN ./svm_struct_api.c 
+mex -largeArrayDims  -c -DWIN ./svm_struct_plugin.c
+mex -largeArrayDims  -c -DWIN ./svm_struct_farm.c
 mex -largeArrayDims  -c -DWIN ./svm_struct_learn_custom.c
 
-mex -largeArrayDims -DWIN -output  svm_struct_learn svm_struct_learn_mex.c svm_struct_api.obj  svm_struct_learn_custom.obj svm_struct_learn.obj svm_struct_common.obj svm_common.obj svm_learn.obj svm_hideo.obj 
+mex -largeArrayDims -DWIN -output  svm_struct_learn svm_struct_learn_mex.c svm_struct_api.obj  svm_struct_plugin.obj svm_struct_farm.obj svm_struct_learn_custom.obj svm_struct_learn.obj svm_struct_common.obj svm_common.obj svm_learn.obj svm_hideo.obj 
 
 delete *.obj
@@ -0,0 +1,564 @@
+/** file:   mex.c
+ ** brief:  Minimal stand-alone replacement of the MATLAB MEX API
+ ** author: Andrea Vedaldi
+ **/
+
+#include "mex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+struct mxArray_
+{
+  mxClassID classID ;
+  int isSparse ;
+  mwSize m ;
+  mwSize n ;
+
+  /* double, logical, char, cell (mxArray*) or struct (mxArray*) data */
+  void * data ;
+
+  /* sparse matrices */
+  mwIndex * ir ;
+  mwIndex * jc ;
+  mwSize nzmax ;
+
+  /* structures */
+  int numFields ;
+  char ** fieldNames ;
+
+  /* function handles */
+  char * name ;
+  mexShimFunction fn ;
+  void * fnData ;
+} ;
+
+typedef struct MexShimEntry_
+{
+  char * name ;
+  mexShimFunction fn ;
+  void * data ;
+  struct MexShimEntry_ * next ;
+} MexShimEntry ;
+
+static MexShimEntry * registry = NULL ;
+static int trapFlag = 0 ;
+static char lastError [1024] = "" ;
+
+static char *
+strdupShim (char const * str)
+{
+  size_t n = strlen(str) + 1 ;
+  char * copy = mxMalloc(n) ;
+  memcpy(copy, str, n) ;
+  return copy ;
+}
+
+static mwSize
+elementSize (mxArray const * array)
+{
+  switch (array->classID) {
+  case mxDOUBLE_CLASS : return sizeof(double) ;
+  case mxLOGICAL_CLASS : return sizeof(mxLogical) ;
+  case mxCHAR_CLASS : return sizeof(mxChar) ;
+  case mxCELL_CLASS : return sizeof(mxArray*) ;
+  case mxSTRUCT_CLASS : return sizeof(mxArray*) * array->numFields ;
+  default : return 0 ;
+  }
+}
+
+static mxArray *
+newArray (mxClassID classID, mwSize m, mwSize n)
+{
+  mxArray * array = mxCalloc(1, sizeof(mxArray)) ;
+  array->classID = classID ;
+  array->m = m ;
+  array->n = n ;
+  return array ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                           Memory */
+/* ---------------------------------------------------------------- */
+
+void *
+mxMalloc (size_t n)
+{
+  void * ptr = malloc(n ? n : 1) ;
+  if (! ptr) mexErrMsgTxt("Out of memory") ;
+  return ptr ;
+}
+
+void *
+mxCalloc (size_t n, size_t size)
+{
+  void * ptr = calloc(n ? n : 1, size ? size : 1) ;
+  if (! ptr) mexErrMsgTxt("Out of memory") ;
+  return ptr ;
+}
+
+void *
+mxRealloc (void * ptr, size_t n)
+{
+  ptr = realloc(ptr, n ? n : 1) ;
+  if (! ptr) mexErrMsgTxt("Out of memory") ;
+  return ptr ;
+}
+
+void
+mxFree (void * ptr)
+{
+  free(ptr) ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                         Creation and destruction */
+/* ---------------------------------------------------------------- */
+
+mxArray *
+mxCreateDoubleMatrix (mwSize m, mwSize n, mxComplexity c)
+{
+  mxArray * array = newArray(mxDOUBLE_CLASS, m, n) ;
+  if (c != mxREAL) mexErrMsgTxt("mxCreateDoubleMatrix: complex arrays are not supported") ;
+  array->data = mxCalloc(m * n, sizeof(double)) ;
+  return array ;
+}
+
+mxArray *
+mxCreateDoubleScalar (double x)
+{
+  mxArray * array = mxCreateDoubleMatrix(1, 1, mxREAL) ;
+  *mxGetPr(array) = x ;
+  return array ;
+}
+
+mxArray *
+mxCreateSparse (mwSize m, mwSize n, mwSize nzmax, mxComplexity c)
+{
+  mxArray * array = newArray(mxDOUBLE_CLASS, m, n) ;
+  if (c != mxREAL) mexErrMsgTxt("mxCreateSparse: complex arrays are not supported") ;
+  if (nzmax == 0) nzmax = 1 ;
+  array->isSparse = 1 ;
+  array->nzmax = nzmax ;
+  array->data = mxCalloc(nzmax, sizeof(double)) ;
+  array->ir = mxCalloc(nzmax, sizeof(mwIndex)) ;
+  array->jc = mxCalloc(n + 1, sizeof(mwIndex)) ;
+  return array ;
+}
+
+mxArray *
+mxCreateLogicalScalar (mxLogical x)
+{
+  mxArray * array = newArray(mxLOGICAL_CLASS, 1, 1) ;
+  array->data = mxMalloc(sizeof(mxLogical)) ;
+  *(mxLogical*)array->data = x ;
+  return array ;
+}
+
+mxArray *
+mxCreateString (char const * str)
+{
+  mwSize i, n = strlen(str) ;
+  mxArray * array = newArray(mxCHAR_CLASS, n > 0, n) ;
+  mxChar * data = mxCalloc(n, sizeof(mxChar)) ;
+  for (i = 0 ; i < n ; ++i) data[i] = (unsigned char) str[i] ;
+  array->data = data ;
+  return array ;
+}
+
+mxArray *
+mxCreateCellMatrix (mwSize m, mwSize n)
+{
+  mxArray * array = newArray(mxCELL_CLASS, m, n) ;
+  array->data = mxCalloc(m * n, sizeof(mxArray*)) ;
+  return array ;
+}
+
+mxArray *
+mxCreateStructMatrix (mwSize m, mwSize n, int nfields, char const ** fieldNames)
+{
+  int f ;
+  mxArray * array = newArray(mxSTRUCT_CLASS, m, n) ;
+  array->numFields = nfields ;
+  array->fieldNames = mxCalloc(nfields, sizeof(char*)) ;
+  for (f = 0 ; f < nfields ; ++f) {
+    array->fieldNames[f] = strdupShim(fieldNames[f]) ;
+  }
+  array->data = mxCalloc(m * n * nfields, sizeof(mxArray*)) ;
+  return array ;
+}
+
+mxArray *
+mxCreateStructArray (mwSize ndims, mwSize const * dims, int nfields,
+                     char const ** fieldNames)
+{
+  mwSize d, n = 1 ;
+  for (d = 1 ; d < ndims ; ++d) n *= dims[d] ;
+  return mxCreateStructMatrix(ndims > 0 ? dims[0] : 1, n, nfields, fieldNames) ;
+}
+
+mxArray *
+mxDuplicateArray (mxArray const * array)
+{
+  mxArray * copy ;
+  mwSize i, numel ;
+  int f ;
+
+  if (! array) return NULL ;
+  copy = newArray(array->classID, array->m, array->n) ;
+  numel = array->m * array->n ;
+
+  switch (array->classID) {
+  case mxFUNCTION_CLASS :
+    copy->name = strdupShim(array->name) ;
+    copy->fn = array->fn ;
+    copy->fnData = array->fnData ;
+    break ;
+
+  case mxCELL_CLASS :
+    copy->data = mxCalloc(numel, sizeof(mxArray*)) ;
+    for (i = 0 ; i < numel ; ++i) {
+      ((mxArray**)copy->data)[i] = mxDuplicateArray(((mxArray**)array->data)[i]) ;
+    }
+    break ;
+
+  case mxSTRUCT_CLASS :
+    copy->numFields = array->numFields ;
+    copy->fieldNames = mxCalloc(array->numFields, sizeof(char*)) ;
+    for (f = 0 ; f < array->numFields ; ++f) {
+      copy->fieldNames[f] = strdupShim(array->fieldNames[f]) ;
+    }
+    copy->data = mxCalloc(numel * array->numFields, sizeof(mxArray*)) ;
+    for (i = 0 ; i < numel * array->numFields ; ++i) {
+      ((mxArray**)copy->data)[i] = mxDuplicateArray(((mxArray**)array->data)[i]) ;
+    }
+    break ;
+
+  default :
+    if (array->isSparse) {
+      copy->isSparse = 1 ;
+      copy->nzmax = array->nzmax ;
+      copy->data = mxMalloc(sizeof(double) * array->nzmax) ;
+      copy->ir = mxMalloc(sizeof(mwIndex) * array->nzmax) ;
+      copy->jc = mxMalloc(sizeof(mwIndex) * (array->n + 1)) ;
+      memcpy(copy->data, array->data, sizeof(double) * array->nzmax) ;
+      memcpy(copy->ir, array->ir, sizeof(mwIndex) * array->nzmax) ;
+      memcpy(copy->jc, array->jc, sizeof(mwIndex) * (array->n + 1)) ;
+    } else {
+      copy->data = mxMalloc(elementSize(array) * numel) ;
+      if (array->data) memcpy(copy->data, array->data, elementSize(array) * numel) ;
+    }
+    break ;
+  }
+  return copy ;
+}
+
+void
+mxDestroyArray (mxArray * array)
+{
+  mwSize i, numel ;
+  int f ;
+
+  if (! array) return ;
+  numel = array->m * array->n ;
+
+  switch (array->classID) {
+  case mxCELL_CLASS :
+    for (i = 0 ; i < numel ; ++i) {
+      mxDestroyArray(((mxArray**)array->data)[i]) ;
+    }
+    break ;
+  case mxSTRUCT_CLASS :
+    for (i = 0 ; i < numel * array->numFields ; ++i) {
+      mxDestroyArray(((mxArray**)array->data)[i]) ;
+    }
+    for (f = 0 ; f < array->numFields ; ++f) {
+      mxFree(array->fieldNames[f]) ;
+    }
+    mxFree(array->fieldNames) ;
+    break ;
+  default :
+    break ;
+  }
+  mxFree(array->data) ;
+  mxFree(array->ir) ;
+  mxFree(array->jc) ;
+  mxFree(array->name) ;
+  mxFree(array) ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                       Inspection */
+/* ---------------------------------------------------------------- */
+
+mxClassID mxGetClassID (mxArray const * array) { return array ? array->classID : mxUNKNOWN_CLASS ; }
+mwSize mxGetM (mxArray const * array) { return array->m ; }
+mwSize mxGetN (mxArray const * array) { return array->n ; }
+void mxSetM (mxArray * array, mwSize m) { array->m = m ; }
+void mxSetN (mxArray * array, mwSize n) { array->n = n ; }
+mwSize mxGetNumberOfDimensions (mxArray const * array) { return 2 ; }
+mwSize mxGetNumberOfElements (mxArray const * array) { return array->m * array->n ; }
+int mxIsChar (mxArray const * array) { return array->classID == mxCHAR_CLASS ; }
+int mxIsDouble (mxArray const * array) { return array->classID == mxDOUBLE_CLASS ; }
+int mxIsComplex (mxArray const * array) { return 0 ; }
+int mxIsSparse (mxArray const * array) { return array->isSparse ; }
+int mxIsCell (mxArray const * array) { return array->classID == mxCELL_CLASS ; }
+int mxIsStruct (mxArray const * array) { return array->classID == mxSTRUCT_CLASS ; }
+int mxIsLogical (mxArray const * array) { return array->classID == mxLOGICAL_CLASS ; }
+int mxIsEmpty (mxArray const * array) { return array->m * array->n == 0 ; }
+
+/* ---------------------------------------------------------------- */
+/*                                                      Data access */
+/* ---------------------------------------------------------------- */
+
+double * mxGetPr (mxArray const * array) { return (double*) array->data ; }
+void mxSetPr (mxArray * array, double * pr) { array->data = pr ; }
+void * mxGetData (mxArray const * array) { return array->data ; }
+void mxSetData (mxArray * array, void * data) { array->data = data ; }
+mwIndex * mxGetIr (mxArray const * array) { return array->ir ; }
+mwIndex * mxGetJc (mxArray const * array) { return array->jc ; }
+void mxSetIr (mxArray * array, mwIndex * ir) { array->ir = ir ; }
+void mxSetJc (mxArray * array, mwIndex * jc) { array->jc = jc ; }
+mwSize mxGetNzmax (mxArray const * array) { return array->nzmax ; }
+mxLogical * mxGetLogicals (mxArray const * array) { return (mxLogical*) array->data ; }
+
+double
+mxGetScalar (mxArray const * array)
+{
+  if (! array->data || array->m * array->n == 0) return 0 ;
+  switch (array->classID) {
+  case mxDOUBLE_CLASS : return *(double*)array->data ;
+  case mxLOGICAL_CLASS : return *(mxLogical*)array->data ;
+  case mxCHAR_CLASS : return *(mxChar*)array->data ;
+  default : return 0 ;
+  }
+}
+
+int
+mxGetString (mxArray const * array, char * buf, mwSize len)
+{
+  mwSize i, n ;
+  if (array->classID != mxCHAR_CLASS || len == 0) return 1 ;
+  n = array->m * array->n ;
+  for (i = 0 ; i < n && i + 1 < len ; ++i) {
+    buf[i] = (char) ((mxChar*)array->data)[i] ;
+  }
+  buf[i] = 0 ;
+  return i < n ;
+}
+
+mxArray *
+mxGetCell (mxArray const * array, mwIndex i)
+{
+  return ((mxArray**)array->data)[i] ;
+}
+
+void
+mxSetCell (mxArray * array, mwIndex i, mxArray * value)
+{
+  ((mxArray**)array->data)[i] = value ;
+}
+
+static int
+fieldIndex (mxArray const * array, char const * name)
+{
+  int f ;
+  for (f = 0 ; f < array->numFields ; ++f) {
+    if (strcmp(array->fieldNames[f], name) == 0) return f ;
+  }
+  return -1 ;
+}
+
+mxArray *
+mxGetField (mxArray const * array, mwIndex i, char const * name)
+{
+  int f ;
+  if (array->classID != mxSTRUCT_CLASS) return NULL ;
+  f = fieldIndex(array, name) ;
+  if (f < 0) return NULL ;
+  return ((mxArray**)array->data)[i * array->numFields + f] ;
+}
+
+void
+mxSetField (mxArray * array, mwIndex i, char const * name, mxArray * value)
+{
+  int f = fieldIndex(array, name) ;
+  if (f < 0) f = mxAddField(array, name) ;
+  ((mxArray**)array->data)[i * array->numFields + f] = value ;
+}
+
+int
+mxAddField (mxArray * array, char const * name)
+{
+  mwSize i, numel = array->m * array->n ;
+  int f, nf = array->numFields ;
+  mxArray ** data ;
+
+  if ((f = fieldIndex(array, name)) >= 0) return f ;
+
+  data = mxCalloc(numel * (nf + 1), sizeof(mxArray*)) ;
+  for (i = 0 ; i < numel ; ++i) {
+    for (f = 0 ; f < nf ; ++f) {
+      data[i * (nf + 1) + f] = ((mxArray**)array->data)[i * nf + f] ;
+    }
+  }
+  mxFree(array->data) ;
+  array->data = data ;
+  array->fieldNames = mxRealloc(array->fieldNames, sizeof(char*) * (nf + 1)) ;
+  array->fieldNames[nf] = strdupShim(name) ;
+  array->numFields = nf + 1 ;
+  return nf ;
+}
+
+int
+mxGetNumberOfFields (mxArray const * array)
+{
+  return array->numFields ;
+}
+
+mxArray *
+mxGetFieldByNumber (mxArray const * array, mwIndex i, int f)
+{
+  if (array->classID != mxSTRUCT_CLASS || f < 0 || f >= array->numFields) return NULL ;
+  return ((mxArray**)array->data)[i * array->numFields + f] ;
+}
+
+char const *
+mxGetFieldNameByNumber (mxArray const * array, int f)
+{
+  if (array->classID != mxSTRUCT_CLASS || f < 0 || f >= array->numFields) return NULL ;
+  return array->fieldNames[f] ;
+}
+
+size_t
+mxGetElementSize (mxArray const * array)
+{
+  /* unlike elementSize(), a structure element is one pointer */
+  return array->classID == mxSTRUCT_CLASS ? sizeof(mxArray*) : elementSize(array) ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                              MEX */
+/* ---------------------------------------------------------------- */
+
+void
+mexErrMsgTxt (char const * msg)
+{
+  fflush(stdout) ;
+  fprintf(stderr, "Error: %s\n", msg) ;
+  exit(1) ;
+}
+
+void
+mexWarnMsgTxt (char const * msg)
+{
+  fflush(stdout) ;
+  fprintf(stderr, "Warning: %s\n", msg) ;
+}
+
+int
+mexPrintf (char const * format, ...)
+{
+  int n ;
+  va_list args ;
+  va_start(args, format) ;
+  n = vprintf(format, args) ;
+  va_end(args) ;
+  return n ;
+}
+
+void
+mexSetTrapFlag (int flag)
+{
+  trapFlag = flag ;
+}
+
+mxArray *
+mexShimCreateFunctionHandle (char const * name, mexShimFunction fn, void * data)
+{
+  mxArray * array = newArray(mxFUNCTION_CLASS, 1, 1) ;
+  array->name = strdupShim(name) ;
+  array->fn = fn ;
+  array->fnData = data ;
+  return array ;
+}
+
+void
+mexShimRegisterFunction (char const * name, mexShimFunction fn, void * data)
+{
+  MexShimEntry * entry = mxMalloc(sizeof(MexShimEntry)) ;
+  entry->name = strdupShim(name) ;
+  entry->fn = fn ;
+  entry->data = data ;
+  entry->next = registry ;
+  registry = entry ;
+}
+
+void
+mexShimClearFunctions (void)
+{
+  while (registry) {
+    MexShimEntry * next = registry->next ;
+    mxFree(registry->name) ;
+    mxFree(registry) ;
+    registry = next ;
+  }
+}
+
+static int
+callShim (char const * name, mexShimFunction fn, void * data,
+          int nout, mxArray * out [], int nin, mxArray * in [])
+{
+  int status = fn(nout, out, nin, in, data) ;
+  if (status) {
+    snprintf(lastError, sizeof(lastError), "Error while executing '%s'", name) ;
+    if (! trapFlag) mexErrMsgTxt(lastError) ;
+  }
+  return status ;
+}
+
+int
+mexCallMATLAB (int nout, mxArray * out [],
+               int nin, mxArray * in [],
+               char const * name)
+{
+  MexShimEntry * entry ;
+
+  if (strcmp(name, "feval") == 0) {
+    if (nin < 1 || mxGetClassID(in[0]) != mxFUNCTION_CLASS) {
+      mexErrMsgTxt("feval: the first argument must be a function handle") ;
+    }
+    return callShim(in[0]->name, in[0]->fn, in[0]->fnData,
+                    nout, out, nin - 1, in + 1) ;
+  }
+
+  for (entry = registry ; entry ; entry = entry->next) {
+    if (strcmp(entry->name, name) == 0) {
+      return callShim(entry->name, entry->fn, entry->data,
+                      nout, out, nin, in) ;
+    }
+  }
+
+  /* the few MATLAB built-ins used for error reporting */
+  if (strcmp(name, "lasterror") == 0) {
+    if (nout > 0) out[0] = mxCreateString(lastError) ;
+    return 0 ;
+  }
+  if (strcmp(name, "disp") == 0) {
+    char buf [1024] ;
+    if (nin > 0 && mxIsChar(in[0])) {
+      mxGetString(in[0], buf, sizeof(buf)) ;
+      mexPrintf("%s\n", buf) ;
+    }
+    return 0 ;
+  }
+  if (strcmp(name, "error") == 0 || strcmp(name, "rethrow") == 0) {
+    mexErrMsgTxt(lastError) ;
+  }
+
+  snprintf(lastError, sizeof(lastError), "Undefined function '%s'", name) ;
+  if (! trapFlag) mexErrMsgTxt(lastError) ;
+  return 1 ;
+}
@@ -0,0 +1,162 @@
+/** file:   mex.h
+ ** brief:  Minimal stand-alone replacement of the MATLAB MEX API
+ ** author: Andrea Vedaldi
+ **/
+
+/*
+ This header replaces MATLAB's mex.h when SVM-struct is compiled
+ natively (see the `native` target in the Makefile). It implements the
+ small subset of the mx/mex API used by the MEX interface: double
+ (dense and sparse), logical, char, cell, struct and function-handle
+ arrays. mexCallMATLAB() is routed to C functions, either attached to
+ function handles (mexShimCreateFunctionHandle()) or registered by
+ name (mexShimRegisterFunction()).
+
+ Unlike MATLAB's, this allocator is the C library one and is
+ therefore thread safe.
+ */
+
+#ifndef MEX_SHIM_H
+#define MEX_SHIM_H
+
+/* like MATLAB's, this header pulls in the C library headers */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MEX_SHIM 1
+
+/* like MATLAB's, mexErrMsgTxt() does not return */
+#if defined(__GNUC__)
+#define MEX_SHIM_NORETURN __attribute__((noreturn))
+#elif defined(_MSC_VER)
+#define MEX_SHIM_NORETURN __declspec(noreturn)
+#else
+#define MEX_SHIM_NORETURN
+#endif
+
+typedef size_t mwSize ;
+typedef size_t mwIndex ;
+typedef unsigned char mxLogical ;
+typedef unsigned short mxChar ;
+
+typedef enum {
+  mxUNKNOWN_CLASS = 0,
+  mxCELL_CLASS,
+  mxSTRUCT_CLASS,
+  mxLOGICAL_CLASS,
+  mxCHAR_CLASS,
+  mxVOID_CLASS,
+  mxDOUBLE_CLASS,
+  mxSINGLE_CLASS,
+  mxINT8_CLASS,
+  mxUINT8_CLASS,
+  mxINT16_CLASS,
+  mxUINT16_CLASS,
+  mxINT32_CLASS,
+  mxUINT32_CLASS,
+  mxINT64_CLASS,
+  mxUINT64_CLASS,
+  mxFUNCTION_CLASS
+} mxClassID ;
+
+typedef enum { mxREAL = 0, mxCOMPLEX } mxComplexity ;
+
+typedef struct mxArray_ mxArray ;
+
+/** @brief Signature of a C function callable through mexCallMATLAB */
+typedef int (*mexShimFunction) (int nout, mxArray * out [],
+                                int nin, mxArray * in [],
+                                void * data) ;
+
+/* memory */
+void *    mxMalloc (size_t n) ;
+void *    mxCalloc (size_t n, size_t size) ;
+void *    mxRealloc (void * ptr, size_t n) ;
+void      mxFree (void * ptr) ;
+
+/* creation and destruction */
+mxArray * mxCreateDoubleMatrix (mwSize m, mwSize n, mxComplexity c) ;
+mxArray * mxCreateDoubleScalar (double x) ;
+mxArray * mxCreateSparse (mwSize m, mwSize n, mwSize nzmax, mxComplexity c) ;
+mxArray * mxCreateLogicalScalar (mxLogical x) ;
+mxArray * mxCreateString (char const * str) ;
+mxArray * mxCreateCellMatrix (mwSize m, mwSize n) ;
+mxArray * mxCreateStructMatrix (mwSize m, mwSize n, int nfields,
+                                char const ** fieldNames) ;
+mxArray * mxCreateStructArray (mwSize ndims, mwSize const * dims, int nfields,
+                               char const ** fieldNames) ;
+mxArray * mxDuplicateArray (mxArray const * array) ;
+void      mxDestroyArray (mxArray * array) ;
+
+/* inspection */
+mxClassID mxGetClassID (mxArray const * array) ;
+mwSize    mxGetM (mxArray const * array) ;
+mwSize    mxGetN (mxArray const * array) ;
+void      mxSetM (mxArray * array, mwSize m) ;
+void      mxSetN (mxArray * array, mwSize n) ;
+mwSize    mxGetNumberOfDimensions (mxArray const * array) ;
+mwSize    mxGetNumberOfElements (mxArray const * array) ;
+int       mxIsChar (mxArray const * array) ;
+int       mxIsDouble (mxArray const * array) ;
+int       mxIsComplex (mxArray const * array) ;
+int       mxIsSparse (mxArray const * array) ;
+int       mxIsCell (mxArray const * array) ;
+int       mxIsStruct (mxArray const * array) ;
+int       mxIsLogical (mxArray const * array) ;
+int       mxIsEmpty (mxArray const * array) ;
+
+/* data access */
+double *     mxGetPr (mxArray const * array) ;
+void         mxSetPr (mxArray * array, double * pr) ;
+void *       mxGetData (mxArray const * array) ;
+void         mxSetData (mxArray * array, void * data) ;
+mwIndex *    mxGetIr (mxArray const * array) ;
+mwIndex *    mxGetJc (mxArray const * array) ;
+void         mxSetIr (mxArray * array, mwIndex * ir) ;
+void         mxSetJc (mxArray * array, mwIndex * jc) ;
+mwSize       mxGetNzmax (mxArray const * array) ;
+mxLogical *  mxGetLogicals (mxArray const * array) ;
+double       mxGetScalar (mxArray const * array) ;
+int          mxGetString (mxArray const * array, char * buf, mwSize len) ;
+mxArray *    mxGetCell (mxArray const * array, mwIndex i) ;
+void         mxSetCell (mxArray * array, mwIndex i, mxArray * value) ;
+mxArray *    mxGetField (mxArray const * array, mwIndex i, char const * name) ;
+void         mxSetField (mxArray * array, mwIndex i, char const * name,
+                         mxArray * value) ;
+int          mxAddField (mxArray * array, char const * name) ;
+int          mxGetNumberOfFields (mxArray const * array) ;
+mxArray *    mxGetFieldByNumber (mxArray const * array, mwIndex i, int f) ;
+char const * mxGetFieldNameByNumber (mxArray const * array, int f) ;
+size_t       mxGetElementSize (mxArray const * array) ;
+
+/* MEX */
+MEX_SHIM_NORETURN void mexErrMsgTxt (char const * msg) ;
+void mexWarnMsgTxt (char const * msg) ;
+int  mexPrintf (char const * format, ...) ;
+void mexSetTrapFlag (int flag) ;
+int  mexCallMATLAB (int nout, mxArray * out [],
+                    int nin, mxArray * in [],
+                    char const * name) ;
+
+/* the MEX entry point implemented by the program */
+void mexFunction (int nout, mxArray ** out, int nin, mxArray const ** in) ;
+
+/* shim specific */
+mxArray * mexShimCreateFunctionHandle (char const * name,
+                                       mexShimFunction fn, void * data) ;
+void      mexShimRegisterFunction (char const * name,
+                                   mexShimFunction fn, void * data) ;
+void      mexShimClearFunctions (void) ;
+
+#ifdef __cplusplus
+}
+#endif
+
+/* MEX_SHIM_H */
+#endif
@@ -0,0 +1,473 @@
+/** file:   svm_struct_bench.c
+ ** brief:  Stand-alone benchmark of the SVM-struct MEX interface
+ ** author: Andrea Vedaldi
+ **/
+
+/*
+ This program drives svm_struct_learn's mexFunction() without MATLAB,
+ using the mx/mex shim in native/mex.c. The MATLAB callbacks are
+ replaced by C functions implementing a K-class linear SVM on
+ synthetic data (the same problem as test_svm_struct_learn.m, with
+ more classes and dimensions): PSI(X,Y) copies X into the Y-th block
+ of a K*D dimensional vector and the loss is the 0-1 loss.
+
+ Usage: svm_struct_bench [-n N] [-d D] [-k K] [-b] [-f] [-u] [-K] [-G]
+                         [-p PLUGIN] -- ARGS
+
+ where ARGS are the svm_struct_learn options (e.g. -c 1 -w 3), -b
+ sets PARM.BATCHCONSTRAINTFN, -f sets PARM.BATCHFEATUREFN, -u sets
+ PARM.FUSEDCONSTRAINTFN, -K sets PARM.KERNELBLOCKFN, -G sets
+ PARM.PATTERNGRAM and PARM.LABELGRAM instead of PARM.KERNELFN and -p sets
+ PARM.PLUGIN to the native plugin PLUGIN (see
+ svm_struct_bench_plugin.c). The
+ program prints the training time, the training error and the norm
+ of the learned model, which can be used to check that the hot paths
+ did not change the solution.
+ */
+
+#include "mex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+typedef struct Problem_
+{
+  int numExamples ;
+  int dimension ;
+  int numClasses ;
+  int batch ;
+  int batchFeature ;
+  int fused ;
+  int kernelBlock ;
+  int gram ;
+  char const * plugin ;
+  long numConstraintCalls ;
+  long numBatchConstraintCalls ;
+  long numFusedConstraintCalls ;
+  long numFeatureCalls ;
+  long numBatchFeatureCalls ;
+  long numLossCalls ;
+  long numKernelCalls ;
+  long numKernelBlockCalls ;
+} Problem ;
+
+static Problem problem ;
+
+/* ---------------------------------------------------------------- */
+/*                                                           Helpers */
+/* ---------------------------------------------------------------- */
+
+static unsigned long randState = 1 ;
+
+static double
+randUniform (void)
+{
+  randState = randState * 6364136223846793005UL + 1442695040888963407UL ;
+  return ((randState >> 11) & ((1UL << 53) - 1)) / (double)(1UL << 53) ;
+}
+
+static double
+randNormal (void)
+{
+  double u = randUniform() + 1e-12 ;
+  double v = randUniform() ;
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v) ;
+}
+
+static double
+getTime (void)
+{
+  struct timespec t ;
+  clock_gettime(CLOCK_MONOTONIC, &t) ;
+  return t.tv_sec + 1e-9 * t.tv_nsec ;
+}
+
+static int
+getLabel (mxArray const * y)
+{
+  return (int) mxGetScalar(y) ;
+}
+
+/* score of class c for pattern x under the m-th model */
+static double
+score (mxArray const * model, mwIndex m, mxArray const * x, int c)
+{
+  double const * xp = mxGetPr(x) ;
+  double s = 0 ;
+  int d, D = problem.dimension ;
+  mxArray const * w_array = mxGetField(model, m, "w") ;
+
+  if (w_array) {
+    double const * w = mxGetPr(w_array) + (c - 1) * D ;
+    for (d = 0 ; d < D ; ++d) s += w[d] * xp[d] ;
+  } else {
+    mxArray const * alpha_array = mxGetField(model, m, "alpha") ;
+    mxArray const * svPatterns = mxGetField(model, m, "svPatterns") ;
+    mxArray const * svLabels = mxGetField(model, m, "svLabels") ;
+    double const * alpha = mxGetPr(alpha_array) ;
+    mwSize k, numSVs = mxGetNumberOfElements(alpha_array) ;
+    for (k = 0 ; k < numSVs ; ++k) {
+      double const * xk ;
+      double dot = 0 ;
+      if (getLabel(mxGetCell(svLabels, k)) != c) continue ;
+      xk = mxGetPr(mxGetCell(svPatterns, k)) ;
+      for (d = 0 ; d < D ; ++d) dot += xk[d] * xp[d] ;
+      s += alpha[k] * dot ;
+    }
+  }
+  return s ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                         Callbacks */
+/* ---------------------------------------------------------------- */
+
+static int
+lossCB (int nout, mxArray * out [], int nin, mxArray * in [], void * data)
+{
+  /* in = {parm, y, ybar} */
+  problem.numLossCalls ++ ;
+  out[0] = mxCreateDoubleScalar(getLabel(in[1]) != getLabel(in[2])) ;
+  return 0 ;
+}
+
+static int
+constraintCB (int nout, mxArray * out [], int nin, mxArray * in [], void * data)
+{
+  /* in = {parm, model, x, y}, margin rescaling */
+  int c, best = 1, y = getLabel(in[3]) ;
+  double bestScore = - HUGE_VAL ;
+  problem.numConstraintCalls ++ ;
+  for (c = 1 ; c <= problem.numClasses ; ++c) {
+    double s = score(in[1], 0, in[2], c) + (c != y) ;
+    if (s > bestScore) { bestScore = s ; best = c ; }
+  }
+  out[0] = mxCreateDoubleScalar(best) ;
+  return 0 ;
+}
+
+static mxArray *
+newFeature (mxArray const * x_array, int y)
+{
+  int d, D = problem.dimension ;
+  double const * x = mxGetPr(x_array) ;
+  mxArray * psi = mxCreateSparse(D * problem.numClasses, 1, D, mxREAL) ;
+  double * pr = mxGetPr(psi) ;
+  mwIndex * ir = mxGetIr(psi) ;
+  mwIndex * jc = mxGetJc(psi) ;
+  for (d = 0 ; d < D ; ++d) {
+    pr[d] = x[d] ;
+    ir[d] = (y - 1) * D + d ;
+  }
+  jc[0] = 0 ;
+  jc[1] = D ;
+  return psi ;
+}
+
+static int
+fusedConstraintCB (int nout, mxArray * out [], int nin, mxArray * in [], void * data)
+{
+  /* in = {parm, model, x, y}, margin rescaling */
+  int c, best = 1, y = getLabel(in[3]) ;
+  double bestScore = - HUGE_VAL ;
+  problem.numFusedConstraintCalls ++ ;
+  for (c = 1 ; c <= problem.numClasses ; ++c) {
+    double s = score(in[1], 0, in[2], c) + (c != y) ;
+    if (s > bestScore) { bestScore = s ; best = c ; }
+  }
+  out[0] = mxCreateDoubleScalar(best) ;
+  out[1] = newFeature(in[2], best) ;
+  out[2] = mxCreateDoubleScalar(best != y) ;
+  return 0 ;
+}
+
+static int
+batchConstraintCB (int nout, mxArray * out [], int nin, mxArray * in [], void * data)
+{
+  /* in = {parm, model, patterns, labels}, margin rescaling */
+  mwSize i, n = mxGetNumberOfElements(in[2]) ;
+  problem.numBatchConstraintCalls ++ ;
+  out[0] = mxCreateCellMatrix(1, n) ;
+  for (i = 0 ; i < n ; ++i) {
+    int c, best = 1, y = getLabel(mxGetCell(in[3], i)) ;
+    double bestScore = - HUGE_VAL ;
+    for (c = 1 ; c <= problem.numClasses ; ++c) {
+      double s = score(in[1], 0, mxGetCell(in[2], i), c) + (c != y) ;
+      if (s > bestScore) { bestScore = s ; best = c ; }
+    }
+    mxSetCell(out[0], i, mxCreateDoubleScalar(best)) ;
+  }
+  return 0 ;
+}
+
+static int
+featureCB (int nout, mxArray * out [], int nin, mxArray * in [], void * data)
+{
+  /* in = {parm, x, y} */
+  problem.numFeatureCalls ++ ;
+  out[0] = newFeature(in[1], getLabel(in[2])) ;
+  return 0 ;
+}
+
+static int
+batchFeatureCB (int nout, mxArray * out [], int nin, mxArray * in [], void * data)
+{
+  /* in = {parm, patterns, labels} */
+  int d, D = problem.dimension ;
+  mwSize i, n = mxGetNumberOfElements(in[1]) ;
+  mxArray * psi = mxCreateSparse(D * problem.numClasses, n, D * n, mxREAL) ;
+  double * pr = mxGetPr(psi) ;
+  mwIndex * ir = mxGetIr(psi) ;
+  mwIndex * jc = mxGetJc(psi) ;
+  problem.numBatchFeatureCalls ++ ;
+  for (i = 0 ; i < n ; ++i) {
+    int y = getLabel(mxGetCell(in[2], i)) ;
+    double const * x = mxGetPr(mxGetCell(in[1], i)) ;
+    jc[i] = i * D ;
+    for (d = 0 ; d < D ; ++d) {
+      pr[i * D + d] = x[d] ;
+      ir[i * D + d] = (y - 1) * D + d ;
+    }
+  }
+  jc[n] = n * D ;
+  out[0] = psi ;
+  return 0 ;
+}
+
+static int
+kernelCB (int nout, mxArray * out [], int nin, mxArray * in [], void * data)
+{
+  /* in = {parm, x, y, xp, yp} */
+  double k = 0 ;
+  int d ;
+  problem.numKernelCalls ++ ;
+  if (getLabel(in[2]) == getLabel(in[4])) {
+    double const * x = mxGetPr(in[1]) ;
+    double const * xp = mxGetPr(in[3]) ;
+    for (d = 0 ; d < problem.dimension ; ++d) k += x[d] * xp[d] ;
+  }
+  out[0] = mxCreateDoubleScalar(k) ;
+  return 0 ;
+}
+
+static int
+kernelBlockCB (int nout, mxArray * out [], int nin, mxArray * in [], void * data)
+{
+  /* in = {parm, X1, Y1, X2, Y2} */
+  mwSize i, j, m = mxGetNumberOfElements(in[1]), n = mxGetNumberOfElements(in[3]) ;
+  double * k ;
+  int d ;
+  problem.numKernelBlockCalls ++ ;
+  out[0] = mxCreateDoubleMatrix(m, n, mxREAL) ;
+  k = mxGetPr(out[0]) ;
+  for (j = 0 ; j < n ; ++j) {
+    double const * xp = mxGetPr(mxGetCell(in[3], j)) ;
+    int yp = getLabel(mxGetCell(in[4], j)) ;
+    for (i = 0 ; i < m ; ++i) {
+      double const * x = mxGetPr(mxGetCell(in[1], i)) ;
+      double s = 0 ;
+      if (getLabel(mxGetCell(in[2], i)) != yp) continue ;
+      for (d = 0 ; d < problem.dimension ; ++d) s += x[d] * xp[d] ;
+      k[i + m * j] = s ;
+    }
+  }
+  return 0 ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                             Driver */
+/* ---------------------------------------------------------------- */
+
+int
+main (int argc, char ** argv)
+{
+  char args [1024] = "" ;
+  char const * fieldNames [] = {"patterns", "labels", "dimension",
+                                "lossFn", "constraintFn", "featureFn",
+                                "kernelFn"} ;
+  mxArray * parm ;
+  mxArray * patterns ;
+  mxArray * labels ;
+  mxArray * centers ;
+  mxArray * in [2] ;
+  mxArray * out [1] ;
+  mxArray const * w_array ;
+  mwSize m ;
+  int i, d, errors = 0 ;
+  double t0, t1, wnorm = 0 ;
+
+  problem.numExamples = 2000 ;
+  problem.dimension = 64 ;
+  problem.numClasses = 10 ;
+
+  for (i = 1 ; i < argc ; ++i) {
+    if (strcmp(argv[i], "--") == 0) { ++i ; break ; }
+    else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) problem.numExamples = atoi(argv[++i]) ;
+    else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) problem.dimension = atoi(argv[++i]) ;
+    else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) problem.numClasses = atoi(argv[++i]) ;
+    else if (strcmp(argv[i], "-b") == 0) problem.batch = 1 ;
+    else if (strcmp(argv[i], "-f") == 0) problem.batchFeature = 1 ;
+    else if (strcmp(argv[i], "-u") == 0) problem.fused = 1 ;
+    else if (strcmp(argv[i], "-K") == 0) problem.kernelBlock = 1 ;
+    else if (strcmp(argv[i], "-G") == 0) problem.gram = 1 ;
+    else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) problem.plugin = argv[++i] ;
+    else {
+      fprintf(stderr, "usage: %s [-n N] [-d D] [-k K] [-b] [-f] [-u] [-K] [-G] [-p PLUGIN] -- ARGS\n", argv[0]) ;
+      return 1 ;
+    }
+  }
+  for ( ; i < argc ; ++i) {
+    strncat(args, " ", sizeof(args) - strlen(args) - 1) ;
+    strncat(args, argv[i], sizeof(args) - strlen(args) - 1) ;
+  }
+  if (strlen(args) == 0) strcpy(args, "-c 1.0 -w 3") ;
+
+  /* generate data: each class is a Gaussian blob */
+  centers = mxCreateDoubleMatrix(problem.dimension, problem.numClasses, mxREAL) ;
+  for (i = 0 ; i < problem.dimension * problem.numClasses ; ++i) {
+    mxGetPr(centers)[i] = randNormal() ;
+  }
+  patterns = mxCreateCellMatrix(1, problem.numExamples) ;
+  labels = mxCreateCellMatrix(1, problem.numExamples) ;
+  for (i = 0 ; i < problem.numExamples ; ++i) {
+    int y = 1 + (int)(randUniform() * problem.numClasses) ;
+    mxArray * x = mxCreateDoubleMatrix(problem.dimension, 1, mxREAL) ;
+    for (d = 0 ; d < problem.dimension ; ++d) {
+      mxGetPr(x)[d] = mxGetPr(centers)[(y - 1) * problem.dimension + d]
+        + 1.5 * randNormal() ;
+    }
+    mxSetCell(patterns, i, x) ;
+    mxSetCell(labels, i, mxCreateDoubleScalar(y)) ;
+  }
+
+  parm = mxCreateStructMatrix(1, 1, sizeof(fieldNames) / sizeof(fieldNames[0]), fieldNames) ;
+  mxSetField(parm, 0, "patterns", patterns) ;
+  mxSetField(parm, 0, "labels", labels) ;
+  mxSetField(parm, 0, "dimension",
+             mxCreateDoubleScalar(problem.dimension * problem.numClasses)) ;
+  mxSetField(parm, 0, "lossFn", mexShimCreateFunctionHandle("lossCB", lossCB, NULL)) ;
+  mxSetField(parm, 0, "constraintFn", mexShimCreateFunctionHandle("constraintCB", constraintCB, NULL)) ;
+  mxSetField(parm, 0, "featureFn", mexShimCreateFunctionHandle("featureCB", featureCB, NULL)) ;
+  mxSetField(parm, 0, "kernelFn", mexShimCreateFunctionHandle("kernelCB", kernelCB, NULL)) ;
+  if (problem.batch) {
+    mxAddField(parm, "batchConstraintFn") ;
+    mxSetField(parm, 0, "batchConstraintFn",
+               mexShimCreateFunctionHandle("batchConstraintCB", batchConstraintCB, NULL)) ;
+  }
+  if (problem.plugin) {
+    char options [256] ;
+    snprintf(options, sizeof(options), "%d %d %d", problem.numExamples,
+             problem.dimension, problem.numClasses) ;
+    mxAddField(parm, "plugin") ;
+    mxSetField(parm, 0, "plugin", mxCreateString(problem.plugin)) ;
+    mxAddField(parm, "pluginOptions") ;
+    mxSetField(parm, 0, "pluginOptions", mxCreateString(options)) ;
+  }
+  if (problem.fused) {
+    mxAddField(parm, "fusedConstraintFn") ;
+    mxSetField(parm, 0, "fusedConstraintFn",
+               mexShimCreateFunctionHandle("fusedConstraintCB", fusedConstraintCB, NULL)) ;
+  }
+  if (problem.gram) {
+    /* K((x,y),(x',y')) = <x,x'> [y = y'] */
+    mxArray * patternGram = mxCreateDoubleMatrix(problem.numExamples, problem.numExamples, mxREAL) ;
+    mxArray * labelGram = mxCreateDoubleMatrix(problem.numClasses, problem.numClasses, mxREAL) ;
+    int j ;
+    for (i = 0 ; i < problem.numExamples ; ++i) {
+      for (j = 0 ; j < problem.numExamples ; ++j) {
+        double const * xi = mxGetPr(mxGetCell(patterns, i)) ;
+        double const * xj = mxGetPr(mxGetCell(patterns, j)) ;
+        double s = 0 ;
+        for (d = 0 ; d < problem.dimension ; ++d) s += xi[d] * xj[d] ;
+        mxGetPr(patternGram)[i + problem.numExamples * j] = s ;
+      }
+    }
+    for (i = 0 ; i < problem.numClasses ; ++i) {
+      mxGetPr(labelGram)[i * (problem.numClasses + 1)] = 1 ;
+    }
+    mxDestroyArray(mxGetField(parm, 0, "kernelFn")) ;
+    mxSetField(parm, 0, "kernelFn", NULL) ;
+    mxAddField(parm, "patternGram") ;
+    mxSetField(parm, 0, "patternGram", patternGram) ;
+    mxAddField(parm, "labelGram") ;
+    mxSetField(parm, 0, "labelGram", labelGram) ;
+  }
+  if (problem.kernelBlock) {
+    mxAddField(parm, "kernelBlockFn") ;
+    mxSetField(parm, 0, "kernelBlockFn",
+               mexShimCreateFunctionHandle("kernelBlockCB", kernelBlockCB, NULL)) ;
+  }
+  if (problem.batchFeature) {
+    mxAddField(parm, "batchFeatureFn") ;
+    mxSetField(parm, 0, "batchFeatureFn",
+               mexShimCreateFunctionHandle("batchFeatureCB", batchFeatureCB, NULL)) ;
+  }
+
+  /* train */
+  in[0] = mxCreateString(args) ;
+  in[1] = parm ;
+  t0 = getTime() ;
+  mexFunction(1, out, 2, (mxArray const **) in) ;
+  t1 = getTime() ;
+
+  printf("args:            %s\n", args) ;
+  printf("examples:        %d (%d dims, %d classes)\n",
+         problem.numExamples, problem.dimension, problem.numClasses) ;
+  printf("training time:   %.3f s\n", t1 - t0) ;
+
+  /* evaluate each model (one per value of C) */
+  for (m = 0 ; m < mxGetNumberOfElements(out[0]) ; ++m) {
+    errors = 0 ;
+    wnorm = 0 ;
+    for (i = 0 ; i < problem.numExamples ; ++i) {
+      mxArray * x = mxGetCell(patterns, i) ;
+      int c, best = 1, y = getLabel(mxGetCell(labels, i)) ;
+      double bestScore = - HUGE_VAL ;
+      for (c = 1 ; c <= problem.numClasses ; ++c) {
+        double s = score(out[0], m, x, c) ;
+        if (s > bestScore) { bestScore = s ; best = c ; }
+      }
+      errors += (best != y) ;
+    }
+    w_array = mxGetField(out[0], m, "w") ;
+    if (w_array) {
+      for (i = 0 ; i < (int) mxGetNumberOfElements(w_array) ; ++i) {
+        wnorm += mxGetPr(w_array)[i] * mxGetPr(w_array)[i] ;
+      }
+    } else {
+      mxArray const * alpha_array = mxGetField(out[0], m, "alpha") ;
+      mxArray const * svPatterns = mxGetField(out[0], m, "svPatterns") ;
+      mxArray const * svLabels = mxGetField(out[0], m, "svLabels") ;
+      mwSize j, k, n = mxGetNumberOfElements(alpha_array) ;
+      for (j = 0 ; j < n ; ++j) {
+        for (k = 0 ; k < n ; ++k) {
+          double dot = 0 ;
+          if (getLabel(mxGetCell(svLabels, j)) != getLabel(mxGetCell(svLabels, k))) continue ;
+          for (d = 0 ; d < problem.dimension ; ++d) {
+            dot += mxGetPr(mxGetCell(svPatterns, j))[d] * mxGetPr(mxGetCell(svPatterns, k))[d] ;
+          }
+          wnorm += mxGetPr(alpha_array)[j] * mxGetPr(alpha_array)[k] * dot ;
+        }
+      }
+    }
+
+    printf("training error:  %.2f%%\n", 100.0 * errors / problem.numExamples) ;
+    printf("model norm^2:    %.6g\n", wnorm) ;
+  }
+  printf("callbacks:       %ld constraint (%ld batch, %ld fused), "
+         "%ld feature (%ld batch), %ld loss, %ld kernel (%ld block)\n",
+         problem.numConstraintCalls, problem.numBatchConstraintCalls,
+         problem.numFusedConstraintCalls,
+         problem.numFeatureCalls, problem.numBatchFeatureCalls,
+         problem.numLossCalls, problem.numKernelCalls,
+         problem.numKernelBlockCalls) ;
+
+  mxDestroyArray(out[0]) ;
+  mxDestroyArray(in[0]) ;
+  mxDestroyArray(parm) ;
+  mxDestroyArray(centers) ;
+  return 0 ;
+}
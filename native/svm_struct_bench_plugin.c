@@ -0,0 +1,147 @@
+/** file:   svm_struct_bench_plugin.c
+ ** brief:  Native oracle plugin implementing the benchmark problem
+ ** author: Andrea Vedaldi
+ **/
+
+/*
+ This plugin implements the same K-class problem as
+ svm_struct_bench.c (see svm_struct_plugin.h for the ABI). The
+ options string is "N D K" and the data is generated with the same
+ random generator, so that svm_struct_bench -p can compare the plugin
+ and the MATLAB callback paths.
+ */
+
+#include "../svm_struct_plugin.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+typedef struct State_
+{
+  long numExamples ;
+  int dimension ;
+  int numClasses ;
+  double * patterns ;
+  long * labels ;
+} State ;
+
+static unsigned long randState = 1 ;
+
+static double
+randUniform (void)
+{
+  randState = randState * 6364136223846793005UL + 1442695040888963407UL ;
+  return ((randState >> 11) & ((1UL << 53) - 1)) / (double)(1UL << 53) ;
+}
+
+static double
+randNormal (void)
+{
+  double u = randUniform() + 1e-12 ;
+  double v = randUniform() ;
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v) ;
+}
+
+static void *
+benchInit (char const * options, long * numExamples, long * sizePsi)
+{
+  State * s = calloc(1, sizeof(State)) ;
+  double * centers ;
+  long i ;
+  int d ;
+  if (sscanf(options, "%ld %d %d", &s->numExamples, &s->dimension, &s->numClasses) != 3) {
+    free(s) ;
+    return NULL ;
+  }
+  randState = 1 ;
+  centers = malloc(sizeof(double) * s->dimension * s->numClasses) ;
+  for (i = 0 ; i < s->dimension * s->numClasses ; ++i) centers[i] = randNormal() ;
+  s->patterns = malloc(sizeof(double) * s->dimension * s->numExamples) ;
+  s->labels = malloc(sizeof(long) * s->numExamples) ;
+  for (i = 0 ; i < s->numExamples ; ++i) {
+    long y = 1 + (long)(randUniform() * s->numClasses) ;
+    s->labels[i] = y ;
+    for (d = 0 ; d < s->dimension ; ++d) {
+      s->patterns[i * s->dimension + d] = centers[(y - 1) * s->dimension + d]
+        + 1.5 * randNormal() ;
+    }
+  }
+  free(centers) ;
+  *numExamples = s->numExamples ;
+  *sizePsi = (long) s->dimension * s->numClasses ;
+  return s ;
+}
+
+static void
+benchExit (void * state)
+{
+  State * s = state ;
+  free(s->patterns) ;
+  free(s->labels) ;
+  free(s) ;
+}
+
+static void
+benchExample (void * state, long i, void ** x, void ** y)
+{
+  State * s = state ;
+  *x = s->patterns + i * s->dimension ;
+  *y = s->labels + i ;
+}
+
+static long
+benchPsi (void * state, void const * x, void const * y,
+          long * index, double * value, long capacity)
+{
+  State * s = state ;
+  double const * xp = x ;
+  long c = *(long const *) y ;
+  int d ;
+  if (capacity < s->dimension) return s->dimension ;
+  for (d = 0 ; d < s->dimension ; ++d) {
+    index[d] = (c - 1) * s->dimension + d ;
+    value[d] = xp[d] ;
+  }
+  return s->dimension ;
+}
+
+static double
+benchLoss (void * state, void const * y, void const * ybar)
+{
+  return *(long const *) y != *(long const *) ybar ;
+}
+
+static void *
+benchArgmax (void * state, double const * w, long sizePsi,
+             void const * x, void const * y, int lossType)
+{
+  State * s = state ;
+  double const * xp = x ;
+  double bestScore = - HUGE_VAL ;
+  long c, best = 1, * ybar ;
+  int d ;
+  for (c = 1 ; c <= s->numClasses ; ++c) {
+    double score = 0 ;
+    for (d = 0 ; d < s->dimension ; ++d) {
+      score += w[(c - 1) * s->dimension + d] * xp[d] ;
+    }
+    if (lossType && c != *(long const *) y) score += 1 ;
+    if (score > bestScore) { bestScore = score ; best = c ; }
+  }
+  ybar = malloc(sizeof(long)) ;
+  *ybar = best ;
+  return ybar ;
+}
+
+static void
+benchFreeLabel (void * state, void * y)
+{
+  free(y) ;
+}
+
+SVM_STRUCT_PLUGIN svm_struct_plugin = {
+  SVM_STRUCT_PLUGIN_ABI_VERSION,
+  benchInit, benchExit, benchExample, benchPsi, benchLoss, benchArgmax,
+  benchFreeLabel
+} ;
@@ -35,28 +35,184 @@
 
 #include "../svm_struct_api_types.h" 
 
-double custom_kernel(KERNEL_PARM *kernel_parm, SVECTOR *a, SVECTOR *b)
-     /* plug in you favorite kernel */
+/* ------------------------------------------------------------------ */
+/*                                                        Kernel memo */
+/* ------------------------------------------------------------------ */
+
+#define KERNEL_MEMO_WAYS 4
+
+typedef struct kernel_memo_entry {
+  uint64_t keya, keyb;         /* keys of the two phis, keya <= keyb */
+  double   value;              /* kernel value */
+  uint32_t stamp;              /* time of last use, 0 if empty */
+} KERNEL_MEMO_ENTRY;
+
+struct MexKernelMemoImpl_ {
+  KERNEL_MEMO_ENTRY *entries;  /* numsets x KERNEL_MEMO_WAYS entries */
+  uint64_t numsets;            /* a power of two */
+  uint32_t time;
+  double   hits, misses;
+};
+
+MexKernelMemo newMexKernelMemo(double sizeMB)
+{
+  MexKernelMemo memo;
+  uint64_t numsets=1;
+  double maxsets=sizeMB*1024*1024
+                 /(sizeof(KERNEL_MEMO_ENTRY)*KERNEL_MEMO_WAYS);
+
+  if(maxsets < 1) return(NULL);
+  while(2.0*numsets <= maxsets) numsets*=2;
+  memo=(MexKernelMemo)my_malloc(sizeof(struct MexKernelMemoImpl_));
+  memo->entries=(KERNEL_MEMO_ENTRY *)
+    mxCalloc(numsets*KERNEL_MEMO_WAYS,sizeof(KERNEL_MEMO_ENTRY));
+  memo->numsets=numsets;
+  memo->time=0;
+  memo->hits=0;
+  memo->misses=0;
+  return(memo);
+}
+
+void deleteMexKernelMemo(MexKernelMemo memo)
+{
+  if(memo) {
+    free(memo->entries);
+    free(memo);
+  }
+}
+
+void MexKernelMemoGetStatistics(MexKernelMemo memo, double *hits,
+				double *misses)
+{
+  *hits=memo ? memo->hits : 0;
+  *misses=memo ? memo->misses : 0;
+}
+
+static uint32_t kernel_memo_tick(MexKernelMemo memo)
+{
+  if(++memo->time == 0) memo->time=1; /* 0 marks empty entries */
+  return(memo->time);
+}
+
+static KERNEL_MEMO_ENTRY *kernel_memo_set(MexKernelMemo memo, 
+					  uint64_t *keya, uint64_t *keyb)
+     /* orders the keys and returns the set where the pair is stored */
+{
+  uint64_t h;
+  if(*keya > *keyb) { h=*keya; *keya=*keyb; *keyb=h; }
+  h=(*keya)*0x9E3779B97F4A7C15ULL ^ (*keyb);
+  h^=h >> 29;
+  h*=0xBF58476D1CE4E5B9ULL;
+  h^=h >> 32;
+  return(memo->entries+(h & (memo->numsets-1))*KERNEL_MEMO_WAYS);
+}
+
+static int kernel_memo_lookup(MexKernelMemo memo, MexPhiCustom a, 
+			      MexPhiCustom b, double *value)
+     /* returns 1 and the memoized value of the pair if present */
+{
+  KERNEL_MEMO_ENTRY *set;
+  uint64_t keya,keyb;
+  int w;
+
+  if((!memo) || (!a) || (!b) || (!a->hasKey) || (!b->hasKey)) return(0);
+  keya=a->key; keyb=b->key;
+  set=kernel_memo_set(memo,&keya,&keyb);
+  for(w=0;w<KERNEL_MEMO_WAYS;w++) {
+    if(set[w].stamp && (set[w].keya == keya) && (set[w].keyb == keyb)) {
+      set[w].stamp=kernel_memo_tick(memo);
+      (*value)=set[w].value;
+      memo->hits++;
+      return(1);
+    }
+  }
+  memo->misses++;
+  return(0);
+}
+
+static void kernel_memo_insert(MexKernelMemo memo, MexPhiCustom a, 
+			       MexPhiCustom b, double value)
+     /* stores the value of the pair, evicting the least recently
+	used entry of its set */
+{
+  KERNEL_MEMO_ENTRY *set;
+  uint64_t keya,keyb;
+  int w,victim=0;
+
+  if((!memo) || (!a) || (!b) || (!a->hasKey) || (!b->hasKey)) return;
+  keya=a->key; keyb=b->key;
+  set=kernel_memo_set(memo,&keya,&keyb);
+  for(w=0;w<KERNEL_MEMO_WAYS;w++) {
+    if(set[w].stamp < set[victim].stamp) victim=w;
+  }
+  set[victim].keya=keya;
+  set[victim].keyb=keyb;
+  set[victim].value=value;
+  set[victim].stamp=kernel_memo_tick(memo);
+}
+
+/* ------------------------------------------------------------------ */
+/*                                                   MATLAB callbacks */
+/* ------------------------------------------------------------------ */
+
+static void call_kernel_block_fn(KERNEL_PARM *kernel_parm, 
+				 MexPhiCustom *a, long na,
+				 MexPhiCustom *b, long nb, double *k)
 {
-  mxArray* structParm_array ;
-  mxArray* kernelFn_array ;
   mxArray* args [6] ;
   mxArray* k_array ;
-  double k  ;
+  long i ;
   int status ;
+  MexKernelInfo* info = (MexKernelInfo*) kernel_parm -> custom ;
 
-  {
-    MexKernelInfo* info = (MexKernelInfo*) kernel_parm -> custom ;
-    structParm_array = (mxArray*) info -> structParm ; 
-    kernelFn_array = (mxArray*) info -> kernelFn ;
+  args[0] = (mxArray*) info -> kernelBlockFn ;
+  args[1] = (mxArray*) info -> structParm ;
+  args[2] = mxCreateCellMatrix (1, na) ;
+  args[3] = mxCreateCellMatrix (1, na) ;
+  args[4] = mxCreateCellMatrix (1, nb) ;
+  args[5] = mxCreateCellMatrix (1, nb) ;
+  for (i = 0 ; i < na ; ++i) {
+    mxSetCell (args[2], i, MexPhiCustomGetPattern (a[i])) ;
+    mxSetCell (args[3], i, MexPhiCustomGetLabel (a[i])) ;
+  }
+  for (i = 0 ; i < nb ; ++i) {
+    mxSetCell (args[4], i, MexPhiCustomGetPattern (b[i])) ;
+    mxSetCell (args[5], i, MexPhiCustomGetLabel (b[i])) ;
   }
 
-  args[0] = kernelFn_array ;
-  args[1] = structParm_array ;
-  args[2] = MexPhiCustomGetPattern (a->userdefined) ;
-  args[3] = MexPhiCustomGetLabel (a->userdefined) ;
-  args[4] = MexPhiCustomGetPattern (b->userdefined) ;
-  args[5] = MexPhiCustomGetLabel (b->userdefined) ;
+  status = mexCallMATLAB(1, &k_array, 6, args, "feval") ;
+
+  for (i = 2 ; i < 6 ; ++i) {
+    destroyMxArrayEncapsulatingCell (args[i]) ;
+  }
+  if (status) {
+    mexErrMsgTxt("Error while executing SPARM.KERNELBLOCKFN") ;
+  }
+  if (! uIsReal(k_array) || mxIsSparse(k_array) ||
+      mxGetM(k_array) != na || mxGetN(k_array) != nb) {
+    mexErrMsgTxt("SPARM.KERNELBLOCKFN must return a full real matrix "
+                 "of size numel(X1) x numel(X2)") ;
+  }
+
+  memcpy (k, mxGetPr(k_array), sizeof(double) * na * nb) ;
+  mxDestroyArray (k_array) ;
+}
+
+static double call_kernel_fn(KERNEL_PARM *kernel_parm, 
+			     MexPhiCustom a, MexPhiCustom b)
+{
+  mxArray* args [6] ;
+  mxArray* k_array ;
+  double k  ;
+  int status ;
+  MexKernelInfo* info = (MexKernelInfo*) kernel_parm -> custom ;
+
+  args[0] = (mxArray*) info -> kernelFn ;
+  args[1] = (mxArray*) info -> structParm ;
+  args[2] = MexPhiCustomGetPattern (a) ;
+  args[3] = MexPhiCustomGetLabel (a) ;
+  args[4] = MexPhiCustomGetPattern (b) ;
+  args[5] = MexPhiCustomGetLabel (b) ;
 
   status = mexCallMATLAB(1, &k_array, 6, args, "feval") ;
 
@@ -72,3 +228,109 @@ double custom_kernel(KERNEL_PARM *kernel_parm, SVECTOR *a, SVECTOR *b)
 
   return (k) ;
 }
+
+static double call_label_kernel_fn(KERNEL_PARM *kernel_parm, 
+				   MexPhiCustom a, MexPhiCustom b)
+{
+  mxArray* args [4] ;
+  mxArray* k_array ;
+  double k  ;
+  int status ;
+  MexKernelInfo* info = (MexKernelInfo*) kernel_parm -> custom ;
+
+  args[0] = (mxArray*) info -> gram -> labelKernelFn ;
+  args[1] = (mxArray*) info -> structParm ;
+  args[2] = MexPhiCustomGetLabel (a) ;
+  args[3] = MexPhiCustomGetLabel (b) ;
+
+  status = mexCallMATLAB(1, &k_array, 4, args, "feval") ;
+
+  if (status) {
+    mexErrMsgTxt("Error while executing SPARM.LABELKERNELFN") ;
+  }
+  if (mxGetClassID(k_array) == mxUNKNOWN_CLASS) {
+    mexErrMsgTxt("SPARM.LABELKERNELFN did not return a result") ;
+  }
+
+  k = mxGetScalar (k_array) ;
+  mxDestroyArray (k_array) ;
+
+  return (k) ;
+}
+
+static long label_gram_index(MexKernelGram const *gram, MexPhiCustom phi)
+{
+  mxArray const *y=MexPhiCustomGetLabel(phi);
+  double v;
+  if(uIsRealScalar(y)) {
+    v=mxGetScalar(y);
+    if((v == floor(v)) && (v >= 1) && (v <= gram->numLabels))
+      return((long)v-1);
+  }
+  mexErrMsgTxt("Labels must be integers in the range 1,...,"
+	       "size(SPARM.LABELGRAM,1) if SPARM.LABELGRAM is used") ;
+  return(-1);
+}
+
+/* ------------------------------------------------------------------ */
+/*                                                      Custom kernel */
+/* ------------------------------------------------------------------ */
+
+int custom_kernel_block(KERNEL_PARM *kernel_parm, MexPhiCustom *a, long na,
+                        MexPhiCustom *b, long nb, double *k)
+     /* computes the na x nb matrix k (column major) of the kernel
+        values between a[i] and b[j] with a single call to
+        SPARM.KERNELBLOCKFN. Returns 0 if the latter is not defined
+        or if the kernel is given by SPARM.PATTERNGRAM. The memo is
+        not used here: looking up each pair costs about as much as
+        computing it in a vectorised callback. */
+{
+  MexKernelInfo* info = (MexKernelInfo*) kernel_parm -> custom ;
+  if (! info -> kernelBlockFn || info -> gram) return 0 ;
+  if (na > 0 && nb > 0) {
+    call_kernel_block_fn (kernel_parm, a, na, b, nb, k) ;
+  }
+  return 1 ;
+}
+
+double custom_kernel(KERNEL_PARM *kernel_parm, SVECTOR *a, SVECTOR *b)
+     /* plug in you favorite kernel */
+{
+  MexKernelInfo* info = (MexKernelInfo*) kernel_parm -> custom ;
+  MexKernelGram const* gram = info -> gram ;
+  MexPhiCustom pa = a->userdefined, pb = b->userdefined ;
+  int factored = gram && pa && pb && pa->index >= 0 && pb->index >= 0 ;
+  double k = 0 ;
+
+  /* vectors without a phi, such as the origin used by
+     estimate_r_delta_average(), are zero */
+  if (! pa || ! pb) return (0) ;
+
+  /* a factored kernel given by tables is a product of two lookups */
+  if (factored && gram -> label) {
+    k = gram -> pattern [pa->index + gram -> numPatterns * pb->index] ;
+    if (k == 0) return (k) ;
+    return (k * gram -> label [label_gram_index (gram, pa) +
+                               gram -> numLabels * label_gram_index (gram, pb)]) ;
+  }
+
+  if (kernel_memo_lookup (info -> memo, pa, pb, &k)) {
+    return (k) ;
+  }
+
+  if (factored) {
+    k = gram -> pattern [pa->index + gram -> numPatterns * pb->index] ;
+    if (k != 0) k *= call_label_kernel_fn (kernel_parm, pa, pb) ;
+  } else if (! info -> kernelFn && ! info -> kernelBlockFn) {
+    mexErrMsgTxt("SPARM.KERNELFN or SPARM.KERNELBLOCKFN is required to "
+                 "evaluate the kernel of patterns not in SPARM.PATTERNS") ;
+  } else if (info -> kernelFn) {
+    k = call_kernel_fn (kernel_parm, pa, pb) ;
+  } else {
+    /* only SPARM.KERNELBLOCKFN is available */
+    call_kernel_block_fn (kernel_parm, &pa, 1, &pb, 1, &k) ;
+  }
+
+  kernel_memo_insert (info -> memo, pa, pb, k) ;
+  return (k) ;
+}
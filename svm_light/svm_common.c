@@ -19,13 +19,16 @@
 # include "ctype.h"
 # include "svm_common.h"
 # include "kernel.h"           /* this contains a user supplied kernel */
+# ifdef _OPENMP
+# include <omp.h>
+# endif
 
 #define MAX(x,y)      ((x) < (y) ? (y) : (x))
 #define MIN(x,y)      ((x) > (y) ? (y) : (x))
 #define SIGN(x)       ((x) > (0) ? (1) : (((x) < (0) ? (-1) : (0))))
 
-long   verbosity;              /* verbosity level (0-4) */
-long   kernel_cache_statistic;
+SVM_THREAD_LOCAL long verbosity;  /* verbosity level (0-4) */
+SVM_THREAD_LOCAL long kernel_cache_statistic;
 
 double classify_example(MODEL *model, DOC *ex) 
      /* classifies one example */
@@ -37,8 +40,13 @@ double classify_example(MODEL *model, DOC *ex)
     return(classify_example_linear(model,ex));
 	   
   dist=0;
-  for(i=1;i<model->sv_num;i++) {  
-    dist+=kernel(&model->kernel_parm,model->supvec[i],ex)*model->alpha[i];
+  if(model->sv_num > 1) {
+    double *k=(double *)my_malloc(sizeof(double)*model->sv_num);
+    kernel_row(&model->kernel_parm,ex,model->supvec+1,model->sv_num-1,k);
+    for(i=1;i<model->sv_num;i++) {  
+      dist+=k[i-1]*model->alpha[i];
+    }
+    free(k);
   }
   return(dist-model->b);
 }
@@ -62,8 +70,12 @@ double classify_example_linear(MODEL *model, DOC *ex)
 }
 
 
-double kernel(KERNEL_PARM *kernel_parm, DOC *a, DOC *b) 
-     /* calculate the kernel function */
+static double single_kernel_value(KERNEL_PARM *, SVECTOR *, SVECTOR *);
+
+static double kernel_value(KERNEL_PARM *kernel_parm, DOC *a, DOC *b,
+			   long *evals)
+     /* calculate the kernel function, adding the number of kernel
+	evaluations to evals */
 {
   double sum=0;
   SVECTOR *fa,*fb;
@@ -81,17 +93,163 @@ double kernel(KERNEL_PARM *kernel_parm, DOC *a, DOC *b)
      take the kernel between all pairs */ 
   for(fa=a->fvec;fa;fa=fa->next) { 
     for(fb=b->fvec;fb;fb=fb->next) {
-      if(fa->kernel_id == fb->kernel_id)
-	sum+=fa->factor*fb->factor*single_kernel(kernel_parm,fa,fb);
+      if(fa->kernel_id == fb->kernel_id) {
+	sum+=fa->factor*fb->factor*single_kernel_value(kernel_parm,fa,fb);
+	(*evals)++;
+      }
     }
   }
   return(sum);
 }
 
+double kernel(KERNEL_PARM *kernel_parm, DOC *a, DOC *b) 
+     /* calculate the kernel function */
+{
+  long evals=0;
+  double sum=kernel_value(kernel_parm,a,b,&evals);
+  kernel_cache_statistic+=evals;
+  return(sum);
+}
+
+static int compare_phi(const void *a, const void *b)
+{
+  size_t pa=(size_t)(*(MexPhiCustom const *)a);
+  size_t pb=(size_t)(*(MexPhiCustom const *)b);
+  return((pa > pb) - (pa < pb));
+}
+
+static long unique_phis(MexPhiCustom *phis, long n)
+     /* sorts phis and removes the duplicates, returns their number */
+{
+  long i,m=0;
+  qsort(phis,n,sizeof(MexPhiCustom),compare_phi);
+  for(i=0;i<n;i++)
+    if((m == 0) || (phis[m-1] != phis[i]))
+      phis[m++]=phis[i];
+  return(m);
+}
+
+static long find_phi(MexPhiCustom *phis, long n, MexPhiCustom phi)
+{
+  MexPhiCustom *p;
+  p=(MexPhiCustom *)bsearch(&phi,phis,n,sizeof(MexPhiCustom),compare_phi);
+  return(p-phis);
+}
+
+void kernel_row(KERNEL_PARM *kernel_parm, DOC *a, DOC **b, long n, 
+		double *k) 
+     /* calculates the kernel between a and each of b[0..n-1]. For
+	custom kernels the distinct pairs of feature vectors are
+	evaluated by custom_kernel_block() with one call per tile of
+	KERNEL_BLOCK_SIZE values, if SPARM.KERNELBLOCKFN is given.
+	Feature vectors without a phi are zero and are skipped. */
+{
+  long i,j,i0,na,nb,nua,nub,*ia;
+  SVECTOR *fa,*fb;
+  MexPhiCustom *ua,*ub;
+  double *block;
+
+  if((kernel_parm->kernel_type != CUSTOM) || (n == 0)
+     || (!((MexKernelInfo *)kernel_parm->custom)->kernelBlockFn)) {
+    for(i=0;i<n;i++)
+      k[i]=kernel(kernel_parm,a,b[i]);
+    return;
+  }
+
+  for(na=0,fa=a->fvec;fa;fa=fa->next) na++;
+  ua=(MexPhiCustom *)my_malloc(sizeof(MexPhiCustom)*(na+1));
+  ia=(long *)my_malloc(sizeof(long)*(na+1));
+  for(na=0,fa=a->fvec;fa;fa=fa->next)
+    if(fa->userdefined) ua[na++]=fa->userdefined;
+  nua=unique_phis(ua,na);
+  for(na=0,fa=a->fvec;fa;fa=fa->next)
+    ia[na++]=fa->userdefined ? find_phi(ua,nua,fa->userdefined) : -1;
+
+  for(i0=0;i0<n;i0=i) {
+    /* gather a tile of rows b[i0..i-1] */
+    nb=0;
+    for(i=i0;i<n;i++) {
+      for(j=0,fb=b[i]->fvec;fb;fb=fb->next) j++;
+      if((i > i0) && ((nb+j)*nua > KERNEL_BLOCK_SIZE)) break;
+      nb+=j;
+    }
+    ub=(MexPhiCustom *)my_malloc(sizeof(MexPhiCustom)*(nb+1));
+    for(nb=0,j=i0;j<i;j++)
+      for(fb=b[j]->fvec;fb;fb=fb->next)
+	if(fb->userdefined) ub[nb++]=fb->userdefined;
+    nub=unique_phis(ub,nb);
+    block=(double *)my_malloc(sizeof(double)*(nua*nub+1));
+    custom_kernel_block(kernel_parm,ua,nua,ub,nub,block);
+    kernel_cache_statistic+=nua*nub;
+    for(j=i0;j<i;j++) {
+      k[j]=0;
+      for(fb=b[j]->fvec;fb;fb=fb->next) {
+	double *col;
+	if(!fb->userdefined) continue;
+	col=block+nua*find_phi(ub,nub,fb->userdefined);
+	for(na=0,fa=a->fvec;fa;fa=fa->next,na++)
+	  if((fa->kernel_id == fb->kernel_id) && (ia[na] >= 0))
+	    k[j]+=fa->factor*fb->factor*col[ia[na]];
+      }
+    }
+    free(block);
+    free(ub);
+  }
+  free(ia);
+  free(ua);
+}
+
+void kernel_row_par(KERNEL_PARM *kernel_parm, DOC *a, DOC **b, long n, 
+		    double *k, long num_threads) 
+     /* same as kernel_row, but splits b[0..n-1] into num_threads
+	ranges computed in parallel. Only the built-in kernels, which
+	do not call back into MATLAB, are computed in parallel, and
+	the values of an explicit gram matrix are just looked up. */
+{
+  long i,c,num_chunks,*evals;
+  SVECTOR *f;
+
+  num_chunks=minl(get_num_threads(num_threads),n);
+  if((kernel_parm->kernel_type == CUSTOM) 
+     || (kernel_parm->kernel_type == GRAM) || (num_chunks <= 1)) {
+    kernel_row(kernel_parm,a,b,n,k);
+    return;
+  }
+
+  /* the rbf kernel caches the norms in the vectors, compute them
+     here so that the threads only read them */
+  if(kernel_parm->kernel_type == RBF) {
+    for(f=a->fvec;f;f=f->next)
+      if(f->twonorm_sq<0) f->twonorm_sq=sprod_ss(f,f);
+    for(i=0;i<n;i++)
+      for(f=b[i]->fvec;f;f=f->next)
+	if(f->twonorm_sq<0) f->twonorm_sq=sprod_ss(f,f);
+  }
+
+  evals=(long *)my_malloc(sizeof(long)*num_chunks);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static,1) num_threads(num_chunks) private(i)
+#endif
+  for(c=0;c<num_chunks;c++) {
+    evals[c]=0;
+    for(i=(n*c)/num_chunks;i<(n*(c+1))/num_chunks;i++)
+      k[i]=kernel_value(kernel_parm,a,b[i],&evals[c]);
+  }
+  for(c=0;c<num_chunks;c++)
+    kernel_cache_statistic+=evals[c];
+  free(evals);
+}
+
 double single_kernel(KERNEL_PARM *kernel_parm, SVECTOR *a, SVECTOR *b) 
      /* calculate the kernel function between two vectors */
 {
   kernel_cache_statistic++;
+  return(single_kernel_value(kernel_parm,a,b));
+}
+
+static double single_kernel_value(KERNEL_PARM *kernel_parm, SVECTOR *a,
+				  SVECTOR *b) 
+{
   switch(kernel_parm->kernel_type) {
     case LINEAR: /* linear */ 
             return(sprod_ss(a,b)); 
@@ -188,6 +346,62 @@ SVECTOR *create_svector_n_r(double *nonsparsevec, long maxfeatnum, MexPhiCustom
   return(vec);
 }
 
+SVECTOR *create_svector_n_r_par(double *nonsparsevec, long maxfeatnum, MexPhiCustom userdefined, double factor, double min_non_zero, long num_threads)
+     /* same as create_svector_n_r, but the features are split into
+	num_threads ranges that are counted and copied in parallel */
+{
+  SVECTOR *vec;
+  long    num_chunks,c,i;
+  long    *fnum;
+
+  num_chunks=MAX(1,minl(get_num_threads(num_threads),maxfeatnum));
+  if(num_chunks == 1)
+    return(create_svector_n_r(nonsparsevec,maxfeatnum,userdefined,factor,
+			      min_non_zero));
+
+  /* count the non-zero features in each range */
+  fnum=(long *)my_malloc(sizeof(long)*(num_chunks+1));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static,1) num_threads(num_chunks) private(i)
+#endif
+  for(c=0;c<num_chunks;c++) {
+    fnum[c+1]=0;
+    for(i=1+(maxfeatnum*c)/num_chunks;i<=(maxfeatnum*(c+1))/num_chunks;i++)
+      if((nonsparsevec[i]<-min_non_zero) || (nonsparsevec[i]>min_non_zero))
+	fnum[c+1]++;
+  }
+  fnum[0]=0;
+  for(c=0;c<num_chunks;c++)
+    fnum[c+1]+=fnum[c];
+
+  /* copy each range to its offset */
+  vec = (SVECTOR *)my_malloc(sizeof(SVECTOR));
+  vec->words = (WORD *)my_malloc(sizeof(WORD)*(fnum[num_chunks]+1));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static,1) num_threads(num_chunks) private(i)
+#endif
+  for(c=0;c<num_chunks;c++) {
+    WORD *w=vec->words+fnum[c];
+    for(i=1+(maxfeatnum*c)/num_chunks;i<=(maxfeatnum*(c+1))/num_chunks;i++)
+      if((nonsparsevec[i]<-min_non_zero) || (nonsparsevec[i]>min_non_zero)) {
+	w->wnum=i;
+	w->weight=nonsparsevec[i];
+	w++;
+      }
+  }
+  vec->words[fnum[num_chunks]].wnum=0;
+  vec->twonorm_sq=-1;
+  free(fnum);
+
+  retainMexPhiCustom(userdefined) ;
+  vec->userdefined = userdefined ;
+
+  vec->kernel_id=0;
+  vec->next=NULL;
+  vec->factor=factor;
+  return(vec);
+}
+
 SVECTOR *copy_svector(SVECTOR *vec)
 {
   SVECTOR *newvec=NULL;
@@ -1622,6 +1836,8 @@ void set_learning_defaults(LEARN_PARM *learn_parm, KERNEL_PARM *kernel_parm)
   learn_parm->type=CLASSIFICATION;
   strcpy (learn_parm->predfile, "trans_predictions");
   strcpy (learn_parm->alphafile, "");
+  learn_parm->qp_solver=NULL;
+  learn_parm->qp_state=NULL;
   learn_parm->biased_hyperplane=1;
   learn_parm->sharedslack=0;
   learn_parm->remove_inconsistent=0;
@@ -1642,6 +1858,7 @@ void set_learning_defaults(LEARN_PARM *learn_parm, KERNEL_PARM *kernel_parm)
   learn_parm->compute_loo=0;
   learn_parm->rho=1.0;
   learn_parm->xa_depth=0;
+  learn_parm->num_threads=1;
   kernel_parm->kernel_type=LINEAR;
   kernel_parm->poly_degree=3;
   kernel_parm->rbf_gamma=1.0;
@@ -1759,6 +1976,20 @@ long maxl(long int a, long int b)
     return(b);
 }
 
+long get_num_threads(long requested)
+{
+  /* returns the number of threads to use for the parallel parts of
+     learning, which is always 1 if OpenMP is not available. The
+     work is split by the number of threads requested rather than
+     the number of processors, so that results do not depend on
+     the machine. */
+# ifdef _OPENMP
+  return(maxl(1,requested));
+# else
+  return(1);
+# endif
+}
+
 double get_runtime(void)
 {
   /* returns the current processor time in hundredth of a second */
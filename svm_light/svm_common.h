@@ -26,11 +26,24 @@
 #define realloc(x,y) (mxRealloc((x),(y)))
 #define free(x) (mxFree(x))
 
+#ifdef _MSC_VER
+typedef __int32 int32_t;
+typedef unsigned __int32 uint32_t;
+typedef __int64 int64_t;
+typedef unsigned __int64 uint64_t;
+#else
+#include <stdint.h>
+#endif
+
 struct MexPhiCustomImpl_
 {
   int counter ;
   mxArray * x ;
   mxArray * y ;
+  long slot ;     /* position in the exported kernel expansion or -1 */
+  long index ;    /* index of the training pattern x or -1 */
+  uint64_t key ;  /* fingerprint of (example index, label) */
+  int hasKey ;    /* whether key is valid */
 } ;
 
 typedef struct MexPhiCustomImpl_ * MexPhiCustom ;
@@ -49,6 +62,10 @@ newMexPhiCustomFromPatternLabel (mxArray const * x, mxArray const *y)
   phi -> counter = 1 ;
   phi -> x = mxDuplicateArray (x) ;
   phi -> y = mxDuplicateArray (y) ;
+  phi -> slot = -1 ;
+  phi -> index = -1 ;
+  phi -> key = 0 ;
+  phi -> hasKey = 0 ;
   return phi ;
 }
 
@@ -86,14 +103,6 @@ MexPhiCustomGetLabel (MexPhiCustom phi) {
 
 # include <stdio.h>
 
-#ifdef _MSC_VER
-typedef __int32 int32_t;
-typedef unsigned __int32 uint32_t;
-typedef __int64 int64_t;
-typedef unsigned __int64 uint64_t;
-#else
-#include <stdint.h>
-#endif
 
 # include <ctype.h>
 # include <math.h>
@@ -120,6 +129,9 @@ typedef unsigned __int64 uint64_t;
 # define SIGMOID 3           /* sigmoid kernel type */
 # define CUSTOM  4           /* userdefined kernel function from kernel.h */
 # define GRAM    5           /* use explicit gram matrix from kernel_parm */
+# define KERNEL_BLOCK_SIZE 1048576 /* maximum number of kernel values
+                                      computed by one call to
+                                      custom_kernel_block() */
 
 # define CLASSIFICATION 1    /* train classification model */
 # define REGRESSION     2    /* train regression model */
@@ -244,6 +256,15 @@ typedef struct learn_parm {
   long   xa_depth;             /* parameter in xi/alpha-estimates upper
 				  bounding the number of SV the current
 				  alpha_t is distributed over */
+  long   num_threads;          /* number of threads used by the
+				  parallel parts of learning */
+  struct qp_solver *qp_solver; /* state of the QP solver kept across
+				  trainings, or NULL to use a private
+				  one for each (see create_qp_solver) */
+  struct qp_state *qp_state;   /* state of svm_learn_optimization kept
+				  across calls on a growing set of
+				  constraints, or NULL (see
+				  create_qp_state) */
   char predfile[200];          /* file for predicitions on unlabeled examples
 				  in transduction */
   char alphafile[200];         /* file to store optimal alphas in. use  
@@ -321,6 +342,21 @@ typedef struct quadratic_program {
   double *opt_low,*opt_up; /* box constraints */
 } QP;
 
+/* State of the QP solver, which adapts across calls. Each training
+   that runs concurrently with others needs its own. */
+typedef struct qp_solver {
+  double *primal;          /* solution, returned by optimize_qp */
+  double *dual;            /* dual variables */
+  long   *nonoptimal;      /* buffer */
+  double *buffer;          /* buffer */
+  long   precision_violations;
+  double opt_precision;
+  long   maxiter;          /* maximum number of iterations */
+  double lindep_sensitivity; /* epsilon for detecting linear dependent ex */
+  long   smallroundcount;  /* number of rounds with two variables */
+  long   roundnumber;      /* number of calls */
+} QP_SOLVER;
+
 typedef struct kernel_cache {
   long   *index;  /* cache some kernel evalutations */
   CFLOAT *buffer; /* to improve speed */
@@ -357,6 +393,26 @@ typedef struct shrink_state {
   double *last_lin;    /* for shrinking with linear kernel */
 } SHRINK_STATE;
 
+/* State of svm_learn_optimization kept across calls, when the
+   constraints of each call are those of the previous one (less the
+   ones removed with remove_from_qp_state) followed by new ones. The
+   linear component of the gradient is kept, so that only the kernel
+   rows of the new and of the changed variables are computed. */
+typedef struct qp_state {
+  long   totdoc;           /* number of variables of the last call,
+			      0 if they must be computed from scratch */
+  long   size;             /* allocated size of the arrays */
+  DOC    **docs;           /* constraints of the last call */
+  long   *label;
+  long   *unlabeled;
+  long   *inconsistent;
+  double *a;               /* alphas at the end of the last call */
+  double *lin;             /* linear component of the gradient */
+  double *c;
+  double *svm_cost;
+  SHRINK_STATE shrink_state;
+} QP_STATE;
+
 typedef struct randpair {
   long   val,sort;
 } RANDPAIR;
@@ -364,12 +420,17 @@ typedef struct randpair {
 double classify_example(MODEL *, DOC *);
 double classify_example_linear(MODEL *, DOC *);
 double kernel(KERNEL_PARM *, DOC *, DOC *); 
+void   kernel_row(KERNEL_PARM *, DOC *, DOC **, long, double *);
+void   kernel_row_par(KERNEL_PARM *, DOC *, DOC **, long, double *, long);
 double single_kernel(KERNEL_PARM *, SVECTOR *, SVECTOR *); 
 double custom_kernel(KERNEL_PARM *, SVECTOR *, SVECTOR *); 
+int    custom_kernel_block(KERNEL_PARM *, MexPhiCustom *, long,
+                           MexPhiCustom *, long, double *);
 SVECTOR *create_svector(WORD *, MexPhiCustom, double);
 SVECTOR *create_svector_shallow(WORD *, MexPhiCustom, double);
 SVECTOR *create_svector_n(double *, long, MexPhiCustom, double);
 SVECTOR *create_svector_n_r(double *, long, MexPhiCustom, double, double);
+SVECTOR *create_svector_n_r_par(double *, long, MexPhiCustom, double, double, long);
 SVECTOR *copy_svector(SVECTOR *);
 SVECTOR *copy_svector_shallow(SVECTOR *);
 void   free_svector(SVECTOR *);
@@ -439,6 +500,7 @@ int    check_learning_parms(LEARN_PARM *, KERNEL_PARM *);
 void   nol_ll(char *, long *, long *, long *);
 long   minl(long, long);
 long   maxl(long, long);
+long   get_num_threads(long);
 double get_runtime(void);
 int    space_or_null(int);
 void   *my_malloc(size_t); 
@@ -447,7 +509,15 @@ void   copyright_notice(void);
    int isnan(double);
 # endif
 
-extern long   verbosity;              /* verbosity level (0-4) */
-extern long   kernel_cache_statistic;
+/* The global state is private to each thread, so that several
+   trainings can run concurrently in different threads. */
+# if defined(_MSC_VER)
+#  define SVM_THREAD_LOCAL __declspec(thread)
+# else
+#  define SVM_THREAD_LOCAL __thread
+# endif
+
+extern SVM_THREAD_LOCAL long verbosity;  /* verbosity level (0-4) */
+extern SVM_THREAD_LOCAL long kernel_cache_statistic;
 
 #endif
@@ -50,17 +50,8 @@
 # define EPSILON_HIDEO          1E-20
 # define EPSILON_EQ             1E-5
 
-double *optimize_qp(QP *, double *, long, double *, LEARN_PARM *);
-double *primal=0,*dual=0;
-long   precision_violations=0;
-double opt_precision=DEF_PRECISION;
-long   maxiter=DEF_MAX_ITERATIONS;
-double lindep_sensitivity=DEF_LINDEP_SENSITIVITY;
-double *buffer;
-long   *nonoptimal;
-
-long  smallroundcount=0;
-long  roundnumber=0;
+double *optimize_qp(QP *, double *, long, double *, LEARN_PARM *,
+		    QP_SOLVER *);
 
 /* /////////////////////////////////////////////////////////////// */
 
@@ -68,7 +59,8 @@ void *my_malloc();
 
 int optimize_hildreth_despo(long,long,double,double,double,long,long,long,double,double *,
 			    double *,double *,double *,double *,double *,
-			    double *,double *,double *,long *,double *,double *);
+			    double *,double *,double *,long *,double *,double *,
+			    long);
 int solve_dual(long,long,double,double,long,double *,double *,double *,
 	       double *,double *,double *,double *,double *,double *,
 	       double *,double *,double *,double *,long);
@@ -83,34 +75,42 @@ void lswitchrk_matrix(double *, long, long, long);
 double calculate_qp_objective(long, double *, double *, double *);
 
 
-void init_qp_solver()
+QP_SOLVER *create_qp_solver()
+     /* creates the state of the QP solver, which is kept between the
+	calls to optimize_qp. Each training that runs concurrently
+	with others needs its own. */
 {
-  primal = 0 ;
-  dual = 0 ;
-  precision_violations = 0 ;
-  opt_precision = DEF_PRECISION ;
-  maxiter = DEF_MAX_ITERATIONS ;
-  lindep_sensitivity = DEF_LINDEP_SENSITIVITY ;
-  buffer = 0 ;
-  nonoptimal = 0 ;
-  smallroundcount = 0 ;
-  roundnumber = 0 ;
+  QP_SOLVER *solver=(QP_SOLVER *)my_malloc(sizeof(QP_SOLVER));
+  solver->primal=0;
+  solver->dual=0;
+  solver->nonoptimal=0;
+  solver->buffer=0;
+  solver->precision_violations=0;
+  solver->opt_precision=DEF_PRECISION;
+  solver->maxiter=DEF_MAX_ITERATIONS;
+  solver->lindep_sensitivity=DEF_LINDEP_SENSITIVITY;
+  solver->smallroundcount=0;
+  solver->roundnumber=0;
+  return(solver);
 }
 
-void free_qp_solver()
+void free_qp_solver(QP_SOLVER *solver)
 {
-  if(buffer) {free(buffer) ; buffer = 0 ;}
-  if(nonoptimal) {free(nonoptimal) ; nonoptimal = 0; }
-  if(dual) {free(dual) ; dual = 0 ;}
-  if(primal) {free(primal) ; primal = 0;}
+  if(!solver) return;
+  if(solver->buffer) free(solver->buffer);
+  if(solver->nonoptimal) free(solver->nonoptimal);
+  if(solver->dual) free(solver->dual);
+  if(solver->primal) free(solver->primal);
+  free(solver);
 }
 
-double *optimize_qp(qp,epsilon_crit,nx,threshold,learn_parm)
+double *optimize_qp(qp,epsilon_crit,nx,threshold,learn_parm,solver)
 QP *qp;
 double *epsilon_crit;
 long nx; /* Maximum number of variables in QP */
 double *threshold; 
 LEARN_PARM *learn_parm;
+QP_SOLVER *solver; /* state kept between calls (see create_qp_solver) */
 /* start the optimizer and return the optimal values */
 /* The HIDEO optimizer does not necessarily fully solve the problem. */
 /* Since it requires a strictly positive definite hessian, the solution */
@@ -121,18 +121,18 @@ LEARN_PARM *learn_parm;
   int result;
   double eq,progress;
 
-  roundnumber++;
+  solver->roundnumber++;
 
-  if(!primal) { /* allocate memory at first call */
-    primal=(double *)my_malloc(sizeof(double)*nx);
-    dual=(double *)my_malloc(sizeof(double)*((nx+1)*2));
-    nonoptimal=(long *)my_malloc(sizeof(long)*(nx));
-    buffer=(double *)my_malloc(sizeof(double)*((nx+1)*2*(nx+1)*2+
+  if(!solver->primal) { /* allocate memory at first call */
+    solver->primal=(double *)my_malloc(sizeof(double)*nx);
+    solver->dual=(double *)my_malloc(sizeof(double)*((nx+1)*2));
+    solver->nonoptimal=(long *)my_malloc(sizeof(long)*(nx));
+    solver->buffer=(double *)my_malloc(sizeof(double)*((nx+1)*2*(nx+1)*2+
 					       nx*nx+2*(nx+1)*2+2*nx+1+2*nx+
 					       nx+nx+nx*nx));
     (*threshold)=0;
     for(i=0;i<nx;i++) {
-      primal[i]=0;
+      solver->primal[i]=0;
     }
   }
 
@@ -158,14 +158,15 @@ LEARN_PARM *learn_parm;
   }
 
   result=optimize_hildreth_despo(qp->opt_n,qp->opt_m,
-				 opt_precision,(*epsilon_crit),
-				 learn_parm->epsilon_a,maxiter,
+				 solver->opt_precision,(*epsilon_crit),
+				 learn_parm->epsilon_a,solver->maxiter,
 				 /* (long)PRIMAL_OPTIMAL, */
 				 (long)0, (long)0,
-				 lindep_sensitivity,
+				 solver->lindep_sensitivity,
 				 qp->opt_g,qp->opt_g0,qp->opt_ce,qp->opt_ce0,
-				 qp->opt_low,qp->opt_up,primal,qp->opt_xinit,
-				 dual,nonoptimal,buffer,&progress);
+				 qp->opt_low,qp->opt_up,solver->primal,qp->opt_xinit,
+				 solver->dual,solver->nonoptimal,solver->buffer,&progress,
+				 solver->smallroundcount);
   if(verbosity>=3) { 
     printf("return(%d)...",result);
   }
@@ -176,50 +177,51 @@ LEARN_PARM *learn_parm;
   }
 
   if(result == NAN_SOLUTION) {
-    lindep_sensitivity*=2;  /* throw out linear dependent examples more */
+    solver->lindep_sensitivity*=2;  /* throw out linear dependent examples more */
                             /* generously */
     if(learn_parm->svm_maxqpsize>2) {
       learn_parm->svm_maxqpsize--;  /* decrease size of qp-subproblems */
     }
-    precision_violations++;
+    solver->precision_violations++;
   }
 
   /* take one round of only two variable to get unstuck */
-  if((result != PRIMAL_OPTIMAL) || (!(roundnumber % 31)) || (progress <= 0)) {
+  if((result != PRIMAL_OPTIMAL) || (!(solver->roundnumber % 31)) || (progress <= 0)) {
 
-    smallroundcount++;
+    solver->smallroundcount++;
 
     result=optimize_hildreth_despo(qp->opt_n,qp->opt_m,
-				   opt_precision,(*epsilon_crit),
-				   learn_parm->epsilon_a,(long)maxiter,
+				   solver->opt_precision,(*epsilon_crit),
+				   learn_parm->epsilon_a,(long)solver->maxiter,
 				   (long)PRIMAL_OPTIMAL,(long)SMALLROUND,
-				   lindep_sensitivity,
+				   solver->lindep_sensitivity,
 				   qp->opt_g,qp->opt_g0,qp->opt_ce,qp->opt_ce0,
-				   qp->opt_low,qp->opt_up,primal,qp->opt_xinit,
-				   dual,nonoptimal,buffer,&progress);
+				   qp->opt_low,qp->opt_up,solver->primal,qp->opt_xinit,
+				   solver->dual,solver->nonoptimal,solver->buffer,&progress,
+				   solver->smallroundcount);
     if(verbosity>=3) { 
       printf("return_srd(%d)...",result);
     }
 
     if(result != PRIMAL_OPTIMAL) {
       if(result != ONLY_ONE_VARIABLE) 
-	precision_violations++;
+	solver->precision_violations++;
       if(result == MAXITER_EXCEEDED) 
-	maxiter+=100;
+	solver->maxiter+=100;
       if(result == NAN_SOLUTION) {
-	lindep_sensitivity*=2;  /* throw out linear dependent examples more */
+	solver->lindep_sensitivity*=2;  /* throw out linear dependent examples more */
 	                        /* generously */
 	/* results not valid, so return inital values */
 	for(i=0;i<qp->opt_n;i++) {
-	  primal[i]=qp->opt_xinit[i];
+	  solver->primal[i]=qp->opt_xinit[i];
 	}
       }
     }
   }
 
 
-  if(precision_violations > 50) {
-    precision_violations=0;
+  if(solver->precision_violations > 50) {
+    solver->precision_violations=0;
     (*epsilon_crit)*=10.0; 
     if(verbosity>=1) {
       printf("\nWARNING: Relaxing epsilon on KT-Conditions (%f).\n",
@@ -227,8 +229,8 @@ LEARN_PARM *learn_parm;
     }
   }	  
 
-  if((qp->opt_m>0) && (result != NAN_SOLUTION) && (!isnan(dual[1]-dual[0])))
-    (*threshold)=dual[1]-dual[0];
+  if((qp->opt_m>0) && (result != NAN_SOLUTION) && (!isnan(solver->dual[1]-solver->dual[0])))
+    (*threshold)=solver->dual[1]-solver->dual[0];
   else
     (*threshold)=0;
 
@@ -236,28 +238,29 @@ LEARN_PARM *learn_parm;
     printf("\n\n");
     eq=qp->opt_ce0[0];
     for(i=0;i<qp->opt_n;i++) {
-      eq+=primal[i]*qp->opt_ce[i];
+      eq+=solver->primal[i]*qp->opt_ce[i];
       printf("%f: ",qp->opt_g0[i]);
       for(j=0;j<qp->opt_n;j++) {
 	printf("%f ",qp->opt_g[i*qp->opt_n+j]);
       }
-      printf(": a=%.30f",primal[i]);
-      printf(": nonopti=%ld",nonoptimal[i]);
+      printf(": a=%.30f",solver->primal[i]);
+      printf(": nonopti=%ld",solver->nonoptimal[i]);
       printf(": y=%f\n",qp->opt_ce[i]);
     }
     printf("eq-constraint=%.30f\n",eq);
     printf("b=%f\n",(*threshold));
-    printf(" smallroundcount=%ld ",smallroundcount);
+    printf(" smallroundcount=%ld ",solver->smallroundcount);
   }
 
-  return(primal);
+  return(solver->primal);
 }
 
 
 
 int optimize_hildreth_despo(n,m,precision,epsilon_crit,epsilon_a,maxiter,goal,
 			    smallround,lindep_sensitivity,g,g0,ce,ce0,low,up,
-			    primal,init,dual,lin_dependent,buffer,progress)
+			    primal,init,dual,lin_dependent,buffer,progress,
+			    smallroundcount)
      long   n;            /* number of variables */
      long   m;            /* number of linear equality constraints [0,1] */
      double precision;    /* solve at least to this dual precision */
@@ -278,6 +281,7 @@ int optimize_hildreth_despo(n,m,precision,epsilon_crit,epsilon_a,maxiter,goal,
      double *buffer;
      double *progress;    /* delta in the objective function between
                              before and after */
+     long   smallroundcount; /* number of small rounds so far */
 {
   long i,j,k,from,to,n_indep,changed;
   double sum,bmin=0,bmax=0;
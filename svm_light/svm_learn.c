@@ -25,7 +25,14 @@
 #define SIGN(x)       ((x) > (0) ? (1) : (((x) < (0) ? (-1) : (0))))
 
 /* interface to QP-solver */
-double *optimize_qp(QP *, double *, long, double *, LEARN_PARM *);
+double *optimize_qp(QP *, double *, long, double *, LEARN_PARM *,
+		    QP_SOLVER *);
+
+static long resize_qp_state(QP_STATE *, DOC **, long);
+static long add_to_dense_factor(double *, long, double *, long *, long, 
+				long, double);
+static void remove_from_dense_factor(double *, long, long *, long, long);
+static void solve_dense_factor(double *, long, long, double *);
 
 /*---------------------------------------------------------------------------*/
 
@@ -197,17 +204,19 @@ void svm_learn_classification(DOC **docs, double *class, long int
       for(i=0;i<totdoc;i++)     /* fill kernel cache with unbounded SV */
 	if((alpha[i]>0) && (alpha[i]<learn_parm->svm_cost[i]) 
 	   && (kernel_cache_space_available(kernel_cache))) 
-	  cache_kernel_row(kernel_cache,docs,i,kernel_parm);
+	  cache_kernel_row(kernel_cache,docs,i,kernel_parm,
+			   learn_parm->num_threads);
       for(i=0;i<totdoc;i++)     /* fill rest of kernel cache with bounded SV */
 	if((alpha[i]==learn_parm->svm_cost[i]) 
 	   && (kernel_cache_space_available(kernel_cache))) 
-	  cache_kernel_row(kernel_cache,docs,i,kernel_parm);
+	  cache_kernel_row(kernel_cache,docs,i,kernel_parm,
+			   learn_parm->num_threads);
     }
     clear_nvector(weights,totwords); /* set weights to zero */
     (void)compute_index(index,totdoc,index2dnum);
     update_linear_component(docs,label,index2dnum,alpha,a,index2dnum,totdoc,
 			    totwords,kernel_parm,kernel_cache,lin,aicache,
-			    weights);
+			    weights,learn_parm->num_threads);
     (void)calculate_svm_model(docs,label,unlabeled,lin,alpha,a,c,
 			      learn_parm,index2dnum,index2dnum,model);
     for(i=0;i<totdoc;i++) {    /* copy initial alphas */
@@ -902,12 +911,14 @@ void svm_learn_optimization(DOC **docs, double *rhs, long int
   long iterations,maxslackid,svsetnum;
   long *unlabeled,*inconsistent;
   double r_delta_avg;
-  long *index,*index2dnum;
-  double *weights,*slack,*alphaslack;
+  long *index,*index2dnum,*new2dnum;
+  double *weights,*slack,*alphaslack,*a_zero;
   CFLOAT *aicache;  /* buffer to keep one row of hessian */
+  QP_STATE *state;  /* state kept from the last call or NULL */
+  long known;       /* number of variables known from the last call */
 
   TIMING timing_profile;
-  SHRINK_STATE shrink_state;
+  SHRINK_STATE private_shrink_state,*shrink_state;
 
   runtime_start=get_runtime();
   timing_profile.time_kernel=0;
@@ -927,15 +938,31 @@ void svm_learn_optimization(DOC **docs, double *rhs, long int
     learn_parm->svm_newvarsinqp=learn_parm->svm_maxqpsize;
   }
 
-  init_shrink_state(&shrink_state,totdoc,(long)MAXSHRINK);
-
-  label = (long *)my_malloc(sizeof(long)*totdoc);
-  unlabeled = (long *)my_malloc(sizeof(long)*totdoc);
-  inconsistent = (long *)my_malloc(sizeof(long)*totdoc);
-  c = (double *)my_malloc(sizeof(double)*totdoc);
-  a = (double *)my_malloc(sizeof(double)*totdoc);
-  lin = (double *)my_malloc(sizeof(double)*totdoc);
-  learn_parm->svm_cost = (double *)my_malloc(sizeof(double)*totdoc);
+  /* the state of the last call can be used only to warm start */
+  state=alpha ? learn_parm->qp_state : NULL;
+  if(state) {
+    known=resize_qp_state(state,docs,totdoc);
+    shrink_state=&state->shrink_state;
+    label=state->label;
+    unlabeled=state->unlabeled;
+    inconsistent=state->inconsistent;
+    c=state->c;
+    a=state->a;
+    lin=state->lin;
+    learn_parm->svm_cost=state->svm_cost;
+  }
+  else {
+    known=0;
+    init_shrink_state(&private_shrink_state,totdoc,(long)MAXSHRINK);
+    shrink_state=&private_shrink_state;
+    label = (long *)my_malloc(sizeof(long)*totdoc);
+    unlabeled = (long *)my_malloc(sizeof(long)*totdoc);
+    inconsistent = (long *)my_malloc(sizeof(long)*totdoc);
+    c = (double *)my_malloc(sizeof(double)*totdoc);
+    a = (double *)my_malloc(sizeof(double)*totdoc);
+    lin = (double *)my_malloc(sizeof(double)*totdoc);
+    learn_parm->svm_cost = (double *)my_malloc(sizeof(double)*totdoc);
+  }
   model->supvec = (DOC **)my_malloc(sizeof(DOC *)*(totdoc+2));
   model->alpha = (double *)my_malloc(sizeof(double)*(totdoc+2));
   model->index = (long *)my_malloc(sizeof(long)*(totdoc+2));
@@ -956,8 +983,8 @@ void svm_learn_optimization(DOC **docs, double *rhs, long int
   model->xa_recall=-1;
   model->xa_precision=-1;
 
-  r_delta_avg=estimate_r_delta_average(docs,totdoc,kernel_parm);
   if(learn_parm->svm_c == 0.0) {  /* default value for C */
+    r_delta_avg=estimate_r_delta_average(docs,totdoc,kernel_parm);
     learn_parm->svm_c=1.0/(r_delta_avg*r_delta_avg);
     if(verbosity>=1) 
       printf("Setting default regularization parameter C=%.4f\n",
@@ -972,8 +999,10 @@ void svm_learn_optimization(DOC **docs, double *rhs, long int
 
   for(i=0;i<totdoc;i++) {    /* various inits */
     docs[i]->docnum=i;
-    a[i]=0;
-    lin[i]=0;
+    if(i >= known) {   /* a and lin of known variables are kept */
+      a[i]=0;
+      lin[i]=0;
+    }
     c[i]=rhs[i];       /* set right-hand side */
     unlabeled[i]=0;
     inconsistent[i]=0;
@@ -1026,21 +1055,48 @@ void svm_learn_optimization(DOC **docs, double *rhs, long int
       for(i=0;i<totdoc;i++)     /* fill kernel cache with unbounded SV */
 	if((alpha[i]>0) && (alpha[i]<learn_parm->svm_cost[i]) 
 	   && (kernel_cache_space_available(kernel_cache))) 
-	  cache_kernel_row(kernel_cache,docs,i,kernel_parm);
+	  cache_kernel_row(kernel_cache,docs,i,kernel_parm,
+			   learn_parm->num_threads);
       for(i=0;i<totdoc;i++)     /* fill rest of kernel cache with bounded SV */
 	if((alpha[i]==learn_parm->svm_cost[i]) 
 	   && (kernel_cache_space_available(kernel_cache))) 
-	  cache_kernel_row(kernel_cache,docs,i,kernel_parm);
+	  cache_kernel_row(kernel_cache,docs,i,kernel_parm,
+			   learn_parm->num_threads);
     }
     (void)compute_index(index,totdoc,index2dnum);
+    a_zero = (double *)my_malloc(sizeof(double)*totdoc);
+    for(i=0;i<totdoc;i++)
+      a_zero[i]=0;
+    if((known > 0) && (known < totdoc)) {
+      /* the linear component of the new variables is computed
+	 from the alphas of the last call... */
+      new2dnum = (long *)my_malloc(sizeof(long)*(totdoc+11));
+      for(i=0;i<totdoc;i++)
+	index[i]=(i >= known);
+      (void)compute_index(index,totdoc,new2dnum);
+      update_linear_component(docs,label,new2dnum,a,a_zero,index2dnum,
+			      totdoc,totwords,kernel_parm,kernel_cache,lin,
+			      aicache,weights,learn_parm->num_threads);
+      free(new2dnum);
+    }
+    /* ...and the one of all variables is updated for the alphas
+       that changed since */
     update_linear_component(docs,label,index2dnum,alpha,a,index2dnum,totdoc,
 			    totwords,kernel_parm,kernel_cache,lin,aicache,
-			    weights);
-    (void)calculate_svm_model(docs,label,unlabeled,lin,alpha,a,c,
+			    weights,learn_parm->num_threads);
+    (void)calculate_svm_model(docs,label,unlabeled,lin,alpha,a_zero,c,
 			      learn_parm,index2dnum,index2dnum,model);
     for(i=0;i<totdoc;i++) {    /* copy initial alphas */
       a[i]=alpha[i];
     }
+    if(state) {
+      /* the shrinking history restarts from the current alphas */
+      for(i=0;i<totdoc;i++) {
+	shrink_state->last_a[i]=a[i];
+	shrink_state->last_lin[i]=lin[i];
+      }
+    }
+    free(a_zero);
     free(index);
     free(index2dnum);
     if(weights) free(weights);
@@ -1065,17 +1121,23 @@ void svm_learn_optimization(DOC **docs, double *rhs, long int
     printf("Optimizing"); fflush(stdout);
   }
 
-  /* train the svm */
-  if(learn_parm->sharedslack)
+  /* train the svm. The QP with a single shared slack and an explicit
+     gram matrix is solved by a dense solver, unless it fails. */
+  iterations=-1;
+  if(learn_parm->sharedslack && (kernel_parm->kernel_type == GRAM))
+    iterations=optimize_sharedslack_dense(docs,label,unlabeled,totdoc,
+				     learn_parm,kernel_parm,model,
+				     a,lin,c,&timing_profile,&maxdiff);
+  if((iterations < 0) && learn_parm->sharedslack)
     iterations=optimize_to_convergence_sharedslack(docs,label,totdoc,
 				     totwords,learn_parm,kernel_parm,
-				     kernel_cache,&shrink_state,model,
+				     kernel_cache,shrink_state,model,
 				     a,lin,c,&timing_profile,
 				     &maxdiff);
-  else
+  else if(iterations < 0)
     iterations=optimize_to_convergence(docs,label,totdoc,
 				     totwords,learn_parm,kernel_parm,
-				     kernel_cache,&shrink_state,model,
+				     kernel_cache,shrink_state,model,
 				     inconsistent,unlabeled,
 				     a,lin,c,&timing_profile,
 				     &maxdiff,(long)-1,(long)1);
@@ -1198,14 +1260,26 @@ void svm_learn_optimization(DOC **docs, double *rhs, long int
   if(learn_parm->alphafile[0])
     write_alphas(learn_parm->alphafile,a,label,totdoc);
   
-  shrink_state_cleanup(&shrink_state);
-  free(label);
-  free(unlabeled);
-  free(inconsistent);
-  free(c);
-  free(a);
-  free(lin);
-  free(learn_parm->svm_cost);
+  if(state) {
+    /* the linear component of the variables left shrunk is not up
+       to date, in which case the next call starts from scratch */
+    state->totdoc=totdoc;
+    for(i=0;i<totdoc;i++) {
+      state->docs[i]=docs[i];
+      if(!shrink_state->active[i])
+	state->totdoc=0;
+    }
+  }
+  else {
+    shrink_state_cleanup(&private_shrink_state);
+    free(label);
+    free(unlabeled);
+    free(inconsistent);
+    free(c);
+    free(a);
+    free(lin);
+    free(learn_parm->svm_cost);
+  }
 }
 
 
@@ -1256,8 +1330,12 @@ long optimize_to_convergence(DOC **docs, long int *label, long int totdoc,
   CFLOAT *aicache;  /* buffer to keep one row of hessian */
   double *weights;  /* buffer for weight vector in linear case */
   QP qp;            /* buffer for one quadratic program */
+  QP_SOLVER *private_solver=NULL; /* state of the QP solver, if the
+				     caller did not provide one */
 
   epsilon_crit_org=learn_parm->epsilon_crit; /* save org */
+  if(!learn_parm->qp_solver) 
+    learn_parm->qp_solver=private_solver=create_qp_solver();
   if(kernel_parm->kernel_type == LINEAR) {
     learn_parm->epsilon_crit=2.0;
     /* kernel_cache=NULL; */  /* caching makes no sense for linear kernel */
@@ -1439,7 +1517,8 @@ long optimize_to_convergence(DOC **docs, long int *label, long int totdoc,
 
     if(kernel_cache) 
       cache_multiple_kernel_rows(kernel_cache,docs,working2dnum,
-				 choosenum,kernel_parm); 
+				 choosenum,kernel_parm,
+				 learn_parm->num_threads); 
     
     if(verbosity>=2) t2=get_runtime();
     if(retrain != 2) {
@@ -1451,7 +1530,7 @@ long optimize_to_convergence(DOC **docs, long int *label, long int totdoc,
     if(verbosity>=2) t3=get_runtime();
     update_linear_component(docs,label,active2dnum,a,a_old,working2dnum,totdoc,
 			    totwords,kernel_parm,kernel_cache,lin,aicache,
-			    weights);
+			    weights,learn_parm->num_threads);
 
     if(verbosity>=2) t4=get_runtime();
     supvecnum=calculate_svm_model(docs,label,unlabeled,lin,a,a_old,c,
@@ -1649,6 +1728,10 @@ long optimize_to_convergence(DOC **docs, long int *label, long int totdoc,
   free(qp.opt_low);
   free(qp.opt_up);
   if(weights) free(weights);
+  if(private_solver) {
+    free_qp_solver(private_solver);
+    learn_parm->qp_solver=NULL;
+  }
 
   learn_parm->epsilon_crit=epsilon_crit_org; /* restore org */
   model->maxdiff=(*maxdiff);
@@ -1696,10 +1779,14 @@ long optimize_to_convergence_sharedslack(DOC **docs, long int *label,
   CFLOAT *aicache;  /* buffer to keep one row of hessian */
   double *weights;  /* buffer for weight vector in linear case */
   QP qp;            /* buffer for one quadratic program */
+  QP_SOLVER *private_solver=NULL; /* state of the QP solver, if the
+				     caller did not provide one */
   double *slack;    /* vector of slack variables for optimization with
 		       shared slacks */
 
   epsilon_crit_org=learn_parm->epsilon_crit; /* save org */
+  if(!learn_parm->qp_solver) 
+    learn_parm->qp_solver=private_solver=create_qp_solver();
   if(kernel_parm->kernel_type == LINEAR) {
     learn_parm->epsilon_crit=2.0;
     /* kernel_cache=NULL; */  /* caching makes no sense for linear kernel */
@@ -1897,7 +1984,8 @@ long optimize_to_convergence_sharedslack(DOC **docs, long int *label,
 
     if(kernel_cache) 
       cache_multiple_kernel_rows(kernel_cache,docs,working2dnum,
-				 choosenum,kernel_parm); 
+				 choosenum,kernel_parm,
+				 learn_parm->num_threads); 
 
     if(verbosity>=2) t2=get_runtime();
     if(jointstep) learn_parm->biased_hyperplane=1;
@@ -1933,7 +2021,7 @@ long optimize_to_convergence_sharedslack(DOC **docs, long int *label,
     if(verbosity>=2) t3=get_runtime();
     update_linear_component(docs,label,active2dnum,a,a_old,working2dnum,totdoc,
 			    totwords,kernel_parm,kernel_cache,lin,aicache,
-			    weights);
+			    weights,learn_parm->num_threads);
     compute_shared_slacks(docs,label,a,lin,c,active2dnum,learn_parm,
 			  slack,alphaslack);
 
@@ -2094,6 +2182,10 @@ long optimize_to_convergence_sharedslack(DOC **docs, long int *label,
   free(qp.opt_low);
   free(qp.opt_up);
   if(weights) free(weights);
+  if(private_solver) {
+    free_qp_solver(private_solver);
+    learn_parm->qp_solver=NULL;
+  }
 
   learn_parm->epsilon_crit=epsilon_crit_org; /* restore org */
   model->maxdiff=(*maxdiff);
@@ -2102,6 +2194,347 @@ long optimize_to_convergence_sharedslack(DOC **docs, long int *label,
 }
 
 
+long optimize_sharedslack_dense(DOC **docs, long int *label, 
+			     long int *unlabeled, long int totdoc, 
+			     LEARN_PARM *learn_parm, 
+			     KERNEL_PARM *kernel_parm, MODEL *model, 
+			     double *a, double *lin, double *c, 
+			     TIMING *timing_profile, double *maxdiff)
+     /* Solves the QP with a single shared slack variable
+
+          max  sum_i c[i]*a[i] - 1/2 sum_ij a[i]*a[j]*K(i,j)
+          s.t. a[i] >= 0,  sum_i a[i] <= C
+
+	with a primal active-set method, reading K from the explicit
+	gram matrix (kernel_type=GRAM). This is the QP of the
+	one-slack algorithms. It is small and dense, so the Cholesky
+	factor of K restricted to the free variables is kept and
+	updated as variables enter and leave the free set, and each
+	iteration costs O(totdoc*free) operations. Starts from a/lin
+	and returns the solution in a/lin/model, like
+	optimize_to_convergence_sharedslack(). Returns the number of
+	iterations, or -1 if the QP does not have this structure or the
+	method did not converge. In the latter case a/lin/model are
+	consistent and the general solver can continue from them. */
+     /* docs: Training vectors (x-part) */
+     /* label: Training labels (must be all 1) */
+     /* unlabeled: Unlabeled examples (for calculate_svm_model) */
+     /* totdoc: Number of examples in docs/label */
+     /* learn_parm: Learning paramenters */
+     /* kernel_parm: Kernel paramenters */
+     /* model: Returns learning result */
+     /* a: alphas */
+     /* lin: linear component of gradient */
+     /* c: right hand side of inequalities (margin) */
+     /* maxdiff: returns maximum violation of KT-conditions */
+{
+  long i,j,r,n,f,iteration,maxiter,blocking,entering,sumact,converged;
+  long *free2dnum,*isfree,*index,*index2dnum;
+  double C,ridge,lambda,sum,sumstar,sumu,sumv,t,tk,mu,minmu,s,t0;
+  double *K,*L,*u,*v,*p,*a_start,*row;
+
+  n=totdoc;
+  if((kernel_parm->kernel_type != GRAM) || (!kernel_parm->gram_matrix)
+     || learn_parm->biased_hyperplane || (n == 0))
+    return(-1);
+  for(i=0;i<n;i++) 
+    if((label[i] != 1) || (docs[i]->kernelid < 0)
+       || (docs[i]->slackid != docs[0]->slackid)
+       || (learn_parm->svm_cost[i] != learn_parm->svm_c))
+      return(-1);
+
+  t0=get_runtime();
+  C=learn_parm->svm_c;
+  K = (double *)my_malloc(sizeof(double)*n*n);
+  L = (double *)my_malloc(sizeof(double)*n*n);
+  u = (double *)my_malloc(sizeof(double)*n);
+  v = (double *)my_malloc(sizeof(double)*n);
+  p = (double *)my_malloc(sizeof(double)*n);
+  a_start = (double *)my_malloc(sizeof(double)*n);
+  free2dnum = (long *)my_malloc(sizeof(long)*n);
+  isfree = (long *)my_malloc(sizeof(long)*n);
+
+  /* dense copy of the gram matrix. A small ridge is added on the
+     diagonal of the factor, so that constraints with an empty
+     left-hand side can be free too. */
+  ridge=0;
+  for(i=0;i<n;i++) {
+    row=kernel_parm->gram_matrix->element[docs[i]->kernelid];
+    for(j=0;j<n;j++) 
+      K[i*n+j]=row[docs[j]->kernelid];
+    ridge=MAX(ridge,K[i*n+i]);
+  }
+  ridge=1E-10*((ridge > 0) ? ridge : 1);
+
+  /* the starting point must be feasible */
+  sum=0;
+  for(i=0;i<n;i++) {
+    a_start[i]=a[i];
+    sum+=a[i];
+  }
+  if(sum > C) {
+    for(i=0;i<n;i++) {
+      a[i]*=C/sum;
+      lin[i]*=C/sum;
+    }
+    sum=C;
+  }
+  /* the variables which are not zero are free, except those
+     linearly dependent on the other ones which are set to zero */
+  f=0;
+  sum=0;
+  for(i=0;i<n;i++) {
+    isfree[i]=0;
+    if(a[i] > 0) {
+      if(add_to_dense_factor(K,n,L,free2dnum,f,i,ridge)) {
+	isfree[i]=1;
+	sum+=a[i];
+	f++;
+      }
+      else {
+	for(j=0;j<n;j++)
+	  lin[j]-=a[i]*K[j*n+i];
+	a[i]=0;
+      }
+    }
+  }
+  sumact=(f > 0) && (sum >= C*(1-1E-12));
+
+  maxiter=100+10*n;
+  converged=0;
+  lambda=0;
+  for(iteration=1;iteration<=maxiter;iteration++) {
+    /* minimizer of the objective over the free variables, the other
+       ones being zero, and with sum_i a[i] = C if sumact. lambda is
+       the multiplier of the latter constraint. */
+    for(r=0;r<f;r++) {
+      u[r]=c[free2dnum[r]];
+      v[r]=1;
+    }
+    solve_dense_factor(L,n,f,u);
+    lambda=0;
+    if(sumact) {
+      solve_dense_factor(L,n,f,v);
+      sumu=0;
+      sumv=0;
+      for(r=0;r<f;r++) {
+	sumu+=u[r];
+	sumv+=v[r];
+      }
+      lambda=(sumu-C)/sumv;
+    }
+
+    /* longest feasible step towards it */
+    t=1;
+    blocking=-1;
+    sum=0;
+    sumstar=0;
+    for(r=0;r<f;r++) {
+      u[r]-=lambda*v[r];
+      sum+=a[free2dnum[r]];
+      sumstar+=u[r];
+      if(u[r] < 0) {
+	tk=a[free2dnum[r]]/(a[free2dnum[r]]-u[r]);
+	if(tk < t) {
+	  t=tk;
+	  blocking=r;
+	}
+      }
+    }
+    if((!sumact) && (sumstar > C)) {
+      tk=(C-sum)/(sumstar-sum);
+      if(tk < t) {
+	t=tk;
+	blocking=f;
+      }
+    }
+    for(r=0;r<f;r++) {
+      j=free2dnum[r];
+      if(r == blocking)
+	p[r]=-a[j];
+      else if(t == 1)
+	p[r]=u[r]-a[j];
+      else
+	p[r]=t*(u[r]-a[j]);
+      a[j]+=p[r];
+    }
+    for(i=0;i<n;i++) {
+      s=0;
+      row=K+i*n;
+      for(r=0;r<f;r++) 
+	s+=row[free2dnum[r]]*p[r];
+      lin[i]+=s;
+    }
+
+    if(blocking == f) {       /* sum_i a[i] <= C becomes active */
+      sumact=1;
+      continue;
+    }
+    if(blocking >= 0) {       /* a variable hits zero */
+      isfree[free2dnum[blocking]]=0;
+      remove_from_dense_factor(L,n,free2dnum,f,blocking);
+      f--;
+      if(f == 0) 
+	sumact=0;
+      continue;
+    }
+
+    /* at the minimizer over the free variables: a variable at zero
+       with negative multiplier enters the free set, or the sum
+       constraint is released if its multiplier is negative. The
+       iterations are cheap, so the QP is solved well below
+       epsilon_crit. A variable linearly dependent on the free ones
+       cannot enter, and the general solver takes over. */
+    entering=-1;
+    minmu=-1E-3*learn_parm->epsilon_crit;
+    for(i=0;i<n;i++) {
+      if(!isfree[i]) {
+	mu=lin[i]-c[i]+lambda;
+	if(mu < minmu) {
+	  minmu=mu;
+	  entering=i;
+	}
+      }
+    }
+    if(sumact && (lambda < minmu)) {
+      sumact=0;
+      continue;
+    }
+    if(entering < 0) {
+      converged=1;
+      break;
+    }
+    if(!add_to_dense_factor(K,n,L,free2dnum,f,entering,ridge))
+      break;
+    isfree[entering]=1;
+    f++;
+  }
+
+  /* update the model and compute the maximum violation of the
+     KT-conditions as in check_optimality_sharedslack() */
+  index = (long *)my_malloc(sizeof(long)*n);
+  index2dnum = (long *)my_malloc(sizeof(long)*(n+11));
+  for(i=0;i<n;i++)
+    index[i]=1;
+  (void)compute_index(index,n,index2dnum);
+  (void)calculate_svm_model(docs,label,unlabeled,lin,a,a_start,c,
+			    learn_parm,index2dnum,index2dnum,model);
+  s=0;
+  sum=0;
+  for(i=0;i<n;i++) {
+    s=MAX(s,c[i]-lin[i]);
+    sum+=a[i];
+  }
+  (*maxdiff)=0;
+  for(i=0;i<n;i++) 
+    if(a[i] > learn_parm->epsilon_a)
+      (*maxdiff)=MAX((*maxdiff),lin[i]+s-c[i]);
+  if(sum < C-learn_parm->epsilon_a)
+    (*maxdiff)=MAX((*maxdiff),s);
+  model->maxdiff=(*maxdiff);
+
+  if(verbosity>=2) {
+    printf(" Dense QP: %ld iterations, %ld free variables, max violation=%.5f\n",
+	   iteration,f,(*maxdiff));
+    fflush(stdout);
+  }
+
+  free(index);
+  free(index2dnum);
+  free(K);
+  free(L);
+  free(u);
+  free(v);
+  free(p);
+  free(a_start);
+  free(free2dnum);
+  free(isfree);
+  timing_profile->time_opti+=get_runtime()-t0;
+
+  if(!converged)
+    return(-1);
+  return(iteration);
+}
+
+static long add_to_dense_factor(double *K, long n, double *L, 
+				long *free2dnum, long f, long j, 
+				double ridge)
+     /* Appends variable j to the f free variables in free2dnum and
+	updates the Cholesky factor L of K+ridge*I restricted to
+	them. K and L are stored by rows with n columns. Returns 0,
+	leaving the free variables unchanged, if K(j,j) is numerically
+	spanned by the free variables. */
+{
+  long r,k;
+  double s;
+
+  for(r=0;r<f;r++) {
+    s=K[free2dnum[r]*n+j];
+    for(k=0;k<r;k++) 
+      s-=L[r*n+k]*L[f*n+k];
+    L[f*n+r]=s/L[r*n+r];
+  }
+  s=K[j*n+j]+ridge;
+  for(k=0;k<f;k++) 
+    s-=L[f*n+k]*L[f*n+k];
+  if(s <= 1E-8*(K[j*n+j]+ridge))
+    return(0);
+  L[f*n+f]=sqrt(s);
+  free2dnum[f]=j;
+  return(1);
+}
+
+static void remove_from_dense_factor(double *L, long n, long *free2dnum,
+				     long f, long k)
+     /* Removes the k-th of the f free variables in free2dnum and
+	updates the Cholesky factor L. Dropping row k of L leaves a
+	matrix with one non-zero above the diagonal in each of the
+	rows after k, which are zeroed by Givens rotations. */
+{
+  long r,i;
+  double x,y,h,cs,sn;
+
+  for(r=k;r<f-1;r++) {
+    free2dnum[r]=free2dnum[r+1];
+    for(i=0;i<=r+1;i++)
+      L[r*n+i]=L[(r+1)*n+i];
+  }
+  for(r=k;r<f-1;r++) {
+    x=L[r*n+r];
+    y=L[r*n+r+1];
+    h=sqrt(x*x+y*y);
+    cs=x/h;
+    sn=y/h;
+    for(i=r;i<f-1;i++) {
+      x=L[i*n+r];
+      y=L[i*n+r+1];
+      L[i*n+r]=cs*x+sn*y;
+      L[i*n+r+1]=cs*y-sn*x;
+    }
+  }
+}
+
+static void solve_dense_factor(double *L, long n, long f, double *x)
+     /* Solves L*L'*x=b for the Cholesky factor L of size f. x
+	contains b on entry. */
+{
+  long r,k;
+  double s;
+
+  for(r=0;r<f;r++) {
+    s=x[r];
+    for(k=0;k<r;k++) 
+      s-=L[r*n+k]*x[k];
+    x[r]=s/L[r*n+r];
+  }
+  for(r=f-1;r>=0;r--) {
+    s=x[r];
+    for(k=r+1;k<f;k++) 
+      s-=L[k*n+r]*x[k];
+    x[r]=s/L[r*n+r];
+  }
+}
+
 double compute_objective_function(double *a, double *lin, double *c, 
 				  double eps, long int *label, 
 				  long int *active2dnum)
@@ -2180,7 +2613,7 @@ void optimize_svm(DOC **docs, long int *label, long int *unlabeled,
 		    &(model->b),   /* in case the optimizer gives us */
                                    /* the threshold for free. otherwise */
                                    /* b is calculated in calculate_model. */
-		    learn_parm);
+		    learn_parm,learn_parm->qp_solver);
     if(verbosity>=3) {         
       printf("done\n");
     }
@@ -2646,18 +3079,24 @@ void update_linear_component(DOC **docs, long int *label,
 			     long int totdoc, long int totwords, 
 			     KERNEL_PARM *kernel_parm, 
 			     KERNEL_CACHE *kernel_cache, 
-			     double *lin, CFLOAT *aicache, double *weights)
+			     double *lin, CFLOAT *aicache, double *weights,
+			     long int num_threads)
      /* keep track of the linear component */
      /* lin of the gradient etc. by updating */
      /* based on the change of the variables */
      /* in the current working set */
+     /* the active variables are split into num_threads ranges */
+     /* that are updated in parallel */
      /* WARNING: Assumes that array of weights is initialized to all zero 
  	         values for linear kernel! */
 {
-  register long i,ii,j,jj;
-  register double tec;
+  register long i,ii;
+  long c,n,num_chunks;
   SVECTOR *f;
 
+  for(n=0;active2dnum[n]>=0;n++);
+  num_chunks=MAX(1,minl(get_num_threads(num_threads),n));
+
   if(kernel_parm->kernel_type==0) { /* special linear case */
     /* clear_vector_n(weights,totwords); */
     for(ii=0;(i=working2dnum[ii])>=0;ii++) {
@@ -2667,9 +3106,17 @@ void update_linear_component(DOC **docs, long int *label,
 			f->factor*((a[i]-a_old[i])*(double)label[i]));
       }
     }
-    for(jj=0;(j=active2dnum[jj])>=0;jj++) {
-      for(f=docs[j]->fvec;f;f=f->next)  
-	lin[j]+=f->factor*sprod_ns(weights,f);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static,1) num_threads(num_chunks) if(num_chunks>1)
+#endif
+    for(c=0;c<num_chunks;c++) {
+      long j,jj;
+      SVECTOR *g;
+      for(jj=(n*c)/num_chunks;jj<(n*(c+1))/num_chunks;jj++) {
+	j=active2dnum[jj];
+	for(g=docs[j]->fvec;g;g=g->next)  
+	  lin[j]+=g->factor*sprod_ns(weights,g);
+      }
     }
     for(ii=0;(i=working2dnum[ii])>=0;ii++) {
       if(a[i] != a_old[i]) {
@@ -2679,13 +3126,21 @@ void update_linear_component(DOC **docs, long int *label,
     }                                     /* weights to zero in each iter. */
   }
   else {                            /* general case */
-    for(jj=0;(i=working2dnum[jj])>=0;jj++) {
+    for(ii=0;(i=working2dnum[ii])>=0;ii++) {
       if(a[i] != a_old[i]) {
 	get_kernel_row(kernel_cache,docs,i,totdoc,active2dnum,aicache,
-		       kernel_parm);
-	for(ii=0;(j=active2dnum[ii])>=0;ii++) {
-	  tec=aicache[j];
-	  lin[j]+=(((a[i]*tec)-(a_old[i]*tec))*(double)label[i]);
+		       kernel_parm,num_threads);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static,1) num_threads(num_chunks) if(num_chunks>1)
+#endif
+	for(c=0;c<num_chunks;c++) {
+	  long j,jj;
+	  double tec;
+	  for(jj=(n*c)/num_chunks;jj<(n*(c+1))/num_chunks;jj++) {
+	    j=active2dnum[jj];
+	    tec=aicache[j];
+	    lin[j]+=(((a[i]*tec)-(a_old[i]*tec))*(double)label[i]);
+	  }
 	}
       }
     }
@@ -2708,10 +3163,10 @@ long incorporate_unlabeled_examples(MODEL *model, long int *label,
   double dist,model_length,posratio,negratio;
   long check_every=2;
   double loss;
-  static double switchsens=0.0,switchsensorg=0.0;
+  static SVM_THREAD_LOCAL double switchsens=0.0,switchsensorg=0.0;
   double umin,umax,sumalpha;
   long imin=0,imax=0;
-  static long switchnum=0;
+  static SVM_THREAD_LOCAL long switchnum=0;
 
   switchsens/=1.2;
 
@@ -3302,6 +3757,137 @@ void shrink_state_cleanup(SHRINK_STATE *shrink_state)
   free(shrink_state->last_lin);
 }
 
+QP_STATE *create_qp_state()
+     /* creates the state of svm_learn_optimization, which is kept
+	between calls on the same growing set of constraints. Set
+	learn_parm->qp_state to use it. */
+{
+  QP_STATE *state=(QP_STATE *)my_malloc(sizeof(QP_STATE));
+  state->totdoc=0;
+  state->size=0;
+  state->docs=(DOC **)my_malloc(sizeof(DOC *));
+  state->label=(long *)my_malloc(sizeof(long));
+  state->unlabeled=(long *)my_malloc(sizeof(long));
+  state->inconsistent=(long *)my_malloc(sizeof(long));
+  state->a=(double *)my_malloc(sizeof(double));
+  state->lin=(double *)my_malloc(sizeof(double));
+  state->c=(double *)my_malloc(sizeof(double));
+  state->svm_cost=(double *)my_malloc(sizeof(double));
+  init_shrink_state(&state->shrink_state,0,(long)MAXSHRINK);
+  return(state);
+}
+
+void free_qp_state(QP_STATE *state)
+{
+  long i;
+
+  if(!state) return;
+  for(i=0;i<state->shrink_state.deactnum;i++) 
+    if(state->shrink_state.a_history[i])
+      free(state->shrink_state.a_history[i]);
+  state->shrink_state.deactnum=0;
+  shrink_state_cleanup(&state->shrink_state);
+  free(state->docs);
+  free(state->label);
+  free(state->unlabeled);
+  free(state->inconsistent);
+  free(state->a);
+  free(state->lin);
+  free(state->c);
+  free(state->svm_cost);
+  free(state);
+}
+
+static long resize_qp_state(QP_STATE *state, DOC **docs, long totdoc)
+     /* prepares the state for a call on docs[0..totdoc-1] and
+	returns the number of variables whose alpha and lin are kept
+	from the last call. These are the first ones, and they must
+	be the constraints of the last call in the same order. */
+{
+  SHRINK_STATE *shrink_state=&state->shrink_state;
+  long i,known,size;
+
+  known=state->totdoc;
+  if(known > totdoc)
+    known=0;
+  for(i=0;i<known;i++)
+    if(docs[i] != state->docs[i])
+      known=0;
+
+  if(totdoc > state->size) {
+    size=MAX(totdoc,2*state->size);
+    state->docs=(DOC **)realloc(state->docs,sizeof(DOC *)*size);
+    state->label=(long *)realloc(state->label,sizeof(long)*size);
+    state->unlabeled=(long *)realloc(state->unlabeled,sizeof(long)*size);
+    state->inconsistent=(long *)realloc(state->inconsistent,
+					sizeof(long)*size);
+    state->a=(double *)realloc(state->a,sizeof(double)*size);
+    state->lin=(double *)realloc(state->lin,sizeof(double)*size);
+    state->c=(double *)realloc(state->c,sizeof(double)*size);
+    state->svm_cost=(double *)realloc(state->svm_cost,sizeof(double)*size);
+    shrink_state->active=(long *)realloc(shrink_state->active,
+					 sizeof(long)*size);
+    shrink_state->inactive_since=(long *)realloc(shrink_state->inactive_since,
+						 sizeof(long)*size);
+    shrink_state->last_a=(double *)realloc(shrink_state->last_a,
+					   sizeof(double)*size);
+    shrink_state->last_lin=(double *)realloc(shrink_state->last_lin,
+					     sizeof(double)*size);
+    state->size=size;
+  }
+
+  /* all variables start active, and the alphas saved by the
+     shrinking of the last call refer to its variables */
+  for(i=0;i<shrink_state->deactnum;i++) 
+    if(shrink_state->a_history[i]) {
+      free(shrink_state->a_history[i]);
+      shrink_state->a_history[i]=0;
+    }
+  shrink_state->deactnum=0;
+  for(i=0;i<totdoc;i++) {
+    shrink_state->active[i]=1;
+    shrink_state->inactive_since[i]=0;
+    shrink_state->last_a[i]=0;
+    shrink_state->last_lin[i]=0;
+  }
+
+  state->totdoc=0; /* until the call completes */
+  return(known);
+}
+
+void remove_from_qp_state(QP_STATE *state, long *keep, long totdoc)
+     /* removes the variables i with keep[i]==0 from the state, where
+	i=0..totdoc-1 are the variables of the last call. The linear
+	component of the other variables is kept only if all the
+	removed ones have alpha zero. */
+{
+  long i,m;
+
+  if(state->totdoc != totdoc) {
+    state->totdoc=0;
+    return;
+  }
+  m=0;
+  for(i=0;i<totdoc;i++) {
+    if(keep[i]) {
+      state->docs[m]=state->docs[i];
+      state->label[m]=state->label[i];
+      state->unlabeled[m]=state->unlabeled[i];
+      state->inconsistent[m]=state->inconsistent[i];
+      state->a[m]=state->a[i];
+      state->lin[m]=state->lin[i];
+      state->c[m]=state->c[i];
+      state->svm_cost[m]=state->svm_cost[i];
+      m++;
+    }
+    else if(state->a[i] != 0) {
+      state->totdoc=0;
+      return;
+    }
+  }
+  state->totdoc=m;
+}
+
 long shrink_problem(DOC **docs,
 		    LEARN_PARM *learn_parm, 
 		    SHRINK_STATE *shrink_state, 
@@ -3446,7 +4032,7 @@ void reactivate_inactive_examples(long int *label,
       
       for(ii=0;(i=changed2dnum[ii])>=0;ii++) {
 	get_kernel_row(kernel_cache,docs,i,totdoc,inactive2dnum,aicache,
-		       kernel_parm);
+		       kernel_parm,learn_parm->num_threads);
 	for(jj=0;(j=inactive2dnum[jj])>=0;jj++) {
 	  kernel_val=aicache[j];
 	  lin[j]+=(((a[i]*kernel_val)-(a_old[i]*kernel_val))*(double)label[i]);
@@ -3505,18 +4091,28 @@ void reactivate_inactive_examples(long int *label,
 void get_kernel_row(KERNEL_CACHE *kernel_cache, DOC **docs, 
 		    long int docnum, long int totdoc, 
 		    long int *active2dnum, CFLOAT *buffer, 
-		    KERNEL_PARM *kernel_parm)
+		    KERNEL_PARM *kernel_parm, long int num_threads)
      /* Get's a row of the matrix of kernel values This matrix has the
       same form as the Hessian, just that the elements are not
       multiplied by */
      /* y_i * y_j * a_i * a_j */
-     /* Takes the values from the cache if available. */
+     /* Takes the values from the cache if available. The missing
+	values are computed by num_threads threads. */
 {
   register long i,j,start;
-  DOC *ex;
+  long n;
+  DOC *ex,**todo;
+  long *todonum;
+  double *kval;
 
   ex=docs[docnum];
 
+  for(n=0;active2dnum[n]>=0;n++);
+  todo=(DOC **)my_malloc(sizeof(DOC *)*(n+1));
+  todonum=(long *)my_malloc(sizeof(long)*(n+1));
+  kval=(double *)my_malloc(sizeof(double)*(n+1));
+  n=0;
+
   if(kernel_cache && (kernel_cache->index[docnum] != -1)) {/* row is cached? */
     kernel_cache->lru[kernel_cache->index[docnum]]=kernel_cache->time;/* lru */
     start=kernel_cache->activenum*kernel_cache->index[docnum];
@@ -3525,31 +4121,51 @@ void get_kernel_row(KERNEL_CACHE *kernel_cache, DOC **docs,
 	buffer[j]=kernel_cache->buffer[start+kernel_cache->totdoc2active[j]];
       }
       else {
-	buffer[j]=(CFLOAT)kernel(kernel_parm,ex,docs[j]);
+	todonum[n]=j;
+	todo[n++]=docs[j];
       }
     }
   }
   else {
     for(i=0;(j=active2dnum[i])>=0;i++) {
-      buffer[j]=(CFLOAT)kernel(kernel_parm,ex,docs[j]);
+      todonum[n]=j;
+      todo[n++]=docs[j];
     }
   }
+
+  /* compute the missing values at once */
+  kernel_row_par(kernel_parm,ex,todo,n,kval,num_threads);
+  for(i=0;i<n;i++)
+    buffer[todonum[i]]=(CFLOAT)kval[i];
+  free(kval);
+  free(todonum);
+  free(todo);
 }
 
 
 void cache_kernel_row(KERNEL_CACHE *kernel_cache, DOC **docs, 
-		      long int m, KERNEL_PARM *kernel_parm)
-     /* Fills cache for the row m */
+		      long int m, KERNEL_PARM *kernel_parm, 
+		      long int num_threads)
+     /* Fills cache for the row m. The values that are not in the
+	cache already are computed by num_threads threads. */
 {
   register DOC *ex;
   register long j,k,l;
   register CFLOAT *cache;
+  long n;
+  DOC **todo;
+  long *todonum;
+  double *kval;
 
   if(!kernel_cache_check(kernel_cache,m)) {  /* not cached yet*/
     cache = kernel_cache_clean_and_malloc(kernel_cache,m);
     if(cache) {
       l=kernel_cache->totdoc2active[m];
       ex=docs[m];
+      todo=(DOC **)my_malloc(sizeof(DOC *)*(kernel_cache->activenum+1));
+      todonum=(long *)my_malloc(sizeof(long)*(kernel_cache->activenum+1));
+      kval=(double *)my_malloc(sizeof(double)*(kernel_cache->activenum+1));
+      n=0;
       for(j=0;j<kernel_cache->activenum;j++) {  /* fill cache */
 	k=kernel_cache->active2totdoc[j];
 	if((kernel_cache->index[k] != -1) && (l != -1) && (k != m)) {
@@ -3557,9 +4173,17 @@ void cache_kernel_row(KERNEL_CACHE *kernel_cache, DOC **docs,
 				       *kernel_cache->index[k]+l];
 	}
 	else {
-	  cache[j]=kernel(kernel_parm,ex,docs[k]);
+	  todonum[n]=j;
+	  todo[n++]=docs[k];
 	} 
       }
+      /* compute the missing values at once */
+      kernel_row_par(kernel_parm,ex,todo,n,kval,num_threads);
+      for(j=0;j<n;j++)
+	cache[todonum[j]]=(CFLOAT)kval[j];
+      free(kval);
+      free(todonum);
+      free(todo);
     }
     else {
       perror("Error: Kernel cache full! => increase cache size");
@@ -3570,13 +4194,16 @@ void cache_kernel_row(KERNEL_CACHE *kernel_cache, DOC **docs,
  
 void cache_multiple_kernel_rows(KERNEL_CACHE *kernel_cache, DOC **docs, 
 				long int *key, long int varnum, 
-				KERNEL_PARM *kernel_parm)
-     /* Fills cache for the rows in key */
+				KERNEL_PARM *kernel_parm, long int num_threads)
+     /* Fills cache for the rows in key. The rows are filled one after
+	the other, as each row reuses the values of the rows cached
+	before it and may evict them, and the columns of each row are
+	computed by num_threads threads. */
 {
   register long i;
 
   for(i=0;i<varnum;i++) {  /* fill up kernel cache */
-    cache_kernel_row(kernel_cache,docs,key[i],kernel_parm);
+    cache_kernel_row(kernel_cache,docs,key[i],kernel_parm,num_threads);
   }
 }
 
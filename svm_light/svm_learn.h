@@ -39,6 +39,10 @@ long   optimize_to_convergence_sharedslack(DOC **, long *, long, long,
 			       KERNEL_PARM *, KERNEL_CACHE *, SHRINK_STATE *,
 			       MODEL *, double *, double *, double *,
 			       TIMING *, double *);
+long   optimize_sharedslack_dense(DOC **, long *, long *, long,
+			       LEARN_PARM *, KERNEL_PARM *, MODEL *,
+			       double *, double *, double *,
+			       TIMING *, double *);
 double compute_objective_function(double *, double *, double *, double,
 				  long *, long *);
 void   clear_index(long *);
@@ -85,7 +89,7 @@ long   incorporate_unlabeled_examples(MODEL *, long *,long *, long *,
 void   update_linear_component(DOC **, long *, long *, double *, double *, 
 			       long *, long, long, KERNEL_PARM *, 
 			       KERNEL_CACHE *, double *,
-			       CFLOAT *, double *);
+			       CFLOAT *, double *, long);
 long   select_next_qp_subproblem_grad(long *, long *, double *, 
 				      double *, double *, long,
 				      long, LEARN_PARM *, long *, long *, 
@@ -115,10 +119,10 @@ void   reactivate_inactive_examples(long *, long *, double *, SHRINK_STATE *,
 KERNEL_CACHE *kernel_cache_init(long, long);
 void   kernel_cache_cleanup(KERNEL_CACHE *);
 void   get_kernel_row(KERNEL_CACHE *,DOC **, long, long, long *, CFLOAT *, 
-		      KERNEL_PARM *);
-void   cache_kernel_row(KERNEL_CACHE *,DOC **, long, KERNEL_PARM *);
+		      KERNEL_PARM *, long);
+void   cache_kernel_row(KERNEL_CACHE *,DOC **, long, KERNEL_PARM *, long);
 void   cache_multiple_kernel_rows(KERNEL_CACHE *,DOC **, long *, long, 
-				  KERNEL_PARM *);
+				  KERNEL_PARM *, long);
 void   kernel_cache_shrink(KERNEL_CACHE *,long, long, long *);
 void   kernel_cache_reset_lru(KERNEL_CACHE *);
 long   kernel_cache_malloc(KERNEL_CACHE *);
@@ -157,6 +161,12 @@ void   write_prediction(char *, MODEL *, double *, double *, long *, long *,
 			long, LEARN_PARM *);
 void   write_alphas(char *, double *, long *, long);
 
+QP_SOLVER *create_qp_solver(void);
+void   free_qp_solver(QP_SOLVER *);
+QP_STATE *create_qp_state(void);
+void   free_qp_state(QP_STATE *);
+void   remove_from_qp_state(QP_STATE *, long *, long);
+
 typedef struct cache_parm_s {
   KERNEL_CACHE *kernel_cache;
   CFLOAT *cache;
@@ -22,7 +22,7 @@
 
 /* Common Block Declarations */
 
-long verbosity;
+/* long verbosity; */
 
 /* /////////////////////////////////////////////////////////////// */
 
@@ -40,12 +40,13 @@ double opt_precision=DEF_PRECISION_LINEAR;
 
 void *my_malloc();
 
-double *optimize_qp(qp,epsilon_crit,nx,threshold,learn_parm)
+double *optimize_qp(qp,epsilon_crit,nx,threshold,learn_parm,solver)
 QP *qp;
 double *epsilon_crit;
 long nx; /* Maximum number of variables in QP */
 double *threshold;
 LEARN_PARM *learn_parm;
+QP_SOLVER *solver; /* not used, the state of LOQO is still global */
 /* start the optimizer and return the optimal values */
 {
   register long i,j,result;
@@ -56,6 +56,6 @@ void printWordArray(WORD*);
 void printModel(MODEL *);
 void printW(double *, long, long, double);
 
-extern long   struct_verbosity;              /* verbosity level (0-4) */
+extern SVM_THREAD_LOCAL long struct_verbosity; /* verbosity level (0-4) */
 
 #endif
@@ -22,10 +22,18 @@
 #include "svm_struct_common.h"
 #include "../svm_struct_api.h"
 #include <assert.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define MAX(x,y)      ((x) < (y) ? (y) : (x))
 #define MIN(x,y)      ((x) > (y) ? (y) : (x))
 
+/* largest number of examples whose constraints are held at once
+   while summing them over a full pass, unless a batch oracle needs
+   the whole pass */
+#define MAX_CONSTRAINT_CHUNK 1024
+
 
 void svm_learn_struct(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 		      LEARN_PARM *lparm, KERNEL_PARM *kparm, 
@@ -128,12 +136,14 @@ void svm_learn_struct(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
   add_weight_vector_to_linear_model(svmModel);
   sm->svm_model=svmModel;
   sm->w=svmModel->lin_weights; /* short cut to weight vector */
+  update_struct_model(sm,sparm);
 
   /* create a cache of the feature vectors for the correct labels */
   if(USE_FYCACHE) {
     fycache=(SVECTOR **)my_malloc(n*sizeof(SVECTOR *));
+    psi_of_examples(fycache,ex,n,sm,sparm);
     for(i=0;i<n;i++) {
-      fy=psi(ex[i].x,ex[i].y,sm,sparm);
+      fy=fycache[i];
       if(kparm->kernel_type == LINEAR) {
 	diff=add_list_ss(fy); /* store difference vector directly */
 	free_svector(fy);
@@ -188,14 +198,11 @@ void svm_learn_struct(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 					add a new constraint */
 	    rt2=get_runtime();
 	    argmax_count++;
-	    if(sparm->loss_type == SLACK_RESCALING) 
-	      ybar=find_most_violated_constraint_slackrescaling(ex[i].x,
-								ex[i].y,sm,
-								sparm);
-	    else
-	      ybar=find_most_violated_constraint_marginrescaling(ex[i].x,
-								 ex[i].y,sm,
-								 sparm);
+	    /* also get psi(x,ybar) and loss, which a fused callback
+	       computes together with ybar */
+	    ybar=find_most_violated_constraint_fused(ex[i].x,ex[i].y,
+						     &fybar,&lossval,
+						     sm,sparm);
 	    rt_viol+=MAX(get_runtime()-rt2,0);
 	    
 	    if(empty_label(ybar)) {
@@ -214,11 +221,9 @@ void svm_learn_struct(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	      fy=copy_svector(fycache[i]);
 	    else
 	      fy=psi(ex[i].x,ex[i].y,sm,sparm);
-	    fybar=psi(ex[i].x,ybar,sm,sparm);
 	    rt_psi+=MAX(get_runtime()-rt2,0);
 	    
 	    /**** scale feature vector and margin by loss ****/
-	    lossval=loss(ex[i].y,ybar,sparm);
 	    if(sparm->slack_norm == 2)
 	      lossval=sqrt(lossval);
 	    if(sparm->loss_type == SLACK_RESCALING)
@@ -337,6 +342,7 @@ void svm_learn_struct(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	    add_weight_vector_to_linear_model(svmModel);
 	    sm->svm_model=svmModel;
 	    sm->w=svmModel->lin_weights; /* short cut to weight vector */
+	    update_struct_model(sm,sparm);
 	    optcount++;
 	    /* keep track of when each constraint was last
 	       active. constraints marked with -1 are not updated */
@@ -367,7 +373,7 @@ void svm_learn_struct(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	if(struct_verbosity>=2)
 	  printf("Reducing working set...");fflush(stdout);
 	remove_inactive_constraints(&cset,alpha,optcount,alphahist,
-				    MAX(50,optcount-lastoptcount));
+				    MAX(50,optcount-lastoptcount),NULL);
 	lastoptcount=optcount;
 	if(struct_verbosity>=2)
 	  printf("done. (NumConst=%d)\n",cset.m);
@@ -449,6 +455,7 @@ void svm_learn_struct(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
   if(svmModel) {
     sm->svm_model=copy_model(svmModel);
     sm->w=sm->svm_model->lin_weights; /* short cut to weight vector */
+    update_struct_model(sm,sparm);
   }
 
   print_struct_learning_stats(sample,sm,cset,alpha,sparm);
@@ -511,6 +518,18 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
   long        uptr=0;
   long        *randmapping=NULL;
   long        batch_size=n;
+  long        batch_num,k;
+  long        *batch_exnum=NULL;
+  SVECTOR     **batch_fydelta=NULL;
+  double      *batch_rhs=NULL;
+  int         pipeline,stale_constraint=0;
+  long        prefetch_num=0,prefetched;
+  long        *prefetch_exnum=NULL;
+  LABEL       *prefetch_ybar=NULL;
+  SVECTOR     **prefetch_fybar=NULL;
+  double      *prefetch_loss=NULL,*prefetch_w=NULL;
+  double      prefetch_viol;
+  STRUCT_PATH *path=sparm->path;
 
   rt1=get_runtime();
 
@@ -536,6 +555,8 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 
 
   lparm->biased_hyperplane=0;     /* set threshold to zero */
+  lparm->qp_state=create_qp_state(); /* the QP of each iteration
+				     starts from that of the last */
   epsilon=100.0;                  /* start with low precision and
 				     increase later */
   epsilon_cached=epsilon;         /* epsilon to use for iterations
@@ -551,9 +572,34 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
       alphahist[i]=-1; /* -1 makes sure these constraints are never removed */
     }
   }
+  /* warm start from the working set of the previous model of the
+     path. The joint constraints do not depend on C, and the dual
+     variables are scaled down if needed so that they remain
+     feasible. */
+  if(path && (path->cset.m > 0)) {
+    cset.lhs=(DOC **)realloc(cset.lhs,sizeof(DOC *)*(cset.m+path->cset.m));
+    cset.rhs=(double *)realloc(cset.rhs,sizeof(double)*(cset.m+path->cset.m));
+    alpha=(double *)realloc(alpha,sizeof(double)*(cset.m+path->cset.m));
+    alphahist=(long *)realloc(alphahist,sizeof(long)*(cset.m+path->cset.m));
+    for(j=0;j<path->cset.m;j++) {
+      cset.lhs[cset.m]=path->cset.lhs[j];
+      cset.lhs[cset.m]->docnum=cset.m;
+      cset.rhs[cset.m]=path->cset.rhs[j];
+      alpha[cset.m]=path->alpha[j]*MIN(1,sparm->C/path->C);
+      alphahist[cset.m]=optcount;
+      cset.m++;
+    }
+    free(path->cset.lhs);
+    free(path->cset.rhs);
+    free(path->alpha);
+    path->cset.m=0;
+    path->cset.lhs=NULL;
+    path->cset.rhs=NULL;
+    path->alpha=NULL;
+  }
   kparm->gram_matrix=NULL;
   if((alg_type == ONESLACK_DUAL_ALG) || (alg_type == ONESLACK_DUAL_CACHE_ALG))
-    kparm->gram_matrix=init_kernel_matrix(&cset,kparm);
+    kparm->gram_matrix=init_kernel_matrix(&cset,kparm,lparm->num_threads);
 
   /* set initial model and slack variables */
   svmModel=(MODEL *)my_malloc(sizeof(MODEL));
@@ -563,25 +609,40 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
   add_weight_vector_to_linear_model(svmModel);
   sm->svm_model=svmModel;
   sm->w=svmModel->lin_weights; /* short cut to weight vector */
+  update_struct_model(sm,sparm);
 
-  /* create a cache of the feature vectors for the correct labels */
-  fycache=(SVECTOR **)my_malloc(n*sizeof(SVECTOR *));
-  for(i=0;i<n;i++) {
-    if(USE_FYCACHE) {
-      fy=psi(ex[i].x,ex[i].y,sm,sparm);
-      if(kparm->kernel_type == LINEAR) { /* store difference vector directly */
-	diff=add_list_sort_ss_r(fy,COMPACT_ROUNDING_THRESH); 
-	free_svector(fy);
-	fy=diff;
+  /* create a cache of the feature vectors for the correct labels,
+     unless a previous model of the path did */
+  if(path && path->fycache)
+    fycache=path->fycache;
+  else {
+    fycache=(SVECTOR **)my_malloc(n*sizeof(SVECTOR *));
+    if(USE_FYCACHE)
+      psi_of_examples(fycache,ex,n,sm,sparm);
+    for(i=0;i<n;i++) {
+      if(USE_FYCACHE) {
+	fy=fycache[i];
+	if(kparm->kernel_type == LINEAR) { /* store difference vector directly */
+	  diff=add_list_sort_ss_r(fy,COMPACT_ROUNDING_THRESH); 
+	  free_svector(fy);
+	  fy=diff;
+	}
       }
+      else
+	fy=NULL;
+      fycache[i]=fy;
     }
-    else
-      fy=NULL;
-    fycache[i]=fy;
+    if(path)
+      path->fycache=fycache;
   }
 
-  /* initialize the constraint cache */
-  if(alg_type == ONESLACK_DUAL_CACHE_ALG) {
+  /* initialize the constraint cache, or take over the one of the
+     previous model of the path */
+  if((alg_type == ONESLACK_DUAL_CACHE_ALG) && path && path->ccache) {
+    ccache=path->ccache;
+    ccache->sm=sm;
+  }
+  else if(alg_type == ONESLACK_DUAL_CACHE_ALG) {
     ccache=create_constraint_cache(sample,sparm,sm);
     /* NOTE:  */
     for(i=0;i<n;i++) 
@@ -590,6 +651,8 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	printf("       W4 algorithm assumes that loss(y_i,y_i)=0 for all i.\n");
 	exit(1);
       }
+    if(path)
+      path->ccache=ccache;
   }
   
   if(kparm->kernel_type == LINEAR)
@@ -599,6 +662,26 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
   if(batch_size<n)
     randmapping=random_order(n);
 
+  /* buffers for computing the most violated constraints of a whole
+     batch of examples at once */
+  batch_exnum=(long *)my_malloc(sizeof(long)*n);
+  batch_fydelta=(SVECTOR **)my_malloc(sizeof(SVECTOR *)*n);
+  batch_rhs=(double *)my_malloc(sizeof(double)*n);
+
+  /* find the most violated constraints of the next batch while the
+     QP is solved. This is possible only with native oracles, as
+     MATLAB cannot be called back concurrently. */
+  pipeline=(sparm->pipeline && (alg_type == ONESLACK_DUAL_CACHE_ALG)
+	    && (kparm->kernel_type == LINEAR) && has_native_oracles(sparm)
+	    && (get_num_threads(2) > 1));
+  if(pipeline) {
+    prefetch_exnum=(long *)my_malloc(sizeof(long)*n);
+    prefetch_ybar=(LABEL *)my_malloc(sizeof(LABEL)*n);
+    prefetch_fybar=(SVECTOR **)my_malloc(sizeof(SVECTOR *)*n);
+    prefetch_loss=(double *)my_malloc(sizeof(double)*n);
+    prefetch_w=(double *)my_malloc(sizeof(double)*sizePsi);
+  }
+
   rt_init+=MAX(get_runtime()-rt1,0);
   rt_total+=rt_init;
 
@@ -628,12 +711,49 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
       /**** find a violated joint constraint ****/
       lhs=NULL;
       rhs=0;
+      stale_constraint=0;
       if(alg_type == ONESLACK_DUAL_CACHE_ALG) {
 	rt1=get_runtime();
 	/* Compute violation of constraints in cache for current w */
 	if(struct_verbosity>=2) rt2=get_runtime();
-	update_constraint_cache_for_model(ccache, svmModel);
+	update_constraint_cache_for_model(ccache,svmModel,lparm->num_threads);
 	if(struct_verbosity>=2) rt_cacheupdate+=MAX(get_runtime()-rt2,0);
+	/* Add the constraints prefetched while the last QP was solved,
+	   i.e. with the previous w, to the cache. They are scored
+	   against the current w like all the others. */
+	prefetched=prefetch_num;
+	prefetch_viol=0;
+	if(prefetch_num) {
+	  if(struct_verbosity>=2) rt2=get_runtime();
+	  for(k=0;k<prefetch_num;k++) {
+	    i=prefetch_exnum[k];
+	    if(empty_label(prefetch_ybar[k])) {
+	      prefetch_fybar[k]=NULL;
+	      prefetch_loss[k]=0;
+	    }
+	    else {
+	      prefetch_fybar[k]=psi(ex[i].x,prefetch_ybar[k],sm,sparm);
+	      prefetch_loss[k]=loss(ex[i].y,prefetch_ybar[k],sparm);
+	    }
+	  }
+	  if(struct_verbosity>=2) rt_viol+=MAX(get_runtime()-rt2,0);
+	  constraints_from_labels(batch_fydelta,batch_rhs,ex,prefetch_exnum,
+				  prefetch_num,prefetch_ybar,prefetch_fybar,
+				  prefetch_loss,fycache,n,sm,sparm,&rt_psi);
+	  for(k=0;k<prefetch_num;k++) {
+	    if(struct_verbosity>=1) 
+	      print_percent_progress(&progress,n,10,".");
+	    i=prefetch_exnum[k];
+	    if(struct_verbosity>=2) rt2=get_runtime();
+	    add_constraint_to_constraint_cache(ccache,sm->svm_model,
+			       i,batch_fydelta[k],batch_rhs[k],
+			       0.0001*sparm->epsilon/n,
+			       sparm->ccache_size,&rt_cachesum);
+	    if(struct_verbosity>=2) rt_cacheadd+=MAX(get_runtime()-rt2,0);
+	    prefetch_viol+=ccache->constlist[i]->viol;
+	  }
+	  prefetch_num=0;
+	}
 	/* Is there is a sufficiently violated constraint in cache? */
 	viol=compute_violation_of_constraint_in_cache(ccache,epsilon_est/2);
 	if(viol-slack > MAX(epsilon_est/10,sparm->epsilon)) { 
@@ -641,7 +761,8 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	     use this constraint in this iteration. */
 	  if(struct_verbosity>=2) rt2=get_runtime();
 	  viol=find_most_violated_joint_constraint_in_cache(ccache,
-					       epsilon_est/2,lhs_n,&lhs,&rhs);
+					       epsilon_est/2,lhs_n,&lhs,&rhs,
+					       lparm->num_threads);
 	  if(struct_verbosity>=2) rt_cacheconst+=MAX(get_runtime()-rt2,0);
 	  cached_constraint=1;
 	}
@@ -649,38 +770,57 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	  /* There is no sufficiently violated constraint in cache, so
 	     update cache by computing most violated constraint
 	     explicitly for batch_size examples. */
-	  viol_est=0;
+	  viol_est=prefetch_viol;
 	  progress=0;
 	  viol=compute_violation_of_constraint_in_cache(ccache,0);
-	  for(j=0;(j<batch_size) || ((j<n)&&(viol-slack<sparm->epsilon));j++) {
-	    if(struct_verbosity>=1) 
-	      print_percent_progress(&progress,n,10,".");
-	    uptr=uptr % n;
-	    if(randmapping) 
-	      i=randmapping[uptr];
-	    else
-	      i=uptr;
-	    /* find most violating fydelta=fy-fybar and rhs for example i */
-	    find_most_violated_constraint(&fydelta,&rhs_i,&ex[i],
-					  fycache[i],n,sm,sparm,
-					  &rt_viol,&rt_psi,&argmax_count);
-	    /* add current fy-fybar and loss to cache */
-	    if(struct_verbosity>=2) rt2=get_runtime();
-	    viol+=add_constraint_to_constraint_cache(ccache,sm->svm_model,
-			     i,fydelta,rhs_i,0.0001*sparm->epsilon/n,
-			     sparm->ccache_size,&rt_cachesum);
-	    if(struct_verbosity>=2) rt_cacheadd+=MAX(get_runtime()-rt2,0);
-	    viol_est+=ccache->constlist[i]->viol;
-	    uptr++;
+	  for(j=prefetched;
+	      (j<batch_size) || ((j<n)&&(viol-slack<sparm->epsilon));) {
+	    /* process the examples in batches of batch_size, so that
+	       their most violated constraints are found at once */
+	    batch_num=MIN(MAX(batch_size,1),n-j);
+	    for(k=0;k<batch_num;k++) {
+	      uptr=uptr % n;
+	      if(randmapping) 
+		batch_exnum[k]=randmapping[uptr];
+	      else
+		batch_exnum[k]=uptr;
+	      uptr++;
+	    }
+	    /* find most violating fydelta=fy-fybar and rhs for the batch */
+	    find_most_violated_constraints(batch_fydelta,batch_rhs,ex,
+					   batch_exnum,batch_num,fycache,n,
+					   sm,sparm,&rt_viol,&rt_psi,
+					   &argmax_count);
+	    for(k=0;k<batch_num;k++) {
+	      if(struct_verbosity>=1) 
+		print_percent_progress(&progress,n,10,".");
+	      i=batch_exnum[k];
+	      /* add current fy-fybar and loss to cache */
+	      if(struct_verbosity>=2) rt2=get_runtime();
+	      viol+=add_constraint_to_constraint_cache(ccache,sm->svm_model,
+			       i,batch_fydelta[k],batch_rhs[k],
+			       0.0001*sparm->epsilon/n,
+			       sparm->ccache_size,&rt_cachesum);
+	      if(struct_verbosity>=2) rt_cacheadd+=MAX(get_runtime()-rt2,0);
+	      viol_est+=ccache->constlist[i]->viol;
+	    }
+	    j+=batch_num;
 	  }
-	  cached_constraint=(j<n);
+	  /* a full pass that includes prefetched constraints is not
+	     exact, since these were found for the previous w, and it
+	     is treated as a cached constraint. The next QP is then
+	     solved without prefetching, so that the following pass is
+	     exact. */
+	  stale_constraint=(j>=n) && (prefetched>0);
+	  cached_constraint=(j<n) || stale_constraint;
 	  if(struct_verbosity>=2) rt2=get_runtime();
-	  if(cached_constraint)
+	  if(j<n)
 	    viol=find_most_violated_joint_constraint_in_cache(ccache,
-					       epsilon_est/2,lhs_n,&lhs,&rhs);
+					       epsilon_est/2,lhs_n,&lhs,&rhs,
+					       lparm->num_threads);
 	  else
 	    viol=find_most_violated_joint_constraint_in_cache(ccache,0,lhs_n,
-							 &lhs,&rhs);
+					       &lhs,&rhs,lparm->num_threads);
 	  if(struct_verbosity>=2) rt_cacheconst+=MAX(get_runtime()-rt2,0);
 	  viol_est*=((double)n/j);
 	  epsilon_est=(1-(double)j/n)*epsilon_est+(double)j/n*(viol_est-slack);
@@ -701,36 +841,68 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	progress=0;
 	rt_total+=MAX(get_runtime()-rt1,0);
 
-	for(i=0; i<n; i++) {
-	  rt1=get_runtime();
-
+	/* native oracles can sum the constraints of all examples
+	   directly into lhs_n, using several threads */
+	rt1=get_runtime();
+	if((kparm->kernel_type == LINEAR)
+	   && sum_most_violated_constraints(lhs_n,&rhs,ex,n,fycache,
+					    lparm->num_threads,sm,sparm)) {
+	  argmax_count+=n;
 	  if(struct_verbosity>=1) 
-	    print_percent_progress(&progress,n,10,".");
-
-	  /* compute most violating fydelta=fy-fybar and rhs for example i */
-	  find_most_violated_constraint(&fydelta,&rhs_i,&ex[i],fycache[i],n,
-				      sm,sparm,&rt_viol,&rt_psi,&argmax_count);
-	  /* add current fy-fybar to lhs of constraint */
-	  if(kparm->kernel_type == LINEAR) {
-	    add_list_n_ns(lhs_n,fydelta,1.0); /* add fy-fybar to sum */
-	    free_svector(fydelta);
-	  }
-	  else {
-	    append_svector_list(fydelta,lhs); /* add fy-fybar to vector list */
-	    lhs=fydelta;
-	  }
-	  rhs+=rhs_i;                         /* add loss to rhs */
-	  
+	    for(i=0; i<n; i++)
+	      print_percent_progress(&progress,n,10,".");
+	  if(struct_verbosity>=2) rt_viol+=MAX(get_runtime()-rt1,0);
+	  rt_total+=MAX(get_runtime()-rt1,0);
+	}
+	else {
+	  /* compute most violating fydelta=fy-fybar and rhs for a
+	     chunk of examples at a time, and fold it into lhs before
+	     fetching the next one. A batch oracle gets all examples at
+	     once, and so do kernels, which keep all fydelta anyway. */
+	  if((kparm->kernel_type != LINEAR) || has_batch_oracle(sparm))
+	    batch_num=n;
+	  else
+	    batch_num=MIN(MAX(batch_size,1),MAX_CONSTRAINT_CHUNK);
 	  rt_total+=MAX(get_runtime()-rt1,0);
 
-	} /* end of example loop */
+	  for(j=0; j<n; j+=batch_num) {
+	    rt1=get_runtime();
+	    k=MIN(batch_num,n-j);
+	    for(i=0; i<k; i++)
+	      batch_exnum[i]=j+i;
+	    find_most_violated_constraints(batch_fydelta,batch_rhs,ex,
+					   batch_exnum,k,fycache,n,sm,sparm,
+					   &rt_viol,&rt_psi,&argmax_count);
+
+	    for(i=0; i<k; i++) {
+	      if(struct_verbosity>=1) 
+		print_percent_progress(&progress,n,10,".");
+
+	      fydelta=batch_fydelta[i];
+	      rhs_i=batch_rhs[i];
+	      /* add current fy-fybar to lhs of constraint */
+	      if(kparm->kernel_type == LINEAR) {
+		add_list_n_ns(lhs_n,fydelta,1.0); /* add fy-fybar to sum */
+		free_svector(fydelta);
+	      }
+	      else {
+		append_svector_list(fydelta,lhs); /* add fy-fybar to vector list */
+		lhs=fydelta;
+	      }
+	      rhs+=rhs_i;                         /* add loss to rhs */
+	    } /* end of example loop */
+	  
+	    rt_total+=MAX(get_runtime()-rt1,0);
+	  }
+	}
 
 	rt1=get_runtime();
 
 	/* create sparse vector from dense sum */
 	if(kparm->kernel_type == LINEAR)
-	  lhs=create_svector_n_r(lhs_n,sm->sizePsi,NULL,1.0,
-				 COMPACT_ROUNDING_THRESH);
+	  lhs=create_svector_n_r_par(lhs_n,sm->sizePsi,NULL,1.0,
+				     COMPACT_ROUNDING_THRESH,
+				     lparm->num_threads);
 	doc=create_example(cset.m,0,1,1,lhs);
 	lhsXw=classify_example(svmModel,doc);
 	free_example(doc,0);
@@ -766,7 +938,8 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	   || (alg_type == ONESLACK_DUAL_CACHE_ALG)) {
 	  if(struct_verbosity>=2) rt2=get_runtime();
 	  kparm->gram_matrix=update_kernel_matrix(kparm->gram_matrix,cset.m-1,
-						  &cset,kparm);
+						  &cset,kparm,
+						  lparm->num_threads);
 	  if(struct_verbosity>=2) rt_kernel+=MAX(get_runtime()-rt2,0);
 	}
 	
@@ -785,6 +958,22 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	  lparm->epsilon_crit=epsilon/2; 
 	  epsilon_cached=epsilon;
 	}
+	/* choose the next batch of examples to prefetch and keep a
+	   copy of the current w, which is freed with svmModel */
+	if(pipeline && !stale_constraint) {
+	  prefetch_num=MIN(MAX(batch_size,1),n);
+	  for(k=0;k<prefetch_num;k++) {
+	    uptr=uptr % n;
+	    if(randmapping) 
+	      prefetch_exnum[k]=randmapping[uptr];
+	    else
+	      prefetch_exnum[k]=uptr;
+	    uptr++;
+	  }
+	  for(i=0;i<sizePsi;i++)
+	    prefetch_w[i]=sm->w[i];
+	  argmax_count+=prefetch_num;
+	}
 	free_model(svmModel,0);
 	svmModel=(MODEL *)my_malloc(sizeof(MODEL));
 	/* Run the QP solver on cset. */
@@ -792,8 +981,38 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	if((alg_type == ONESLACK_DUAL_ALG) 
 	   || (alg_type == ONESLACK_DUAL_CACHE_ALG))
 	  kparm->kernel_type=GRAM; /* use kernel stored in kparm */
-	svm_learn_optimization(cset.lhs,cset.rhs,cset.m,sizePsi,
-			       lparm,kparm,NULL,svmModel,alpha);
+	/* The calling thread solves the QP, while the other threads
+	   find the most violated constraints of the prefetched batch
+	   for the previous w. Only the calling thread may allocate
+	   memory or call MATLAB. */
+#ifdef _OPENMP
+#pragma omp parallel num_threads(MAX(2,get_num_threads(lparm->num_threads))) if(prefetch_num>0)
+#endif
+	{
+	  long kk;
+	  int  thread=0,num_workers=0;
+#ifdef _OPENMP
+	  thread=omp_get_thread_num();
+	  num_workers=omp_get_num_threads()-1;
+#endif
+	  if(thread == 0) {
+	    svm_learn_optimization(cset.lhs,cset.rhs,cset.m,sizePsi,
+				   lparm,kparm,NULL,svmModel,alpha);
+	    if(num_workers == 0)
+	      for(kk=0;kk<prefetch_num;kk++)
+		prefetch_ybar[kk]=find_most_violated_constraint_native(
+				     ex[prefetch_exnum[kk]].x,
+				     ex[prefetch_exnum[kk]].y,
+				     prefetch_w,sm,sparm);
+	  }
+	  else {
+	    for(kk=thread-1;kk<prefetch_num;kk+=num_workers)
+	      prefetch_ybar[kk]=find_most_violated_constraint_native(
+				   ex[prefetch_exnum[kk]].x,
+				   ex[prefetch_exnum[kk]].y,
+				   prefetch_w,sm,sparm);
+	  }
+	}
 	kparm->kernel_type=kernel_type_org; 
 	svmModel->kernel_parm.kernel_type=kernel_type_org;
 	/* Always add weight vector, in case part of the kernel is
@@ -802,6 +1021,7 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	add_weight_vector_to_linear_model(svmModel);
 	sm->svm_model=svmModel;
 	sm->w=svmModel->lin_weights; /* short cut to weight vector */
+	update_struct_model(sm,sparm);
 	optcount++;
 	/* keep track of when each constraint was last
 	   active. constraints marked with -1 are not updated */
@@ -815,7 +1035,8 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 	   avoid bloating the working set beyond necessity. */
 	if(struct_verbosity>=3)
 	  printf("Reducing working set...");fflush(stdout);
-	remove_inactive_constraints(&cset,alpha,optcount,alphahist,50);
+	remove_inactive_constraints(&cset,alpha,optcount,alphahist,50,
+				    lparm->qp_state);
 	if(struct_verbosity>=3)
 	  printf("done. ");
       }
@@ -890,6 +1111,7 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
   if(svmModel) {
     sm->svm_model=copy_model(svmModel);
     sm->w=sm->svm_model->lin_weights; /* short cut to weight vector */
+    update_struct_model(sm,sparm);
     free_model(svmModel,0);
   }
 
@@ -897,12 +1119,588 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 
   if(lhs_n)
     free_nvector(lhs_n);
-  if(ccache)    
-    free_constraint_cache(ccache);
+  if(randmapping)
+    free(randmapping);
+  free(batch_exnum);
+  free(batch_fydelta);
+  free(batch_rhs);
+  if(pipeline) {
+    for(k=0;k<prefetch_num;k++)
+      free_label(prefetch_ybar[k]);
+    free(prefetch_exnum);
+    free(prefetch_ybar);
+    free(prefetch_fybar);
+    free(prefetch_loss);
+    free(prefetch_w);
+  }
+  if(path) {
+    /* pass the working set on to the next model of the path, except
+       for the constraints of init_struct_constraints(), which that
+       model adds again */
+    for(i=0,j=0;i<cset.m;i++) {
+      if(alphahist[i] < 0) {
+	free_example(cset.lhs[i],1);
+	continue;
+      }
+      cset.lhs[j]=cset.lhs[i];
+      cset.rhs[j]=cset.rhs[i];
+      alpha[j]=alpha[i];
+      j++;
+    }
+    path->cset.m=j;
+    path->cset.lhs=cset.lhs;
+    path->cset.rhs=cset.rhs;
+    path->alpha=alpha;
+    path->C=sparm->C;
+    free(alphahist);
+  }
+  else {
+    if(ccache)    
+      free_constraint_cache(ccache);
+    for(i=0;i<n;i++)
+      if(fycache[i])
+	free_svector(fycache[i]);
+    free(fycache);
+    free(alpha); 
+    free(alphahist); 
+    free(cset.rhs); 
+    for(i=0;i<cset.m;i++) 
+      free_example(cset.lhs[i],1);
+    free(cset.lhs);
+  }
+  if(kparm->gram_matrix)
+    free_matrix(kparm->gram_matrix);
+  free_qp_state(lparm->qp_state);
+  lparm->qp_state=NULL;
+}
+
+
+MODEL *create_linear_model(double *w, long sizePsi, long n,
+			   KERNEL_PARM *kparm)
+     /* creates an SVM-light model holding the weight vector w (of
+	size sizePsi+1, indexed from 1) and no support vectors. Used
+	by the algorithms which optimize w directly (w=5,6,9). */
+{
+  MODEL *model;
+
+  model=(MODEL *)my_malloc(sizeof(MODEL));
+  model->supvec=(DOC **)my_malloc(sizeof(DOC *)*2);
+  model->alpha=(double *)my_malloc(sizeof(double)*2);
+  model->index=NULL;
+  model->supvec[0]=NULL;
+  model->alpha[0]=0;
+  model->sv_num=1;
+  model->at_upper_bound=0;
+  model->b=0;
+  model->totwords=sizePsi;
+  model->totdoc=n;
+  model->kernel_parm=(*kparm);
+  model->loo_error=-1;
+  model->loo_recall=-1;
+  model->loo_precision=-1;
+  model->xa_error=-1;
+  model->xa_recall=-1;
+  model->xa_precision=-1;
+  model->lin_weights=w;
+  model->maxdiff=0;
+  return(model);
+}
+
+
+void svm_learn_struct_ssg(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
+			  LEARN_PARM *lparm, KERNEL_PARM *kparm, 
+			  STRUCTMODEL *sm)
+     /* Input: sample (training examples)
+	       sparm (structural learning parameters)
+               lparm (svm learning parameters)
+               kparm (kernel parameters)
+	       Output: sm (learned model) */
+     /* Stochastic subgradient descent (Pegasos, Shalev-Shwartz et
+	al., ICML 2007) on the primal of the n-slack problem for
+	linear models, written as
+
+	  min 1/(2C)*|w|^2 + sum_i max(0, rhs_i - w*fydelta_i).
+
+	The examples are visited in random order. Each visit calls
+	the separation oracle once and takes the step
+
+	  w <- (1-1/t)*w + C*n/t*fydelta_i
+
+	(the second term only if the constraint is violated), followed
+	by the projection on the ball |w|^2 <= C*max_i(loss_i) that
+	contains the optimum. No constraint is kept and no QP is
+	solved. With sparm->ssg_average the model returned is the
+	average of the iterates with weights proportional to t. A
+	pass over the examples is an iteration, and learning stops
+	after sparm->ssg_passes passes. */
+{
+  long        i,j,k,t=0;
+  int         numIt=0;
+  long        argmax_count=0;
+  long        sizePsi;
+  long        n=sample.n;
+  EXAMPLE     *ex=sample.examples;
+  double      *w,*wavg=NULL;
+  SVECTOR     **fycache,*fy,*diff,*fydelta,*f;
+  double      rhs,lhsXw,slack,slacksum,lossmax=0;
+  double      eta,rho,norm2,modellength;
+  long        *randmapping;
+  long        progress;
+  CONSTSET    cset;
+  double      rt_total=0,rt_viol=0,rt_psi=0,rt_init=0;
+  double      rt1=0;
+
+  rt1=get_runtime();
+
+  if(kparm->kernel_type != LINEAR) {
+    printf("ERROR: The SSG algorithm is implemented only for linear kernels!\n");
+    fflush(stdout);
+    exit(1);
+  }
+  if(sparm->slack_norm != 1) {
+    printf("ERROR: The SSG algorithm applies only to the L1 slack norm!\n");
+    fflush(stdout);
+    exit(1);
+  }
+
+  init_struct_model(sample,sm,sparm,lparm,kparm); 
+  sizePsi=sm->sizePsi;
+
+  /* start from w=0 */
+  w=create_nvector(sizePsi);
+  clear_nvector(w,sizePsi);
+  sm->svm_model=create_linear_model(w,sizePsi,n,kparm);
+  sm->w=w;
+  update_struct_model(sm,sparm);
+  if(sparm->ssg_average) {
+    wavg=create_nvector(sizePsi);
+    clear_nvector(wavg,sizePsi);
+  }
+
+  /* create a cache of the feature vectors for the correct labels */
+  fycache=(SVECTOR **)my_malloc(n*sizeof(SVECTOR *));
+  if(USE_FYCACHE)
+    psi_of_examples(fycache,ex,n,sm,sparm);
+  for(i=0;i<n;i++) {
+    if(USE_FYCACHE) {
+      fy=fycache[i];
+      diff=add_list_sort_ss_r(fy,COMPACT_ROUNDING_THRESH); 
+      free_svector(fy);
+      fy=diff;
+    }
+    else
+      fy=NULL;
+    fycache[i]=fy;
+  }
+
+  rt_init+=MAX(get_runtime()-rt1,0);
+  rt_total+=rt_init;
+
+  cset.m=0;
+  cset.lhs=NULL;
+  cset.rhs=NULL;
+
+    /*****************/
+   /*** main loop ***/
+  /*****************/
+  do { /* one pass over the examples in random order */
+
+    numIt++;
+    if(struct_verbosity>=1) { 
+      printf("Iter %i: ",numIt); 
+      fflush(stdout);
+    }
+
+    rt1=get_runtime();
+    randmapping=random_order(n);
+    progress=0;
+    slacksum=0;
+    for(k=0;k<n;k++) {
+      i=randmapping[k];
+      if(struct_verbosity>=1) 
+	print_percent_progress(&progress,n,10,".");
+
+      find_most_violated_constraint(&fydelta,&rhs,&ex[i],fycache[i],n,
+				    sm,sparm,&rt_viol,&rt_psi,
+				    &argmax_count);
+      lhsXw=0;
+      for(f=fydelta;f;f=f->next)
+	lhsXw+=f->factor*sprod_ns(w,f);
+      slack=MAX(0,rhs-lhsXw);
+      slacksum+=slack;
+      lossmax=MAX(lossmax,n*rhs);
+
+      /* subgradient step with step size C/t */
+      t++;
+      eta=sparm->C/t;
+      for(j=1;j<=sizePsi;j++)
+	w[j]*=(1.0-1.0/t);
+      if(slack > 0)
+	add_list_n_ns(w,fydelta,eta*n);
+      free_svector(fydelta);
+
+      /* projection on the ball containing the optimum */
+      for(norm2=0,j=1;j<=sizePsi;j++)
+	norm2+=w[j]*w[j];
+      if(norm2 > sparm->C*lossmax) {
+	rho=sqrt(sparm->C*lossmax/norm2);
+	for(j=1;j<=sizePsi;j++)
+	  w[j]*=rho;
+      }
+      update_struct_model(sm,sparm);
+
+      if(wavg) {
+	rho=2.0/(t+1);
+	for(j=1;j<=sizePsi;j++)
+	  wavg[j]+=rho*(w[j]-wavg[j]);
+      }
+    }
+    free(randmapping);
+    rt_total+=MAX(get_runtime()-rt1,0);
+
+    if(struct_verbosity>=1) {
+      for(norm2=0,j=1;j<=sizePsi;j++)
+	norm2+=w[j]*w[j];
+      printf("(Obj=%.5f, |w|=%.5f)\n",
+	     0.5*norm2+sparm->C*slacksum,sqrt(norm2));
+    }
+
+  } while((numIt < sparm->ssg_passes)
+	  | finalize_iteration(slacksum,0,sample,sm,cset,NULL,sparm));
+
+  /* return the average of the iterates */
+  if(wavg) {
+    for(j=1;j<=sizePsi;j++)
+      w[j]=wavg[j];
+    free_nvector(wavg);
+    update_struct_model(sm,sparm);
+  }
+
+  if(struct_verbosity>=1) {
+    for(norm2=0,j=1;j<=sizePsi;j++)
+      norm2+=w[j]*w[j];
+    modellength=sqrt(norm2);
+    printf("Objective along the last pass (estimate): %.5f\n",
+	   0.5*norm2+sparm->C*slacksum);
+    printf("Number of iterations: %d\n",numIt);
+    printf("Number of calls to 'find_most_violated_constraint': %ld\n",argmax_count);
+    printf("Norm of weight vector: |w|=%.5f\n",modellength);
+    if(struct_verbosity>=2) 
+      printf("Runtime in cpu-seconds: %.2f (%.2f%% for Argmax, %.2f%% for Psi, %.2f%% for init)\n",
+	     rt_total/100.0, (100.0*rt_viol)/rt_total, 
+	     (100.0*rt_psi)/rt_total, (100.0*rt_init)/rt_total);
+    else if(struct_verbosity==1) 
+      printf("Runtime in cpu-seconds: %.2f\n",rt_total/100.0);
+  }
+  if(struct_verbosity>=4)
+    printW(sm->w,sizePsi+1,n,sparm->C);
+
+  /* store w also as the only support vector, so that the model can
+     be written and read back like the ones of the other algorithms */
+  sm->svm_model->supvec[1]=create_example(-1,0,0,0,
+			     create_svector_n_r(w,sizePsi,NULL,1.0,
+						COMPACT_ROUNDING_THRESH));
+  sm->svm_model->alpha[1]=1;
+  sm->svm_model->sv_num=2;
+  update_struct_model(sm,sparm);
+
+  print_struct_learning_stats(sample,sm,cset,NULL,sparm);
+
   for(i=0;i<n;i++)
     if(fycache[i])
       free_svector(fycache[i]);
   free(fycache);
+}
+
+
+void svm_learn_struct_bmrm(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
+			   LEARN_PARM *lparm, KERNEL_PARM *kparm, 
+			   STRUCTMODEL *sm)
+     /* Input: sample (training examples)
+	       sparm (structural learning parameters)
+               lparm (svm learning parameters)
+               kparm (kernel parameters)
+	       Output: sm (learned model) */
+     /* One-slack cutting-plane algorithm for linear models with a
+	line search between the best w found so far, wb, and the
+	minimizer wc of the cutting-plane model, in the spirit of
+	BMRM with line search (Teo et al., JMLR 2010) and OCAS (Franc
+	and Sonnenburg, ICML 2008). The working set of joint
+	constraints and its gram matrix are the same as with the w=3
+	algorithm, but the separation oracle is called at
+
+	  w = wb + mu*(wc-wb)
+
+	instead of at wc. The joint constraint found at w gives the
+	exact objective at w, so each trial point of the line search
+	costs one pass over the examples and adds its constraint to
+	the working set like any other. If the objective decreases, w
+	becomes wb and mu is doubled (up to 1), otherwise mu is
+	halved. Learning stops when the objective at wb is within
+	C*epsilon of the dual objective of the QP, which is a lower
+	bound of the optimum, and wb is returned. */
+{
+  long        i,j;
+  int         numIt=0;
+  long        argmax_count=0;
+  long        totconstraints=0;
+  long        sizePsi;
+  long        n=sample.n;
+  EXAMPLE     *ex=sample.examples;
+  CONSTSET    cset;
+  MODEL       *qpModel;
+  double      *w,*wb,*wc,*lhs_n,*alpha=NULL;
+  long        *alphahist=NULL,optcount=0;
+  SVECTOR     **fycache,*fy,*diff,*lhs;
+  SVECTOR     **batch_fydelta;
+  double      *batch_rhs;
+  long        *batch_exnum;
+  long        batch_num,k;
+  double      rhs,lhsXw,obj,objb,dual,gap,mu,norm2,alphasum;
+  long        progress;
+  double      rt_total=0,rt_opt=0,rt_viol=0,rt_psi=0,rt_init=0;
+  double      rt1=0,rt2=0;
+
+  rt1=get_runtime();
+
+  if(kparm->kernel_type != LINEAR) {
+    printf("ERROR: The BMRM algorithm is implemented only for linear kernels!\n");
+    fflush(stdout);
+    exit(1);
+  }
+  if(sparm->slack_norm != 1) {
+    printf("ERROR: The BMRM algorithm applies only to the L1 slack norm!\n");
+    fflush(stdout);
+    exit(1);
+  }
+
+  init_struct_model(sample,sm,sparm,lparm,kparm); 
+  sizePsi=sm->sizePsi;
+
+  lparm->svm_c=sparm->C;            /* set upper bound C */
+  lparm->sharedslack=1;
+  lparm->biased_hyperplane=0;       /* set threshold to zero */
+  lparm->epsilon_crit=sparm->epsilon/2;
+  lparm->qp_state=create_qp_state(); /* the QP of each iteration
+				     starts from that of the last */
+
+  /* start from w=0 */
+  w=create_nvector(sizePsi);
+  wb=create_nvector(sizePsi);
+  wc=create_nvector(sizePsi);
+  lhs_n=create_nvector(sizePsi);
+  clear_nvector(w,sizePsi);
+  clear_nvector(wb,sizePsi);
+  sm->svm_model=create_linear_model(w,sizePsi,n,kparm);
+  sm->w=w;
+  update_struct_model(sm,sparm);
+  objb=0;
+  mu=1;
+
+  cset=init_struct_constraints(sample, sm, sparm);
+  if(cset.m > 0) {
+    alpha=(double *)realloc(alpha,sizeof(double)*cset.m);
+    alphahist=(long *)realloc(alphahist,sizeof(long)*cset.m);
+    for(i=0; i<cset.m; i++) {
+      alpha[i]=0;
+      alphahist[i]=-1; /* -1 makes sure these constraints are never removed */
+    }
+  }
+  kparm->gram_matrix=init_kernel_matrix(&cset,kparm,lparm->num_threads);
+
+  /* create a cache of the feature vectors for the correct labels */
+  fycache=(SVECTOR **)my_malloc(n*sizeof(SVECTOR *));
+  if(USE_FYCACHE)
+    psi_of_examples(fycache,ex,n,sm,sparm);
+  for(i=0;i<n;i++) {
+    if(USE_FYCACHE) {
+      fy=fycache[i];
+      diff=add_list_sort_ss_r(fy,COMPACT_ROUNDING_THRESH); 
+      free_svector(fy);
+      fy=diff;
+    }
+    else
+      fy=NULL;
+    fycache[i]=fy;
+  }
+
+  batch_exnum=(long *)my_malloc(sizeof(long)*n);
+  batch_fydelta=(SVECTOR **)my_malloc(sizeof(SVECTOR *)*n);
+  batch_rhs=(double *)my_malloc(sizeof(double)*n);
+  for(i=0;i<n;i++)
+    batch_exnum[i]=i;
+
+  rt_init+=MAX(get_runtime()-rt1,0);
+  rt_total+=rt_init;
+
+    /*****************/
+   /*** main loop ***/
+  /*****************/
+  do { /* one pass over the examples at the trial point w */
+
+    numIt++;
+    if(struct_verbosity>=1) { 
+      printf("Iter %i: ",numIt); 
+      fflush(stdout);
+    }
+
+    /**** find the most violated joint constraint at w ****/
+    rt1=get_runtime();
+    clear_nvector(lhs_n,sizePsi);
+    rhs=0;
+    progress=0;
+    if(sum_most_violated_constraints(lhs_n,&rhs,ex,n,fycache,
+				     lparm->num_threads,sm,sparm)) {
+      argmax_count+=n;
+      if(struct_verbosity>=1) 
+	for(i=0; i<n; i++)
+	  print_percent_progress(&progress,n,10,".");
+      if(struct_verbosity>=2) rt_viol+=MAX(get_runtime()-rt1,0);
+    }
+    else {
+      /* fold the constraints into lhs_n a chunk at a time, as in
+	 svm_learn_struct_joint() */
+      batch_num=has_batch_oracle(sparm) ? n : MIN(n,MAX_CONSTRAINT_CHUNK);
+      for(j=0; j<n; j+=batch_num) {
+	k=MIN(batch_num,n-j);
+	find_most_violated_constraints(batch_fydelta,batch_rhs,ex,
+				       batch_exnum+j,k,fycache,n,sm,sparm,
+				       &rt_viol,&rt_psi,&argmax_count);
+	for(i=0; i<k; i++) {
+	  if(struct_verbosity>=1) 
+	    print_percent_progress(&progress,n,10,".");
+	  add_list_n_ns(lhs_n,batch_fydelta[i],1.0); /* add fy-fybar to sum */
+	  free_svector(batch_fydelta[i]);
+	  rhs+=batch_rhs[i];                        /* add loss to rhs */
+	}
+      }
+    }
+
+    /**** exact objective at w and line search step ****/
+    lhsXw=0;
+    norm2=0;
+    for(j=1;j<=sizePsi;j++) {
+      lhsXw+=lhs_n[j]*w[j];
+      norm2+=w[j]*w[j];
+    }
+    obj=0.5*norm2+sparm->C*MAX(0,rhs-lhsXw);
+    if((numIt == 1) || (obj < objb)) {
+      for(j=1;j<=sizePsi;j++)
+	wb[j]=w[j];
+      objb=obj;
+      mu=MIN(1,2*mu);
+    }
+    else
+      mu=mu/2;
+
+    /**** add the constraint to the working set ****/
+    lhs=create_svector_n_r(lhs_n,sizePsi,NULL,1.0,COMPACT_ROUNDING_THRESH);
+    cset.lhs=(DOC **)realloc(cset.lhs,sizeof(DOC *)*(cset.m+1));
+    cset.lhs[cset.m]=create_example(cset.m,0,1,1,lhs);
+    cset.rhs=(double *)realloc(cset.rhs,sizeof(double)*(cset.m+1));
+    cset.rhs[cset.m]=rhs;
+    alpha=(double *)realloc(alpha,sizeof(double)*(cset.m+1));
+    alpha[cset.m]=0;
+    alphahist=(long *)realloc(alphahist,sizeof(long)*(cset.m+1));
+    alphahist[cset.m]=optcount;
+    cset.m++;
+    totconstraints++;
+    kparm->gram_matrix=update_kernel_matrix(kparm->gram_matrix,cset.m-1,
+					    &cset,kparm,lparm->num_threads);
+    rt_total+=MAX(get_runtime()-rt1,0);
+
+    /**** minimize the cutting-plane model ****/
+    if(struct_verbosity>=1) {
+      printf("*");fflush(stdout);
+    }
+    rt1=get_runtime();
+    qpModel=(MODEL *)my_malloc(sizeof(MODEL));
+    kparm->kernel_type=GRAM; /* use kernel stored in kparm */
+    svm_learn_optimization(cset.lhs,cset.rhs,cset.m,sizePsi+1,
+			   lparm,kparm,NULL,qpModel,alpha);
+    kparm->kernel_type=LINEAR;
+    qpModel->kernel_parm.kernel_type=LINEAR;
+    add_weight_vector_to_linear_model(qpModel);
+    alphasum=0;
+    for(i=0;i<cset.m;i++)
+      alphasum+=alpha[i]*cset.rhs[i];
+    norm2=0;
+    for(j=1;j<=sizePsi;j++) {
+      wc[j]=qpModel->lin_weights[j];
+      norm2+=wc[j]*wc[j];
+    }
+    dual=alphasum-0.5*norm2;
+    gap=objb-dual;
+    free_model(qpModel,0);
+    optcount++;
+    for(i=0;i<cset.m;i++) 
+      if((alphahist[i]>-1) && (alpha[i] != 0))  
+	alphahist[i]=optcount;
+    remove_inactive_constraints(&cset,alpha,optcount,alphahist,50,
+				lparm->qp_state);
+    if(struct_verbosity>=2) rt2=MAX(get_runtime()-rt1,0);
+    rt_opt+=rt2;
+    rt_total+=MAX(get_runtime()-rt1,0);
+
+    /**** next trial point ****/
+    for(j=1;j<=sizePsi;j++)
+      w[j]=wb[j]+mu*(wc[j]-wb[j]);
+    update_struct_model(sm,sparm);
+
+    if(struct_verbosity>=1)
+      printf("(NumConst=%d, Obj=%.5f, Gap=%.5f, mu=%.4f)\n",cset.m,
+	     objb,gap,mu);
+
+  } while((gap > sparm->C*sparm->epsilon)
+	  | finalize_iteration(gap/sparm->C,0,sample,sm,cset,alpha,sparm));
+
+  /* return the best w */
+  for(j=1;j<=sizePsi;j++)
+    w[j]=wb[j];
+  update_struct_model(sm,sparm);
+
+  if(struct_verbosity>=1) {
+    for(norm2=0,j=1;j<=sizePsi;j++)
+      norm2+=w[j]*w[j];
+    printf("Upper bound on duality gap: %.5f\n",gap);
+    printf("Dual objective value: dval=%.5f\n",objb-gap);
+    printf("Primal objective value: pval=%.5f\n",objb);
+    printf("Total number of constraints in final working set: %i (of %i)\n",(int)cset.m,(int)totconstraints);
+    printf("Number of iterations: %d\n",numIt);
+    printf("Number of calls to 'find_most_violated_constraint': %ld\n",argmax_count);
+    printf("Norm of weight vector: |w|=%.5f\n",sqrt(norm2));
+    if(struct_verbosity>=2) 
+      printf("Runtime in cpu-seconds: %.2f (%.2f%% for QP, %.2f%% for Argmax, %.2f%% for Psi, %.2f%% for init)\n",
+	     rt_total/100.0, (100.0*rt_opt)/rt_total,
+	     (100.0*rt_viol)/rt_total, (100.0*rt_psi)/rt_total,
+	     (100.0*rt_init)/rt_total);
+    else if(struct_verbosity==1) 
+      printf("Runtime in cpu-seconds: %.2f\n",rt_total/100.0);
+  }
+  if(struct_verbosity>=4)
+    printW(sm->w,sizePsi+1,n,sparm->C);
+
+  /* store w also as the only support vector, so that the model can
+     be written and read back like the ones of the other algorithms */
+  sm->svm_model->supvec[1]=create_example(-1,0,0,0,
+			     create_svector_n_r(w,sizePsi,NULL,1.0,
+						COMPACT_ROUNDING_THRESH));
+  sm->svm_model->alpha[1]=1;
+  sm->svm_model->sv_num=2;
+  update_struct_model(sm,sparm);
+
+  print_struct_learning_stats(sample,sm,cset,alpha,sparm);
+
+  for(i=0;i<n;i++)
+    if(fycache[i])
+      free_svector(fycache[i]);
+  free(fycache);
+  free(batch_exnum);
+  free(batch_fydelta);
+  free(batch_rhs);
+  free_nvector(wb);
+  free_nvector(wc);
+  free_nvector(lhs_n);
   free(alpha); 
   free(alphahist); 
   free(cset.rhs); 
@@ -911,6 +1709,9 @@ void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
   free(cset.lhs);
   if(kparm->gram_matrix)
     free_matrix(kparm->gram_matrix);
+  kparm->gram_matrix=NULL;
+  free_qp_state(lparm->qp_state);
+  lparm->qp_state=NULL;
 }
 
 
@@ -921,61 +1722,147 @@ void find_most_violated_constraint(SVECTOR **fydelta, double *rhs,
 				   long *argmax_count)
      /* returns fydelta=fy-fybar and rhs scalar value that correspond
 	to the most violated constraint for example ex */
+{
+  long exnum=0;
+
+  find_most_violated_constraints(fydelta,rhs,ex,&exnum,1,&fycached,n,
+				 sm,sparm,rt_viol,rt_psi,argmax_count);
+}
+
+
+void find_most_violated_constraints(SVECTOR **fydelta, double *rhs, 
+				    EXAMPLE *ex, long *exnum, long num,
+				    SVECTOR **fycache, long n, 
+				    STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm,
+				    double *rt_viol, double *rt_psi, 
+				    long *argmax_count)
+     /* returns fydelta[k]=fy-fybar and rhs[k] that correspond to the
+	most violated constraint for example ex[exnum[k]], for
+	k=0..num-1. The labels ybar, psi(x,ybar) and the losses are
+	found by a single call to find_most_violated_constraint_batch,
+	so that the API can process the whole batch at once. fycache
+	is indexed by example number and may be NULL. */
 {
   double      rt2=0;
-  LABEL       ybar;
-  SVECTOR     *fybar, *fy;
-  double      factor,lossval;
+  PATTERN     *x;
+  LABEL       *y,*ybar;
+  SVECTOR     **fybar;
+  double      *lossval;
+  long        k;
+
+  x=(PATTERN *)my_malloc(sizeof(PATTERN)*num);
+  y=(LABEL *)my_malloc(sizeof(LABEL)*num);
+  ybar=(LABEL *)my_malloc(sizeof(LABEL)*num);
+  fybar=(SVECTOR **)my_malloc(sizeof(SVECTOR *)*num);
+  lossval=(double *)my_malloc(sizeof(double)*num);
+  for(k=0;k<num;k++) {
+    x[k]=ex[exnum[k]].x;
+    y[k]=ex[exnum[k]].y;
+  }
 
+  /**** get ybar, psi(x,ybar) and loss of the whole batch ****/
   if(struct_verbosity>=2) rt2=get_runtime();
-  (*argmax_count)++;
-  if(sparm->loss_type == SLACK_RESCALING) 
-    ybar=find_most_violated_constraint_slackrescaling(ex->x,ex->y,sm,sparm);
-  else
-    ybar=find_most_violated_constraint_marginrescaling(ex->x,ex->y,sm,sparm);
+  (*argmax_count)+=num;
+  find_most_violated_constraint_batch(x,y,ybar,fybar,lossval,num,sm,sparm);
   if(struct_verbosity>=2) (*rt_viol)+=MAX(get_runtime()-rt2,0);
-  
-  if(empty_label(ybar)) {
-    printf("ERROR: empty label was returned for example\n");
-    /* exit(1); */
-    /* continue; */
+
+  constraints_from_labels(fydelta,rhs,ex,exnum,num,ybar,fybar,lossval,
+			  fycache,n,sm,sparm,rt_psi);
+
+  free(x);
+  free(y);
+  free(ybar);
+  free(fybar);
+  free(lossval);
+}
+
+
+void constraints_from_labels(SVECTOR **fydelta, double *rhs, 
+			     EXAMPLE *ex, long *exnum, long num,
+			     LABEL *ybar, SVECTOR **fybar, double *lossval,
+			     SVECTOR **fycache, long n, 
+			     STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm,
+			     double *rt_psi)
+     /* returns fydelta[k]=fy-fybar and rhs[k] for the labels ybar[k]
+	of the examples ex[exnum[k]], k=0..num-1, given
+	fybar[k]=psi(x,ybar[k]) and lossval[k]=loss(y,ybar[k]). The
+	labels are freed and fybar[k] is reused for fydelta[k]. */
+{
+  double      rt2=0;
+  SVECTOR     *fy;
+  double      factor;
+  long        k;
+
+  for(k=0;k<num;k++) {
+    /**** get psi(x,y) ****/
+    if(struct_verbosity>=2) rt2=get_runtime();
+    if(fycache && fycache[exnum[k]])
+      fy=copy_svector(fycache[exnum[k]]); 
+    else 
+      fy=psi(ex[exnum[k]].x,ex[exnum[k]].y,sm,sparm);
+    if(struct_verbosity>=2) (*rt_psi)+=MAX(get_runtime()-rt2,0);
+
+    if(empty_label(ybar[k])) {
+      printf("ERROR: empty label was returned for example\n");
+      /* exit(1); */
+      /* use a void constraint */
+      mult_svector_list(fy,0);
+      fydelta[k]=fy;
+      rhs[k]=0;
+      continue;
+    }
+    free_label(ybar[k]);
+
+    /**** scale feature vector and margin by loss ****/
+    if(sparm->loss_type == SLACK_RESCALING)
+      factor=lossval[k]/n;
+    else                 /* do not rescale vector for */
+      factor=1.0/n;      /* margin rescaling loss type */
+    mult_svector_list(fy,factor);
+    mult_svector_list(fybar[k],-factor);
+    append_svector_list(fybar[k],fy);   /* compute fy-fybar */
+
+    fydelta[k]=fybar[k];
+    rhs[k]=lossval[k]/n;
   }
-  
-  /**** get psi(x,y) and psi(x,ybar) ****/
-  if(struct_verbosity>=2) rt2=get_runtime();
-  if(fycached)
-    fy=copy_svector(fycached); 
-  else 
-    fy=psi(ex->x,ex->y,sm,sparm);
-  fybar=psi(ex->x,ybar,sm,sparm);
-  if(struct_verbosity>=2) (*rt_psi)+=MAX(get_runtime()-rt2,0);
-  lossval=loss(ex->y,ybar,sparm);
-  free_label(ybar);
-  
-  /**** scale feature vector and margin by loss ****/
-  if(sparm->loss_type == SLACK_RESCALING)
-    factor=lossval/n;
-  else                 /* do not rescale vector for */
-    factor=1.0/n;      /* margin rescaling loss type */
-  mult_svector_list(fy,factor);
-  mult_svector_list(fybar,-factor);
-  append_svector_list(fybar,fy);   /* compute fy-fybar */
-
-  (*fydelta)=fybar;
-  (*rhs)=lossval/n;
+}
+
+
+void psi_of_examples(SVECTOR **fy, EXAMPLE *ex, long n,
+		     STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm)
+     /* computes fy[i]=psi(x,y) for the examples ex[0..n-1] with a
+	single call to psi_batch */
+{
+  PATTERN     *x;
+  LABEL       *y;
+  long        i;
+
+  x=(PATTERN *)my_malloc(sizeof(PATTERN)*n);
+  y=(LABEL *)my_malloc(sizeof(LABEL)*n);
+  for(i=0;i<n;i++) {
+    x[i]=ex[i].x;
+    y[i]=ex[i].y;
+  }
+  psi_batch(x,y,fy,n,sm,sparm);
+  free(x);
+  free(y);
 }
 
 
 void remove_inactive_constraints(CONSTSET *cset, double *alpha, 
 			         long currentiter, long *alphahist, 
-				 long mininactive)
+				 long mininactive, QP_STATE *qp_state)
      /* removes the constraints from cset (and alpha) for which
 	alphahist indicates that they have not been active for at
-	least mininactive iterations */
+	least mininactive iterations. If qp_state is not NULL, they
+	are removed from the state of the QP solved on cset too. */
 
 {  
   long i,m;
+  long *keep=NULL;
   
+  if(qp_state)
+    keep=(long *)my_malloc(sizeof(long)*cset->m);
   m=0;
   for(i=0;i<cset->m;i++) {
     if((alphahist[i]<0) || ((currentiter-alphahist[i]) < mininactive)) {
@@ -986,12 +1873,20 @@ void remove_inactive_constraints(CONSTSET *cset, double *alpha,
       cset->rhs[m]=cset->rhs[i];
       alpha[m]=alpha[i];
       alphahist[m]=alphahist[i];
+      if(keep)
+	keep[i]=1;
       m++;
     }
     else {
+      if(keep)
+	keep[i]=0;
       free_example(cset->lhs[i],1);
     }
   }
+  if(keep) {
+    remove_from_qp_state(qp_state,keep,cset->m);
+    free(keep);
+  }
   if(cset->m != m) {
     cset->m=m;
     cset->lhs=(DOC **)realloc(cset->lhs,sizeof(DOC *)*cset->m);
@@ -1002,12 +1897,14 @@ void remove_inactive_constraints(CONSTSET *cset, double *alpha,
 }
 
 
-MATRIX *init_kernel_matrix(CONSTSET *cset, KERNEL_PARM *kparm) 
+MATRIX *init_kernel_matrix(CONSTSET *cset, KERNEL_PARM *kparm,
+			   long num_threads) 
      /* assigns a kernelid to each constraint in cset and creates the
-	corresponding kernel matrix. */
+	corresponding kernel matrix. each row is computed by
+	num_threads threads. */
 {
   int i,j;
-  double kval;
+  double *kval;
   MATRIX *matrix;
 
   /* assign kernel id to each new constraint */
@@ -1017,23 +1914,27 @@ MATRIX *init_kernel_matrix(CONSTSET *cset, KERNEL_PARM *kparm)
   /* allocate kernel matrix as necessary */
   matrix=create_matrix(i+50,i+50);
 
+  kval=create_nvector(cset->m);
   for(j=0;j<cset->m;j++) {
+    kernel_row_par(kparm,cset->lhs[j],cset->lhs+j,cset->m-j,kval,
+		   num_threads);
     for(i=j;i<cset->m;i++) {
-      kval=kernel(kparm,cset->lhs[j],cset->lhs[i]);
-      matrix->element[j][i]=kval;
-      matrix->element[i][j]=kval;
+      matrix->element[j][i]=kval[i-j];
+      matrix->element[i][j]=kval[i-j];
     }
   }
+  free_nvector(kval);
   return(matrix);
 }
 
 MATRIX *update_kernel_matrix(MATRIX *matrix, int newpos, CONSTSET *cset, 
-			     KERNEL_PARM *kparm) 
+			     KERNEL_PARM *kparm, long num_threads) 
      /* assigns new kernelid to constraint in position newpos and
-	fills the corresponding part of the kernel matrix */
+	fills the corresponding part of the kernel matrix, whose
+	entries are computed by num_threads threads */
 {
   int i,maxkernelid=0,newid;
-  double kval;
+  double *kval;
   double *used;
 
   /* find free kernelid to assign to new constraint */
@@ -1054,11 +1955,14 @@ MATRIX *update_kernel_matrix(MATRIX *matrix, int newpos, CONSTSET *cset,
   if((!matrix) || (maxkernelid>=matrix->m))
     matrix=realloc_matrix(matrix,maxkernelid+50,maxkernelid+50);
 
+  kval=create_nvector(cset->m);
+  kernel_row_par(kparm,cset->lhs[newpos],cset->lhs,cset->m,kval,
+		 num_threads);
   for(i=0;i<cset->m;i++) {
-    kval=kernel(kparm,cset->lhs[newpos],cset->lhs[i]);
-    matrix->element[newid][cset->lhs[i]->kernelid]=kval;
-    matrix->element[cset->lhs[i]->kernelid][newid]=kval;
+    matrix->element[newid][cset->lhs[i]->kernelid]=kval[i];
+    matrix->element[cset->lhs[i]->kernelid][newid]=kval[i];
   }
+  free_nvector(kval);
   return(matrix);
 }
 
@@ -1110,6 +2014,45 @@ void free_constraint_cache(CCACHE *ccache)
   free(ccache);
 }
 
+STRUCT_PATH *create_struct_path(void)
+     /* create the empty state of a regularization path. The models
+	of the path are trained one after the other by
+	svm_learn_struct_joint(), which fills it in. */
+{
+  STRUCT_PATH *path;
+
+  path=(STRUCT_PATH *)my_malloc(sizeof(STRUCT_PATH));
+  path->fycache=NULL;
+  path->ccache=NULL;
+  path->cset.m=0;
+  path->cset.lhs=NULL;
+  path->cset.rhs=NULL;
+  path->alpha=NULL;
+  path->C=0;
+  return(path);
+}
+
+void free_struct_path(STRUCT_PATH *path, long n)
+     /* frees all memory allocated for the regularization path of a
+	training set of n examples */
+{
+  long i;
+  if(path->fycache) {
+    for(i=0;i<n;i++)
+      if(path->fycache[i])
+	free_svector(path->fycache[i]);
+    free(path->fycache);
+  }
+  if(path->ccache)
+    free_constraint_cache(path->ccache);
+  for(i=0;i<path->cset.m;i++)
+    free_example(path->cset.lhs[i],1);
+  free(path->cset.lhs);
+  free(path->cset.rhs);
+  free(path->alpha);
+  free(path);
+}
+
 double add_constraint_to_constraint_cache(CCACHE *ccache, MODEL *svmModel, int exnum, SVECTOR *fydelta, double rhs, double gainthresh, int maxconst, double *rt_cachesum)
      /* add new constraint fydelta*w>rhs for example exnum to cache,
 	if it is more violated (by gainthresh) than the currently most
@@ -1181,47 +2124,81 @@ double add_constraint_to_constraint_cache(CCACHE *ccache, MODEL *svmModel, int e
 }
 
 
-void update_constraint_cache_for_model(CCACHE *ccache, MODEL *svmModel)
+static void update_constraint_cache_for_example(CCACHE *ccache, 
+						MODEL *svmModel, 
+						DOC *doc_fydelta, int i)
+     /* update the violation scores of the constraints of example i
+	and move the most violated one to the top of its list */
+{
+  double  maxviol;
+  double  dist_ydelta;
+  CCACHEELEM *celem,*prev,*maxviol_celem,*maxviol_prev;
+
+  maxviol=0;
+  prev=NULL;
+  maxviol_celem=NULL;
+  maxviol_prev=NULL;
+  for(celem=ccache->constlist[i];celem;celem=celem->next) {
+    doc_fydelta->fvec=celem->fydelta;
+    dist_ydelta=classify_example(svmModel,doc_fydelta);
+    celem->viol=celem->rhs-dist_ydelta;
+    if((celem->viol > maxviol) || (!maxviol_celem)) {
+      maxviol=celem->viol;
+      maxviol_celem=celem;
+      maxviol_prev=prev;
+    }
+    prev=celem;
+  }
+  ccache->changed[i]=0;
+  if(maxviol_prev) { /* move max violated constraint to the top of list */
+    maxviol_prev->next=maxviol_celem->next;
+    maxviol_celem->next=ccache->constlist[i];
+    ccache->constlist[i]=maxviol_celem;
+    ccache->changed[i]=1;
+  }
+}
+
+void update_constraint_cache_for_model(CCACHE *ccache, MODEL *svmModel,
+				       long num_threads)
      /* update the violation scores according to svmModel and find the
-	most violated constraints for each example */
+	most violated constraints for each example. the lists of the
+	examples are independent, so that with a linear model they
+	are split into num_threads chunks updated in parallel. */
 { 
   int     i;
+  long    c,num_chunks=1;
   long    progress=0;
-  double  maxviol=0;
-  double  dist_ydelta;
-  DOC     *doc_fydelta;
-  CCACHEELEM *celem,*prev,*maxviol_celem,*maxviol_prev;
-
-  doc_fydelta=create_example(1,0,1,1,NULL);
-  for(i=0; i<ccache->n; i++) { /*** example loop ***/
-	  
-    if(struct_verbosity>=3) 
-      print_percent_progress(&progress,ccache->n,10,"+");
-
-    maxviol=0;
-    prev=NULL;
-    maxviol_celem=NULL;
-    maxviol_prev=NULL;
-    for(celem=ccache->constlist[i];celem;celem=celem->next) {
-      doc_fydelta->fvec=celem->fydelta;
-      dist_ydelta=classify_example(svmModel,doc_fydelta);
-      celem->viol=celem->rhs-dist_ydelta;
-      if((celem->viol > maxviol) || (!maxviol_celem)) {
-	maxviol=celem->viol;
-	maxviol_celem=celem;
-	maxviol_prev=prev;
-      }
-      prev=celem;
+  DOC     **doc_fydelta;
+
+  if((svmModel->kernel_parm.kernel_type == LINEAR) && (svmModel->lin_weights))
+    num_chunks=MAX(1,minl(get_num_threads(num_threads),ccache->n));
+  doc_fydelta=(DOC **)my_malloc(sizeof(DOC *)*num_chunks);
+  for(c=0;c<num_chunks;c++)
+    doc_fydelta[c]=create_example(1,0,1,1,NULL);
+
+  if(num_chunks == 1) {
+    for(i=0; i<ccache->n; i++) { /*** example loop ***/
+      if(struct_verbosity>=3) 
+	print_percent_progress(&progress,ccache->n,10,"+");
+      update_constraint_cache_for_example(ccache,svmModel,doc_fydelta[0],i);
     }
-    ccache->changed[i]=0;
-    if(maxviol_prev) { /* move max violated constraint to the top of list */
-      maxviol_prev->next=maxviol_celem->next;
-      maxviol_celem->next=ccache->constlist[i];
-      ccache->constlist[i]=maxviol_celem;
-      ccache->changed[i]=1;
+  }
+  else {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static,1) num_threads(num_chunks) private(i)
+#endif
+    for(c=0;c<num_chunks;c++) {
+      for(i=(ccache->n*c)/num_chunks; i<(ccache->n*(c+1))/num_chunks; i++) 
+	update_constraint_cache_for_example(ccache,svmModel,doc_fydelta[c],i);
     }
+    if(struct_verbosity>=3) 
+      for(i=0; i<ccache->n; i++)
+	print_percent_progress(&progress,ccache->n,10,"+");
   }
-  free_example(doc_fydelta,0);
+
+  for(c=0;c<num_chunks;c++)
+    free_example(doc_fydelta[c],0);
+  free(doc_fydelta);
 }
 
 double compute_violation_of_constraint_in_cache(CCACHE *ccache, double thresh)
@@ -1243,7 +2220,7 @@ double compute_violation_of_constraint_in_cache(CCACHE *ccache, double thresh)
   return(sumviol);
 }
 
-double find_most_violated_joint_constraint_in_cache(CCACHE *ccache, double thresh, double *lhs_n, SVECTOR **lhs, double *rhs)
+double find_most_violated_joint_constraint_in_cache(CCACHE *ccache, double thresh, double *lhs_n, SVECTOR **lhs, double *rhs, long num_threads)
      /* constructs most violated joint constraint from cache. assumes
 	that update_constraint_cache_for_model has been run. */
      /* NOTE: For kernels, this function returns only a shallow copy
@@ -1251,38 +2228,89 @@ double find_most_violated_joint_constraint_in_cache(CCACHE *ccache, double thres
 	otherwise the case becomes invalid. */
      /* NOTE: This function assumes that loss(y,y')>=0, and it is most
 	efficient when loss(y,y)=0. */
+     /* NOTE: In the linear case, the examples are split into
+	num_threads ranges that are summed in parallel into private
+	dense vectors. These are then added to lhs_n in range order,
+	so that the result does not depend on the scheduling. */
 {
   double sumviol=0;
   int i,n=ccache->n;
+  long c,k,num_chunks=1,sizePsi=ccache->sm->sizePsi;
+  double **acc,*chunk_rhs,*chunk_viol;
   SVECTOR *fydelta;
 
   (*lhs)=NULL;
   (*rhs)=0;
   if(lhs_n) {                             /* linear case? */
-    clear_nvector(lhs_n,ccache->sm->sizePsi);
+    clear_nvector(lhs_n,sizePsi);
+    num_chunks=MAX(1,minl(get_num_threads(num_threads),n));
   }
 
-  /**** add all maximally violated fydelta to joint constraint ****/
-  for(i=0; i<n; i++) { 
-    if((thresh<0) || (ccache->constlist[i]->viol*n > thresh)) {
-      /* get most violating fydelta=fy-fybar for example i from cache */
-      fydelta=ccache->constlist[i]->fydelta;
-      (*rhs)+=ccache->constlist[i]->rhs;
-      sumviol+=ccache->constlist[i]->viol;
-      if(lhs_n) {                         /* linear case? */
-	add_list_n_ns(lhs_n,fydelta,1.0); /* add fy-fybar to sum */
-      }
-      else {                              /* add fy-fybar to vector list */
-	fydelta=copy_svector(fydelta);
-	append_svector_list(fydelta,(*lhs));  
-	(*lhs)=fydelta;
+  if(num_chunks > 1) {
+    acc=(double **)my_malloc(sizeof(double *)*num_chunks);
+    chunk_rhs=(double *)my_malloc(sizeof(double)*num_chunks);
+    chunk_viol=(double *)my_malloc(sizeof(double)*num_chunks);
+    acc[0]=lhs_n;
+    for(c=1;c<num_chunks;c++) {
+      acc[c]=create_nvector(sizePsi);
+      clear_nvector(acc[c],sizePsi);
+    }
+
+    /**** add maximally violated fydelta of each range ****/
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static,1) num_threads(num_chunks) private(i)
+#endif
+    for(c=0;c<num_chunks;c++) {
+      chunk_rhs[c]=0;
+      chunk_viol[c]=0;
+      for(i=(n*c)/num_chunks; i<(n*(c+1))/num_chunks; i++) 
+	if((thresh<0) || (ccache->constlist[i]->viol*n > thresh)) {
+	  chunk_rhs[c]+=ccache->constlist[i]->rhs;
+	  chunk_viol[c]+=ccache->constlist[i]->viol;
+	  add_list_n_ns(acc[c],ccache->constlist[i]->fydelta,1.0);
+	}
+    }
+
+    /**** sum the ranges, splitting the features among threads ****/
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(num_chunks) private(c)
+#endif
+    for(k=1;k<=sizePsi;k++) 
+      for(c=1;c<num_chunks;c++)
+	lhs_n[k]+=acc[c][k];
+
+    for(c=0;c<num_chunks;c++) {
+      (*rhs)+=chunk_rhs[c];
+      sumviol+=chunk_viol[c];
+      if(c>0) free_nvector(acc[c]);
+    }
+    free(acc);
+    free(chunk_rhs);
+    free(chunk_viol);
+  }
+  else {
+    /**** add all maximally violated fydelta to joint constraint ****/
+    for(i=0; i<n; i++) { 
+      if((thresh<0) || (ccache->constlist[i]->viol*n > thresh)) {
+	/* get most violating fydelta=fy-fybar for example i from cache */
+	fydelta=ccache->constlist[i]->fydelta;
+	(*rhs)+=ccache->constlist[i]->rhs;
+	sumviol+=ccache->constlist[i]->viol;
+	if(lhs_n) {                         /* linear case? */
+	  add_list_n_ns(lhs_n,fydelta,1.0); /* add fy-fybar to sum */
+	}
+	else {                              /* add fy-fybar to vector list */
+	  fydelta=copy_svector(fydelta);
+	  append_svector_list(fydelta,(*lhs));  
+	  (*lhs)=fydelta;
+	}
       }
     }
   }
   /* create sparse vector from dense sum */
   if(lhs_n)                               /* linear case? */
-    (*lhs)=create_svector_n_r(lhs_n,ccache->sm->sizePsi,NULL,1.0,
-			      COMPACT_ROUNDING_THRESH);
+    (*lhs)=create_svector_n_r_par(lhs_n,sizePsi,NULL,1.0,
+				  COMPACT_ROUNDING_THRESH,num_threads);
 
   return(sumviol);
 }
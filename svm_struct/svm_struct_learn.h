@@ -65,36 +65,74 @@ typedef struct ccache {
 			     last iter? */
 } CCACHE;
 
+typedef struct struct_path {
+  SVECTOR  **fycache;     /* feature vectors of the correct labels */
+  CCACHE   *ccache;       /* constraint cache (w=4 algorithm) */
+  CONSTSET cset;          /* working set of the last model trained */
+  double   *alpha;        /* dual variables of the working set */
+  double   C;             /* value of C of the last model trained */
+} STRUCT_PATH;            /* state shared by the models trained along
+			     a path of values of C. Only the one-slack
+			     algorithms (w=2,3,4) use it. */
+
 void find_most_violated_constraint(SVECTOR **fydelta, double *lossval, 
 				   EXAMPLE *ex, SVECTOR *fycached, long n, 
 				   STRUCTMODEL *sm,STRUCT_LEARN_PARM *sparm,
 				   double *rt_viol, double *rt_psi, 
 				   long *argmax_count);
+void find_most_violated_constraints(SVECTOR **fydelta, double *rhs, 
+				    EXAMPLE *ex, long *exnum, long num,
+				    SVECTOR **fycache, long n, 
+				    STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm,
+				    double *rt_viol, double *rt_psi, 
+				    long *argmax_count);
+void constraints_from_labels(SVECTOR **fydelta, double *rhs, 
+			     EXAMPLE *ex, long *exnum, long num,
+			     LABEL *ybar, SVECTOR **fybar, double *lossval,
+			     SVECTOR **fycache, long n, 
+			     STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm,
+			     double *rt_psi);
+void psi_of_examples(SVECTOR **fy, EXAMPLE *ex, long n,
+		     STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
 CCACHE *create_constraint_cache(SAMPLE sample, STRUCT_LEARN_PARM *sparm, 
 				STRUCTMODEL *sm);
 void free_constraint_cache(CCACHE *ccache);
+STRUCT_PATH *create_struct_path(void);
+void free_struct_path(STRUCT_PATH *path, long n);
 double add_constraint_to_constraint_cache(CCACHE *ccache, MODEL *svmModel, 
 	  				  int exnum, SVECTOR *fydelta, 
 					  double rhs, double gainthresh,
 					  int maxconst, double *rt_cachesum);
-void update_constraint_cache_for_model(CCACHE *ccache, MODEL *svmModel);
+void update_constraint_cache_for_model(CCACHE *ccache, MODEL *svmModel,
+				       long num_threads);
 double compute_violation_of_constraint_in_cache(CCACHE *ccache, double thresh);
 double find_most_violated_joint_constraint_in_cache(CCACHE *ccache, 
-  		     double thresh, double *lhs_n, SVECTOR **lhs, double *rhs);
+  		     double thresh, double *lhs_n, SVECTOR **lhs, double *rhs,
+		     long num_threads);
 void svm_learn_struct(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 		      LEARN_PARM *lparm, KERNEL_PARM *kparm, 
 		      STRUCTMODEL *sm, int alg_type);
 void svm_learn_struct_joint(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 		      LEARN_PARM *lparm, KERNEL_PARM *kparm, 
 		      STRUCTMODEL *sm, int alg_type);
+void svm_learn_struct_ssg(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
+			  LEARN_PARM *lparm, KERNEL_PARM *kparm, 
+			  STRUCTMODEL *sm);
+void svm_learn_struct_bmrm(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
+			   LEARN_PARM *lparm, KERNEL_PARM *kparm, 
+			   STRUCTMODEL *sm);
 void svm_learn_struct_joint_custom(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 		      LEARN_PARM *lparm, KERNEL_PARM *kparm, 
 		      STRUCTMODEL *sm);
+MODEL *create_linear_model(double *w, long sizePsi, long n,
+			   KERNEL_PARM *kparm);
 void remove_inactive_constraints(CONSTSET *cset, double *alpha, 
-			         long i, long *alphahist, long mininactive);
-MATRIX *init_kernel_matrix(CONSTSET *cset, KERNEL_PARM *kparm); 
+			         long i, long *alphahist, long mininactive,
+				 QP_STATE *qp_state);
+MATRIX *init_kernel_matrix(CONSTSET *cset, KERNEL_PARM *kparm,
+			   long num_threads); 
 MATRIX *update_kernel_matrix(MATRIX *matrix, int newpos, CONSTSET *cset,
-			     KERNEL_PARM *kparm);
+			     KERNEL_PARM *kparm, long num_threads);
  
 #endif
 
@@ -70,7 +70,9 @@ int main (int argc, char* argv[])
     printf("done\n"); fflush(stdout);
   }
   
-  /* Do the learning and return structmodel. */
+  /* Do the learning and return structmodel. All the QP problems
+     share the same state of the solver. */
+  learn_parm.qp_solver=create_qp_solver();
   if(alg_type == 0)
     svm_learn_struct(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,NSLACK_ALG);
   else if(alg_type == 1)
@@ -81,6 +83,10 @@ int main (int argc, char* argv[])
     svm_learn_struct_joint(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,ONESLACK_DUAL_ALG);
   else if(alg_type == 4)
     svm_learn_struct_joint(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,ONESLACK_DUAL_CACHE_ALG);
+  else if(alg_type == 5)
+    svm_learn_struct_ssg(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel);
+  else if(alg_type == 6)
+    svm_learn_struct_bmrm(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel);
   else if(alg_type == 9)
     svm_learn_struct_joint_custom(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel);
   else
@@ -99,6 +105,7 @@ int main (int argc, char* argv[])
 
   free_struct_sample(sample);
   free_struct_model(structmodel);
+  free_qp_solver(learn_parm.qp_solver);
 
   svm_struct_learn_api_exit();
 
@@ -128,6 +135,10 @@ void read_input_parameters(int argc,char *argv[],char *trainfile,
   struct_parm->newconstretrain=100;
   struct_parm->ccache_size=5;
   struct_parm->batch_size=100;
+  struct_parm->pipeline=0;
+  struct_parm->ssg_passes=10;
+  struct_parm->ssg_average=0;
+  struct_parm->path=NULL;
 
   strcpy (modelfile, "svm_struct_model");
   strcpy (learn_parm->predfile, "trans_predictions");
@@ -153,6 +164,9 @@ void read_input_parameters(int argc,char *argv[],char *trainfile,
   learn_parm->compute_loo=0;
   learn_parm->rho=1.0;
   learn_parm->xa_depth=0;
+  learn_parm->num_threads=1;
+  learn_parm->qp_solver=NULL;
+  learn_parm->qp_state=NULL;
   kernel_parm->kernel_type=0;
   kernel_parm->poly_degree=3;
   kernel_parm->rbf_gamma=1.0;
@@ -171,6 +185,7 @@ void read_input_parameters(int argc,char *argv[],char *trainfile,
       case 'e': i++; struct_parm->epsilon=atof(argv[i]); break;
       case 'k': i++; struct_parm->newconstretrain=atol(argv[i]); break;
       case 'h': i++; learn_parm->svm_iter_to_shrink=atol(argv[i]); break;
+      case 'j': i++; learn_parm->num_threads=atol(argv[i]); break;
       case '#': i++; learn_parm->maxiter=atol(argv[i]); break;
       case 'm': i++; learn_parm->kernel_cache_size=atol(argv[i]); break;
       case 'w': i++; (*alg_type)=atol(argv[i]); break;
@@ -180,6 +195,7 @@ void read_input_parameters(int argc,char *argv[],char *trainfile,
       case 'l': i++; struct_parm->loss_function=atol(argv[i]); break;
       case 'f': i++; struct_parm->ccache_size=atol(argv[i]); break;
       case 'b': i++; struct_parm->batch_size=atof(argv[i]); break;
+      case 'z': i++; struct_parm->pipeline=atol(argv[i]); break;
       case 't': i++; kernel_parm->kernel_type=atol(argv[i]); break;
       case 'd': i++; kernel_parm->poly_degree=atol(argv[i]); break;
       case 'g': i++; kernel_parm->rbf_gamma=atof(argv[i]); break;
@@ -245,8 +261,8 @@ void read_input_parameters(int argc,char *argv[],char *trainfile,
     print_help();
     exit(0);
   }
-  if(((*alg_type) < 0) || (((*alg_type) > 5) && ((*alg_type) != 9))) {
-    printf("\nAlgorithm type must be either '0', '1', '2', '3', '4', or '9'!\n\n");
+  if(((*alg_type) < 0) || (((*alg_type) > 6) && ((*alg_type) != 9))) {
+    printf("\nAlgorithm type must be either '0', '1', '2', '3', '4', '5', '6', or '9'!\n\n");
     wait_any_key();
     print_help();
     exit(0);
@@ -357,7 +373,11 @@ void print_help()
   printf("                        2: 1-slack algorithm (primal) described in [5]\n");
   printf("                        3: 1-slack algorithm (dual) described in [5]\n");
   printf("                        4: 1-slack algorithm (dual) with constraint cache [5]\n");
-  printf("                        9: custom algorithm in svm_struct_learn_custom.c\n");
+  printf("                        5: stochastic subgradient descent (linear kernel only)\n");
+  printf("                        6: 1-slack algorithm (dual) with line search (linear\n");
+  printf("                           kernel only)\n");
+  printf("                        9: block-coordinate Frank-Wolfe (linear kernel and\n");
+  printf("                           margin rescaling only)\n");
   printf("         -e float    -> epsilon: allow that tolerance for termination\n");
   printf("                        criterion (default %f)\n",DEFAULT_EPS);
   printf("         -k [1..]    -> number of new constraints to accumulate before\n"); 
@@ -367,6 +387,9 @@ void print_help()
   printf("         -b [1..100] -> percentage of training set for which to refresh cache\n");
   printf("                        when no epsilon violated constraint can be constructed\n");
   printf("                        from current cache (default 100%%) (used with -w 4)\n");
+  printf("         -z [0,1]    -> find the most violated constraints of the next batch\n");
+  printf("                        while solving the QP (default 0) (used with -w 4)\n");
+  printf("         -j [1..]    -> number of threads (default 1)\n");
   printf("SVM-light Options for Solving QP Subproblems (see [3]):\n");
   printf("         -n [2..q]   -> number of new variables entering the working set\n");
   printf("                        in each svm-light iteration (default n = q). \n");
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "svm_struct/svm_struct_common.h"
+#include "svm_struct/svm_struct_learn.h"
 #include "svm_struct_api.h"
 
 /** ------------------------------------------------------------------
@@ -81,7 +82,11 @@ init_struct_model (SAMPLE sample, STRUCTMODEL *sm,
                    STRUCT_LEARN_PARM *sparm, LEARN_PARM *lparm,
                    KERNEL_PARM *kparm)
 {
-  if (kparm->kernel_type == LINEAR) {
+  sm->snapshot = NULL ;
+  sm->expansion = NULL ;
+  if (sparm->plugin) {
+    sm->sizePsi = sparm->plugin->size_psi ;
+  } else if (kparm->kernel_type == LINEAR) {
     mxArray const * sizePsi_array = mxGetField(sparm->mex, 0, "dimension") ;
     if (! sizePsi_array) {
         mexErrMsgTxt("Field PARM.DIMENSION not found") ;
@@ -99,6 +104,22 @@ init_struct_model (SAMPLE sample, STRUCTMODEL *sm,
   }
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Notify that the structured model changed
+ **
+ ** Called by the learner every time sm->w or sm->svm_model are
+ ** updated. Drops the Matlab version of the model shared by the
+ ** callbacks, so that it is rebuilt when it is needed next (with
+ ** kernels, this patches the persistent expansion of the model).
+ **/
+
+void
+update_struct_model (STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm)
+{
+  releaseMexSmodelSnapshot (sm->snapshot) ;
+  sm->snapshot = NULL ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Initialize structred model constraints
  **
@@ -145,6 +166,121 @@ init_struct_constraints (SAMPLE sample, STRUCTMODEL *sm,
   return(c);
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Call the argmax function of the native plugin
+ **
+ ** LOSS_TYPE is zero for prediction and SLACK_RESCALING or
+ ** MARGIN_RESCALING to find the most violated constraint.
+ **/
+
+static LABEL
+pluginArgmax (PATTERN x, LABEL const * y, int loss_type,
+              STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm)
+{
+  LABEL ybar ;
+  PLUGIN * plugin = sparm->plugin ;
+  ybar.mex = NULL ;
+  ybar.isOwner = 1 ;
+  ybar.plugin = plugin ;
+  ybar.native = plugin->abi->argmax (plugin->state,
+                                     sm->w + 1, sm->sizePsi,
+                                     x.native, y ? y->native : NULL,
+                                     loss_type) ;
+  return ybar ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Create a feature vector from the output of a plugin psi()
+ **
+ ** INDEX (starting from 0) and VALUE are the NUMNZ non-zero
+ ** components returned by the psi() function of a plugin.
+ **/
+
+static SVECTOR *
+newSvectorFromPluginPsi (long const *index, double const *value, long numNZ)
+{
+  SVECTOR * sv ;
+  WORD * words ;
+  double twonorm_sq = 0 ;
+  long i ;
+
+  words = (WORD*) my_malloc (sizeof(WORD) * (numNZ + 1)) ;
+  for (i = 0 ; i < numNZ ; ++ i) {
+    words[i].wnum = index[i] + 1 ;
+    words[i].weight = value[i] ;
+    twonorm_sq += value[i] * value[i] ;
+  }
+  words[numNZ].wnum = 0 ;
+  words[numNZ].weight = 0 ;
+
+  sv = create_svector_shallow (words, NULL, 1.0) ;
+  sv->twonorm_sq = twonorm_sq ;
+  return sv ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Call the feature map of the native plugin
+ **/
+
+static SVECTOR *
+pluginPsi (PATTERN x, LABEL y, STRUCT_LEARN_PARM *sparm)
+{
+  PLUGIN * plugin = sparm->plugin ;
+  long numNZ = plugin_psi (plugin, x.native, y.native) ;
+
+  if (numNZ < 0) {
+    mexErrMsgTxt("PARM.PLUGIN failed to compute the feature map") ;
+  }
+  return newSvectorFromPluginPsi (plugin->index, plugin->value, numNZ) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Find the most violated constraints with the farm of workers
+ **
+ ** Sends the patterns X[0], ..., X[NUM-1] to the workers of
+ ** sparm->farm and collects the feature maps FYBAR and the losses
+ ** LOSSVAL (either may be NULL) of the most violated labels. The
+ ** labels remain in the workers: YBAR[k] is only a placeholder that
+ ** is empty if the worker did not find a label, and that does not
+ ** need to be freed.
+ **/
+
+static void
+farmArgmax (PATTERN *x, LABEL *ybar, SVECTOR **fybar, double *lossval,
+            long num, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm)
+{
+  static char placeholder ;
+  FARM * farm = sparm->farm ;
+  long * exnum = (long*) my_malloc (sizeof(long) * num) ;
+  long k ;
+
+  for (k = 0 ; k < num ; ++ k) exnum[k] = x[k].index ;
+  if (farm_send (farm, sm->w + 1, exnum, num, sparm->loss_type)) {
+    mexErrMsgTxt("Could not send the examples to the oracle workers") ;
+  }
+  free (exnum) ;
+
+  for (k = 0 ; k < num ; ++ k) {
+    int empty ;
+    double lossk ;
+    long numNZ = farm_receive (farm, &empty, &lossk) ;
+    if (numNZ < 0) {
+      mexErrMsgTxt("An oracle worker failed") ;
+    }
+    ybar[k].mex = NULL ;
+    ybar[k].isOwner = 0 ;
+    ybar[k].native = empty ? NULL : &placeholder ;
+    ybar[k].plugin = sparm->plugin ;
+    if (fybar) {
+      fybar[k] = empty ? NULL :
+        newSvectorFromPluginPsi (farm->index, farm->value, numNZ) ;
+    }
+    if (lossval) {
+      lossval[k] = empty ? 0 : lossk ;
+    }
+  }
+}
+
 /** ------------------------------------------------------------------
  ** @brief Predict a structured label given a pattern
  **
@@ -167,8 +303,13 @@ classify_struct_example (PATTERN x,
   mxArray* fn_array ;
   mxArray* w_array ;
   mxArray* args [4] ;
+  MexSmodelSnapshot snapshot ;
   int status ;
 
+  if (sparm->plugin) {
+    return pluginArgmax (x, NULL, 0, sm, sparm) ;
+  }
+
   fn_array= mxGetField(sparm->mex, 0, "classifyFn") ;
   if (! fn_array) {
       mexErrMsgTxt("Field PARM.CLASSIFYFN not found") ;
@@ -177,11 +318,17 @@ classify_struct_example (PATTERN x,
     mexErrMsgTxt("PARM.CLASSIFYFN must be a valid function handle") ;
   }
 
-  /* encapsulate sm->w into a Matlab array */
-  w_array = mxCreateDoubleMatrix(sm->sizePsi, 1, mxREAL) ;
-  memcpy(mxGetPr(w_array),
-         sm->w + 1,
-         sm->sizePsi * sizeof(double)) ;
+  /* get sm->w from the Matlab version of the model */
+  snapshot = retainMexSmodelSnapshot (sm) ;
+  w_array = mxGetField (MexSmodelSnapshotGetArray (snapshot), 0, "w") ;
+  if (! w_array) {
+    w_array = mxCreateDoubleMatrix(sm->sizePsi, 1, mxREAL) ;
+    memcpy(mxGetPr(w_array),
+           sm->w + 1,
+           sm->sizePsi * sizeof(double)) ;
+    releaseMexSmodelSnapshot (snapshot) ;
+    snapshot = NULL ;
+  }
 
   /* evaluate Matlab callback */
   args[0] = fn_array ;
@@ -191,7 +338,11 @@ classify_struct_example (PATTERN x,
 
   status = mexCallMATLAB(1, &y.mex, 4, args, "feval") ;
 
-  mxDestroyArray(w_array) ;
+  if (snapshot) {
+    releaseMexSmodelSnapshot (snapshot) ;
+  } else {
+    mxDestroyArray(w_array) ;
+  }
 
   if (status) {
     mexErrMsgTxt("Error while executing PARM.CLASSIFYFN") ;
@@ -202,10 +353,149 @@ classify_struct_example (PATTERN x,
 
   /* flag this label has one tha should be freed when discared */
   y.isOwner = 1 ;
+  y.native = NULL ;
+  y.plugin = NULL ;
 
   return (y) ;
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Convert a column of a sparse MATLAB matrix to a sparse vector
+ **
+ ** The row indexes are shifted by one as SVM-light feature numbers
+ ** start from 1.
+ **/
+
+static SVECTOR *
+newSvectorFromSparseColumn (mxArray const * array, mwIndex k)
+{
+  SVECTOR * sv ;
+  WORD * words ;
+  double twonorm_sq = 0 ;
+  double * data = mxGetPr(array) ;
+  mwIndex * colOffsets = mxGetJc(array) ;
+  mwIndex * rowIndexes = mxGetIr(array) ;
+  mwIndex i, begin = colOffsets[k], numNZ = colOffsets[k+1] - begin ;
+
+  words = (WORD*) my_malloc (sizeof(WORD) * (numNZ + 1)) ;
+
+  for (i = 0 ; i < numNZ ; ++ i) {
+    words[i].wnum = rowIndexes[begin + i] + 1 ;
+    words[i].weight = data[begin + i] ;
+    twonorm_sq += data[begin + i] * data[begin + i] ;
+  }
+  words[numNZ].wnum = 0 ;
+  words[numNZ].weight = 0 ;
+
+  sv = create_svector_shallow (words, NULL, 1.0) ;
+  sv->twonorm_sq = twonorm_sq ;
+  return sv ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Fingerprint a MATLAB array
+ **
+ ** Accumulates into *h a 64 bit FNV-1a hash of the class, size and
+ ** content of ARRAY. Returns 0 if the array cannot be hashed
+ ** (e.g. function handles, objects, complex arrays).
+ **/
+
+static void
+hashBytes (uint64_t * h, void const * data, size_t n)
+{
+  unsigned char const * p = (unsigned char const *) data ;
+  size_t i ;
+  for (i = 0 ; i < n ; ++ i) {
+    *h ^= p[i] ;
+    *h *= 0x100000001B3ULL ;
+  }
+}
+
+static int
+hashMxArray (uint64_t * h, mxArray const * array)
+{
+  mxClassID classID ;
+  mwSize m, n, i, numel ;
+  int f, numFields ;
+
+  if (! array) {
+    hashBytes (h, "null", 4) ;
+    return 1 ;
+  }
+  classID = mxGetClassID (array) ;
+  m = mxGetM (array) ;
+  n = mxGetN (array) ;
+  numel = mxGetNumberOfElements (array) ;
+  hashBytes (h, &classID, sizeof(classID)) ;
+  hashBytes (h, &m, sizeof(m)) ;
+  hashBytes (h, &n, sizeof(n)) ;
+
+  switch (classID) {
+  case mxCELL_CLASS :
+    for (i = 0 ; i < numel ; ++ i) {
+      if (! hashMxArray (h, mxGetCell (array, i))) return 0 ;
+    }
+    return 1 ;
+
+  case mxSTRUCT_CLASS :
+    numFields = mxGetNumberOfFields (array) ;
+    for (f = 0 ; f < numFields ; ++ f) {
+      char const * name = mxGetFieldNameByNumber (array, f) ;
+      hashBytes (h, name, strlen (name)) ;
+    }
+    for (i = 0 ; i < numel ; ++ i) {
+      for (f = 0 ; f < numFields ; ++ f) {
+        if (! hashMxArray (h, mxGetFieldByNumber (array, i, f))) return 0 ;
+      }
+    }
+    return 1 ;
+
+  case mxLOGICAL_CLASS : case mxCHAR_CLASS :
+  case mxDOUBLE_CLASS : case mxSINGLE_CLASS :
+  case mxINT8_CLASS : case mxUINT8_CLASS :
+  case mxINT16_CLASS : case mxUINT16_CLASS :
+  case mxINT32_CLASS : case mxUINT32_CLASS :
+  case mxINT64_CLASS : case mxUINT64_CLASS :
+    if (mxIsComplex (array)) return 0 ;
+    if (mxIsSparse (array)) {
+      mwIndex const * jc = mxGetJc (array) ;
+      mwSize nnz = jc [n] ;
+      hashBytes (h, jc, sizeof(mwIndex) * (n + 1)) ;
+      hashBytes (h, mxGetIr (array), sizeof(mwIndex) * nnz) ;
+      hashBytes (h, mxGetData (array), mxGetElementSize (array) * nnz) ;
+    } else {
+      hashBytes (h, mxGetData (array), mxGetElementSize (array) * numel) ;
+    }
+    return 1 ;
+
+  default :
+    return 0 ;
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Make a label from the output of a constraint callback
+ **
+ ** The label owns ARRAY. An empty array ([]) means that the callback
+ ** found no violated constraint and gives an empty label as
+ ** recognized by empty_label().
+ **/
+
+static LABEL
+newLabelFromConstraintFn (mxArray * array)
+{
+  LABEL ybar ;
+  if (array && mxIsEmpty(array)) {
+    mxDestroyArray (array) ;
+    array = NULL ;
+  }
+  ybar.mex = array ;
+  ybar.isOwner = 1 ;
+  ybar.native = NULL ;
+  ybar.plugin = NULL ;
+  return (ybar) ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Find the most violated constraint with slack rescaling
  **
@@ -240,9 +530,14 @@ find_most_violated_constraint_slackrescaling (PATTERN x, LABEL y,
 
   mxArray* fn_array ;
   mxArray* model_array ;
+  MexSmodelSnapshot snapshot ;
   mxArray* args [5] ;
   int status ;
 
+  if (sparm->plugin) {
+    return pluginArgmax (x, &y, SLACK_RESCALING, sm, sparm) ;
+  }
+
   fn_array = mxGetField(sparm->mex, 0, "constraintFn") ;
   if (! fn_array) {
     mexErrMsgTxt("Field PARM.CONSTRAINTFN not found") ;
@@ -251,8 +546,9 @@ find_most_violated_constraint_slackrescaling (PATTERN x, LABEL y,
     mexErrMsgTxt("PARM.CONSTRAINTFN must be a valid function handle") ;
   }
 
-  /* encapsulate sm->w into a Matlab array */
-  model_array = newMxArrayEncapsulatingSmodel (sm) ;
+  /* get the Matlab version of the model */
+  snapshot = retainMexSmodelSnapshot (sm) ;
+  model_array = MexSmodelSnapshotGetArray (snapshot) ;
 
   args[0] = fn_array ;
   args[1] = (mxArray*) sparm->mex ; /* model (discard conts) */
@@ -270,7 +566,7 @@ find_most_violated_constraint_slackrescaling (PATTERN x, LABEL y,
   status = mexCallMATLAB(1, &ybar.mex, 5, args, "feval") ;
   mexSetTrapFlag (0) ;
 
-  destroyMxArrayEncapsulatingSmodel (model_array) ;
+  releaseMexSmodelSnapshot (snapshot) ;
 
   if (status) {
     mxArray * error_array ;
@@ -281,7 +577,7 @@ find_most_violated_constraint_slackrescaling (PATTERN x, LABEL y,
   if (mxGetClassID(ybar.mex) == mxUNKNOWN_CLASS) {
     mexErrMsgTxt("PARM.CONSTRAINTFN did not reutrn a result") ;
   }
-  ybar.isOwner = 1 ;
+  ybar = newLabelFromConstraintFn (ybar.mex) ;
 
   return(ybar);
 }
@@ -318,9 +614,14 @@ find_most_violated_constraint_marginrescaling (PATTERN x, LABEL y,
   LABEL ybar ;
   mxArray* fn_array ;
   mxArray* model_array ;
+  MexSmodelSnapshot snapshot ;
   mxArray* args [5] ;
   int status ;
 
+  if (sparm->plugin) {
+    return pluginArgmax (x, &y, MARGIN_RESCALING, sm, sparm) ;
+  }
+
   fn_array = mxGetField(sparm->mex, 0, "constraintFn") ;
   if (! fn_array) {
     mexErrMsgTxt("Field PARM.CONSTRAINTFN not found") ;
@@ -329,8 +630,9 @@ find_most_violated_constraint_marginrescaling (PATTERN x, LABEL y,
     mexErrMsgTxt("PARM.CONSTRAINTFN is not a valid function handle") ;
   }
 
-  /* encapsulate sm->w into a Matlab array */
-  model_array = newMxArrayEncapsulatingSmodel (sm) ;
+  /* get the Matlab version of the model */
+  snapshot = retainMexSmodelSnapshot (sm) ;
+  model_array = MexSmodelSnapshotGetArray (snapshot) ;
 
   args[0] = fn_array ;
   args[1] = (mxArray*) sparm->mex ; /* model (discard conts) */
@@ -342,7 +644,7 @@ find_most_violated_constraint_marginrescaling (PATTERN x, LABEL y,
   status = mexCallMATLAB(1, &ybar.mex, 5, args, "feval") ;
   mexSetTrapFlag (0) ;
 
-  destroyMxArrayEncapsulatingSmodel (model_array) ;
+  releaseMexSmodelSnapshot (snapshot) ;
 
   if (status) {
     mxArray * error_array ;
@@ -352,11 +654,436 @@ find_most_violated_constraint_marginrescaling (PATTERN x, LABEL y,
   if (mxGetClassID(ybar.mex) == mxUNKNOWN_CLASS) {
     mexErrMsgTxt("PARM.CONSTRAINTFN did not reutrn a result") ;
   }
-  ybar.isOwner = 1 ;
+  ybar = newLabelFromConstraintFn (ybar.mex) ;
 
   return (ybar) ;
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Find the most violated constraint, its feature map and loss
+ **
+ ** Returns the label ybar responsible for the most violated
+ ** constraint of the example (x,y), using the loss rescaling method
+ ** selected in sparm->loss_type. If fybar is not NULL, it is set to
+ ** psi(x,ybar), and if lossval is not NULL, it is set to
+ ** loss(y,ybar). If ybar is empty, *fybar is set to NULL and
+ ** *lossval to zero.
+ **
+ ** If PARM.FUSEDCONSTRAINTFN is defined, the label, the feature map
+ ** and the loss are obtained from a single call
+ ** [YBAR,PSI,DELTA]=FUSEDCONSTRAINTFN(PARM,MODEL,X,Y). Otherwise the
+ ** function calls find_most_violated_constraint_slackrescaling() or
+ ** find_most_violated_constraint_marginrescaling(), psi() and
+ ** loss() in turn. With kernels the PSI output is ignored as psi()
+ ** only needs to return a placeholder.
+ **/
+
+LABEL
+find_most_violated_constraint_fused (PATTERN x, LABEL y,
+                                     SVECTOR **fybar, double *lossval,
+                                     STRUCTMODEL *sm,
+                                     STRUCT_LEARN_PARM *sparm)
+{
+  LABEL ybar ;
+  mxArray* fn_array ;
+  mxArray* model_array ;
+  MexSmodelSnapshot snapshot ;
+  mxArray* out [3] ;
+  mxArray* args [5] ;
+  int status ;
+
+  fn_array = mxGetField(sparm->mex, 0, "fusedConstraintFn") ;
+  if (sparm->plugin || ! fn_array) {
+    if (sparm->loss_type == SLACK_RESCALING) {
+      ybar = find_most_violated_constraint_slackrescaling (x, y, sm, sparm) ;
+    } else {
+      ybar = find_most_violated_constraint_marginrescaling (x, y, sm, sparm) ;
+    }
+    if (fybar) {
+      *fybar = empty_label(ybar) ? NULL : psi (x, ybar, sm, sparm) ;
+    }
+    if (lossval) {
+      *lossval = empty_label(ybar) ? 0 : loss (y, ybar, sparm) ;
+    }
+    return (ybar) ;
+  }
+  if (mxGetClassID(fn_array) != mxFUNCTION_CLASS) {
+    mexErrMsgTxt("PARM.FUSEDCONSTRAINTFN must be a valid function handle") ;
+  }
+
+  /* get the Matlab version of the model */
+  snapshot = retainMexSmodelSnapshot (sm) ;
+  model_array = MexSmodelSnapshotGetArray (snapshot) ;
+
+  args[0] = fn_array ;
+  args[1] = (mxArray*) sparm->mex ; /* model (discard conts) */
+  args[2] = model_array ;
+  args[3] = x.mex ;
+  args[4] = y.mex ;
+
+  mexSetTrapFlag (1) ;
+  status = mexCallMATLAB(3, out, 5, args, "feval") ;
+  mexSetTrapFlag (0) ;
+
+  releaseMexSmodelSnapshot (snapshot) ;
+
+  if (status) {
+    mxArray * error_array ;
+    mexCallMATLAB(1, &error_array, 0, NULL, "lasterror") ;
+    mexCallMATLAB(0, NULL, 1, &error_array, "disp") ;
+    mexCallMATLAB(0, NULL, 1, &error_array, "rethrow") ;
+  }
+  if (mxGetClassID(out[0]) == mxUNKNOWN_CLASS) {
+    mexErrMsgTxt("PARM.FUSEDCONSTRAINTFN did not reutrn a result") ;
+  }
+  ybar = newLabelFromConstraintFn (out[0]) ;
+  if (empty_label(ybar)) {
+    if (fybar) *fybar = NULL ;
+    if (lossval) *lossval = 0 ;
+    mxDestroyArray (out[1]) ;
+    mxDestroyArray (out[2]) ;
+    return (ybar) ;
+  }
+  if (! uIsRealScalar(out[2])) {
+    mexErrMsgTxt("PARM.FUSEDCONSTRAINTFN must return a scalar loss") ;
+  }
+
+  if (lossval) {
+    *lossval = *mxGetPr(out[2]) ;
+  }
+  if (fybar) {
+    if (sm -> svm_model -> kernel_parm .kernel_type == LINEAR) {
+      if (! mxIsSparse(out[1]) ||
+          mxGetClassID(out[1]) != mxDOUBLE_CLASS ||
+          mxGetN(out[1]) != 1 ||
+          mxGetM(out[1]) != (mwSize) sm->sizePsi) {
+        mexErrMsgTxt("PARM.FUSEDCONSTRAINTFN must return a sparse column "
+                     "vector of the prescribed size") ;
+      }
+      *fybar = newSvectorFromSparseColumn (out[1], 0) ;
+    } else {
+      *fybar = psi (x, ybar, sm, sparm) ;
+    }
+  }
+
+  mxDestroyArray (out[1]) ;
+  mxDestroyArray (out[2]) ;
+
+  return (ybar) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Find the most violated constraints of a batch of examples
+ **
+ ** Fills ybar[k] with the label responsible for the most violated
+ ** constraint of the example (x[k],y[k]), for k=0,...,num-1, using
+ ** the loss rescaling method selected in sparm->loss_type. If fybar
+ ** and lossval are not NULL, they are filled with psi(x[k],ybar[k])
+ ** and loss(y[k],ybar[k]) as in find_most_violated_constraint_fused().
+ **
+ ** If PARM.BATCHCONSTRAINTFN is defined, it is called once for the
+ ** whole batch with a cell array of patterns and a cell array of
+ ** labels, and it must return a cell array with one label per
+ ** pattern. In this manner the model is passed to MATLAB only once
+ ** and the callback can vectorise the search. The feature maps are
+ ** then computed by psi_batch(). Otherwise, the function falls back
+ ** to calling find_most_violated_constraint_fused() for each example.
+ **/
+
+void
+find_most_violated_constraint_batch (PATTERN *x, LABEL *y, LABEL *ybar,
+                                     SVECTOR **fybar, double *lossval,
+                                     long num, STRUCTMODEL *sm,
+                                     STRUCT_LEARN_PARM *sparm)
+{
+  mxArray* fn_array ;
+  mxArray* model_array ;
+  MexSmodelSnapshot snapshot ;
+  mxArray* patterns_array ;
+  mxArray* labels_array ;
+  mxArray* out ;
+  mxArray* args [5] ;
+  long k, m ;
+  int status ;
+
+  if (sparm->farm) {
+    farmArgmax (x, ybar, fybar, lossval, num, sm, sparm) ;
+    return ;
+  }
+  fn_array = mxGetField(sparm->mex, 0, "batchConstraintFn") ;
+  if (sparm->plugin || ! fn_array) {
+    for (k = 0 ; k < num ; ++ k) {
+      ybar[k] = find_most_violated_constraint_fused
+        (x[k], y[k],
+         fybar ? &fybar[k] : NULL,
+         lossval ? &lossval[k] : NULL,
+         sm, sparm) ;
+    }
+    return ;
+  }
+  if (mxGetClassID(fn_array) != mxFUNCTION_CLASS) {
+    mexErrMsgTxt("PARM.BATCHCONSTRAINTFN must be a valid function handle") ;
+  }
+
+  /* get the Matlab version of the model and encapsulate the patterns
+     and the labels into Matlab arrays */
+  snapshot = retainMexSmodelSnapshot (sm) ;
+  model_array = MexSmodelSnapshotGetArray (snapshot) ;
+  patterns_array = newMxArrayEncapsulatingPatterns (x, num) ;
+  labels_array = newMxArrayEncapsulatingLabels (y, num) ;
+
+  args[0] = fn_array ;
+  args[1] = (mxArray*) sparm->mex ; /* model (discard conts) */
+  args[2] = model_array ;
+  args[3] = patterns_array ;
+  args[4] = labels_array ;
+
+  mexSetTrapFlag (1) ;
+  status = mexCallMATLAB(1, &out, 5, args, "feval") ;
+  mexSetTrapFlag (0) ;
+
+  releaseMexSmodelSnapshot (snapshot) ;
+  destroyMxArrayEncapsulatingCell (patterns_array) ;
+  destroyMxArrayEncapsulatingCell (labels_array) ;
+
+  if (status) {
+    mxArray * error_array ;
+    mexCallMATLAB(1, &error_array, 0, NULL, "lasterror") ;
+    mexCallMATLAB(0, NULL, 1, &error_array, "disp") ;
+    mexCallMATLAB(0, NULL, 1, &error_array, "rethrow") ;
+  }
+  if (! mxIsCell(out) || mxGetNumberOfElements(out) != num) {
+    mexErrMsgTxt("PARM.BATCHCONSTRAINTFN must return a cell array "
+                 "with one label for each pattern") ;
+  }
+
+  /* detach the labels from the output cell array */
+  for (k = 0 ; k < num ; ++ k) {
+    mxArray * label_array = mxGetCell(out, k) ;
+    mxSetCell(out, k, NULL) ;
+    ybar[k] = newLabelFromConstraintFn (label_array) ;
+  }
+  mxDestroyArray (out) ;
+
+  /* compute the feature maps and losses of the non-empty labels */
+  if (fybar) {
+    PATTERN * xs = (PATTERN*) my_malloc (sizeof(PATTERN) * num) ;
+    LABEL * ybars = (LABEL*) my_malloc (sizeof(LABEL) * num) ;
+    SVECTOR ** fvec = (SVECTOR**) my_malloc (sizeof(SVECTOR*) * num) ;
+    for (k = 0, m = 0 ; k < num ; ++ k) {
+      if (empty_label(ybar[k])) continue ;
+      xs[m] = x[k] ;
+      ybars[m] = ybar[k] ;
+      ++ m ;
+    }
+    if (m > 0) psi_batch (xs, ybars, fvec, m, sm, sparm) ;
+    for (k = 0, m = 0 ; k < num ; ++ k) {
+      fybar[k] = empty_label(ybar[k]) ? NULL : fvec[m++] ;
+    }
+    free (xs) ;
+    free (ybars) ;
+    free (fvec) ;
+  }
+  if (lossval) {
+    for (k = 0 ; k < num ; ++ k) {
+      lossval[k] = empty_label(ybar[k]) ? 0 : loss (y[k], ybar[k], sparm) ;
+    }
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Is there a batch oracle?
+ **
+ ** Returns true if PARM.BATCHCONSTRAINTFN is defined, so that
+ ** find_most_violated_constraint_batch() gains from being called
+ ** with all the examples at once.
+ **/
+
+int
+has_batch_oracle (STRUCT_LEARN_PARM *sparm)
+{
+  return (! sparm->plugin &&
+          mxGetField(sparm->mex, 0, "batchConstraintFn") != NULL) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Are the oracles native?
+ **
+ ** Returns true if the most violated constraints are found by a
+ ** native plugin, so that find_most_violated_constraint_native() can
+ ** be used.
+ **/
+
+int
+has_native_oracles (STRUCT_LEARN_PARM *sparm)
+{
+  return (sparm->plugin != NULL) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Find the most violated constraint with the native plugin
+ **
+ ** Like find_most_violated_constraint_slackrescaling() or
+ ** find_most_violated_constraint_marginrescaling(), depending on
+ ** sparm->loss_type, but the model is given by the weight vector W
+ ** (indexed from 1 to sm->sizePsi as sm->w) rather than by sm.
+ **
+ ** This function neither calls MATLAB nor allocates memory with the
+ ** MATLAB allocator, so that it can be run by a thread other than
+ ** the one calling the MEX file, while the latter updates sm. It can
+ ** be used only if has_native_oracles() is true.
+ **/
+
+LABEL
+find_most_violated_constraint_native (PATTERN x, LABEL y, double const *w,
+                                      STRUCTMODEL *sm,
+                                      STRUCT_LEARN_PARM *sparm)
+{
+  LABEL ybar ;
+  PLUGIN * plugin = sparm->plugin ;
+  ybar.mex = NULL ;
+  ybar.isOwner = 1 ;
+  ybar.plugin = plugin ;
+  ybar.native = plugin->abi->argmax (plugin->state,
+                                     w + 1, sm->sizePsi,
+                                     x.native, y.native,
+                                     sparm->loss_type) ;
+  return ybar ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Sum the most violated constraints of all examples in parallel
+ **
+ ** Computes the joint constraint of the one-slack formulation,
+ ** adding fy[i]-fybar[i] scaled by the loss rescaling factor to the
+ ** dense vector LHS_N and loss(y[i],ybar[i])/n to *RHS, for all n
+ ** examples EX. FYCACHE must contain psi(x[i],y[i]).
+ **
+ ** This is done only for native plugins with the linear kernel, as
+ ** they do not call MATLAB and can be run concurrently, and not if
+ ** the plugin runs in a farm of workers (--f option). The examples
+ ** are split into NUM_THREADS contiguous chunks, each accumulated by
+ ** one thread into its own dense vector. The chunks are then summed
+ ** in order, so that the result does not depend on the scheduling of
+ ** the threads. With one thread the result is identical to the one
+ ** of find_most_violated_constraint_batch().
+ **
+ ** Returns 0 without doing anything if the conditions above are not
+ ** met, and 1 otherwise.
+ **/
+
+int
+sum_most_violated_constraints (double *lhs_n, double *rhs,
+                               EXAMPLE *ex, long n, SVECTOR **fycache,
+                               long num_threads, STRUCTMODEL *sm,
+                               STRUCT_LEARN_PARM *sparm)
+{
+  PLUGIN * plugin = sparm->plugin ;
+  long sizePsi = sm->sizePsi ;
+  long numChunks, c, i, k ;
+  double ** acc ;
+  double * chunkRhs ;
+  long * chunkEmpty ;
+  int * chunkFailed ;
+  long ** index ;
+  double ** value ;
+
+  if (! plugin ||
+      sparm->farm ||
+      sm->svm_model->kernel_parm.kernel_type != LINEAR ||
+      ! fycache) {
+    return 0 ;
+  }
+  for (i = 0 ; i < n ; ++ i) if (! fycache[i]) return 0 ;
+
+  numChunks = minl (get_num_threads (num_threads), n) ;
+
+  /* the buffers are allocated here as the MATLAB allocator cannot be
+     used by several threads */
+  acc = (double**) my_malloc (sizeof(double*) * numChunks) ;
+  index = (long**) my_malloc (sizeof(long*) * numChunks) ;
+  value = (double**) my_malloc (sizeof(double*) * numChunks) ;
+  chunkRhs = (double*) my_malloc (sizeof(double) * numChunks) ;
+  chunkEmpty = (long*) my_malloc (sizeof(long) * numChunks) ;
+  chunkFailed = (int*) my_malloc (sizeof(int) * numChunks) ;
+  for (c = 0 ; c < numChunks ; ++ c) {
+    acc[c] = (c == 0) ? lhs_n : create_nvector (sizePsi) ;
+    if (c > 0) clear_nvector (acc[c], sizePsi) ;
+    index[c] = (long*) my_malloc (sizeof(long) * sizePsi) ;
+    value[c] = (double*) my_malloc (sizeof(double) * sizePsi) ;
+    chunkRhs[c] = 0 ;
+    chunkEmpty[c] = 0 ;
+    chunkFailed[c] = 0 ;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static,1) num_threads(numChunks) private(i,k)
+#endif
+  for (c = 0 ; c < numChunks ; ++ c) {
+    SVM_STRUCT_PLUGIN const * abi = plugin->abi ;
+    long begin = (n * c) / numChunks ;
+    long end = (n * (c + 1)) / numChunks ;
+    for (i = begin ; i < end && ! chunkFailed[c] ; ++ i) {
+      void * ybar ;
+      double lossval, factor ;
+      long nnz ;
+
+      ybar = abi->argmax (plugin->state, sm->w + 1, sizePsi,
+                          ex[i].x.native, ex[i].y.native,
+                          sparm->loss_type) ;
+      if (! ybar) {
+        chunkEmpty[c] ++ ;
+        continue ;
+      }
+      lossval = abi->loss (plugin->state, ex[i].y.native, ybar) ;
+      nnz = abi->psi (plugin->state, ex[i].x.native, ybar,
+                      index[c], value[c], sizePsi) ;
+      if (abi->free_label) abi->free_label (plugin->state, ybar) ;
+      if (nnz < 0 || nnz > sizePsi) {
+        chunkFailed[c] = 1 ;
+        break ;
+      }
+
+      /* add fy-fybar, rounding psi(x,ybar) as psi() does */
+      if (sparm->loss_type == SLACK_RESCALING)
+        factor = lossval / n ;
+      else
+        factor = 1.0 / n ;
+      for (k = 0 ; k < nnz ; ++ k) {
+        acc[c][index[c][k] + 1] += (- factor) * (double)(FVAL)value[c][k] ;
+      }
+      add_list_n_ns (acc[c], fycache[i], factor) ;
+      chunkRhs[c] += lossval / n ;
+    }
+  }
+
+  /* reduce in chunk order */
+  for (c = 0 ; c < numChunks ; ++ c) {
+    if (c > 0) {
+      for (k = 1 ; k <= sizePsi ; ++ k) lhs_n[k] += acc[c][k] ;
+      free_nvector (acc[c]) ;
+    }
+    (*rhs) += chunkRhs[c] ;
+    for (i = 0 ; i < chunkEmpty[c] ; ++ i) {
+      printf("ERROR: empty label was returned for example\n");
+    }
+    free (index[c]) ;
+    free (value[c]) ;
+  }
+  for (c = 0 ; c < numChunks ; ++ c) {
+    if (chunkFailed[c]) {
+      mexErrMsgTxt("PARM.PLUGIN failed to compute the feature map") ;
+    }
+  }
+  free (acc) ;
+  free (index) ;
+  free (value) ;
+  free (chunkRhs) ;
+  free (chunkEmpty) ;
+  free (chunkFailed) ;
+  return 1 ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Is the label empty?
  **
@@ -369,7 +1096,7 @@ find_most_violated_constraint_marginrescaling (PATTERN x, LABEL y,
 int
 empty_label (LABEL y)
 {
-  return (y.mex == NULL) ;
+  return (y.mex == NULL && y.native == NULL) ;
 }
 
 /** ------------------------------------------------------------------
@@ -409,13 +1136,15 @@ psi (PATTERN x, LABEL y, STRUCTMODEL *sm,
    * the implicit feature map this function returns a placeholder
    */
 
-  if (sm -> svm_model -> kernel_parm .kernel_type == LINEAR) {
+  if (sparm->plugin) {
+    /* The native plugin computes Phi(x,y) directly */
+    sv = pluginPsi (x, y, sparm) ;
+  }
+  else if (sm -> svm_model -> kernel_parm .kernel_type == LINEAR) {
     /* For the linear kernel computes the vector Phi(x,y) */
     mxArray* out ;
     mxArray* fn_array ;
     mxArray* args [4] ;
-    WORD* words = NULL ;
-    double twonorm_sq = 0 ;
     int status ;
 
     fn_array = mxGetField(sparm->mex, 0, "featureFn") ;
@@ -447,26 +1176,7 @@ psi (PATTERN x, LABEL y, STRUCTMODEL *sm,
                    "of the prescribed size") ;
     }
 
-    {
-      double * data = mxGetPr(out) ;
-      int i ;
-      mwIndex * colOffsets = mxGetJc(out) ;
-      mwIndex * rowIndexes = mxGetIr(out) ;
-      int numNZ = colOffsets[1] - colOffsets[0] ;
-
-      words = (WORD*) my_malloc (sizeof(WORD) * (numNZ + 1)) ;
-
-      for (i = 0 ; i < numNZ ; ++ i) {
-        words[i].wnum = rowIndexes[i] + 1 ;
-        words[i].weight = data[i] ;
-        twonorm_sq += data[i] * data[i] ;
-      }
-      words[numNZ].wnum = 0 ;
-      words[numNZ].weight = 0 ;
-    }
-
-    sv = create_svector_shallow (words, NULL, 1.0) ;
-    sv->twonorm_sq = twonorm_sq ;
+    sv = newSvectorFromSparseColumn (out, 0) ;
 
     mxDestroyArray (out) ;
   }
@@ -474,6 +1184,14 @@ psi (PATTERN x, LABEL y, STRUCTMODEL *sm,
     /* For the ustom kernel returns a placeholder for (x,y). */
     MexPhiCustom phi = newMexPhiCustomFromPatternLabel(x.mex, y.mex) ;
     WORD * words = mxMalloc(sizeof(WORD)) ;
+    phi->index = x.index ;
+    if (x.index >= 0) {
+      /* the key identifies (x,y) in the kernel memo */
+      uint64_t h = 0xCBF29CE484222325ULL ;
+      hashBytes (&h, &x.index, sizeof(x.index)) ;
+      phi->hasKey = hashMxArray (&h, y.mex) ;
+      phi->key = h ;
+    }
     words[0].wnum = 0 ;
     words[0].weight = 0 ;
     sv = create_svector_shallow(words, phi, 1.0) ;
@@ -482,6 +1200,78 @@ psi (PATTERN x, LABEL y, STRUCTMODEL *sm,
   return (sv) ;
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Compute the feature vectors of a batch of pattern-label pairs
+ **
+ ** Fills fvec[k] with psi(x[k],y[k]), for k=0,...,num-1.
+ **
+ ** If the linear kernel is used and PARM.BATCHFEATUREFN is defined,
+ ** the latter is called once for the whole batch with a cell array of
+ ** patterns and a cell array of labels. It must return a sparse
+ ** matrix with PARM.DIMENSION rows and one column per pair, which is
+ ** converted to the feature vectors in a single pass. Otherwise, the
+ ** function falls back to calling psi() for each pair.
+ **/
+
+void
+psi_batch (PATTERN *x, LABEL *y, SVECTOR **fvec, long num,
+           STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm)
+{
+  mxArray* fn_array ;
+  mxArray* patterns_array ;
+  mxArray* labels_array ;
+  mxArray* out ;
+  mxArray* args [4] ;
+  long k ;
+  int status ;
+
+  fn_array = mxGetField(sparm->mex, 0, "batchFeatureFn") ;
+  if (sparm->plugin ||
+      sm -> svm_model -> kernel_parm .kernel_type != LINEAR ||
+      ! fn_array) {
+    for (k = 0 ; k < num ; ++ k) {
+      fvec[k] = psi (x[k], y[k], sm, sparm) ;
+    }
+    return ;
+  }
+  if (mxGetClassID(fn_array) != mxFUNCTION_CLASS) {
+    mexErrMsgTxt("PARM.BATCHFEATUREFN must be a valid function handle") ;
+  }
+
+  patterns_array = newMxArrayEncapsulatingPatterns (x, num) ;
+  labels_array = newMxArrayEncapsulatingLabels (y, num) ;
+
+  args[0] = fn_array ;
+  args[1] = (mxArray*) sparm->mex ; /* model (discard conts) */
+  args[2] = patterns_array ;        /* patterns */
+  args[3] = labels_array ;          /* labels */
+  status = mexCallMATLAB(1, &out, 4, args, "feval") ;
+
+  destroyMxArrayEncapsulatingCell (patterns_array) ;
+  destroyMxArrayEncapsulatingCell (labels_array) ;
+
+  if (status) {
+    mexErrMsgTxt("Error while executing PARM.BATCHFEATUREFN") ;
+  }
+  if (mxGetClassID(out) == mxUNKNOWN_CLASS) {
+    mexErrMsgTxt("PARM.BATCHFEATUREFN must reutrn a result") ;
+  }
+  if (! mxIsSparse(out) ||
+      mxGetClassID(out) != mxDOUBLE_CLASS ||
+      mxGetN(out) != (mwSize) num ||
+      mxGetM(out) != (mwSize) sm->sizePsi) {
+    mexErrMsgTxt("PARM.BATCHFEATUREFN must return a sparse matrix "
+                 "with PARM.DIMENSION rows and one column per pattern") ;
+  }
+
+  /* split the columns into sparse vectors */
+  for (k = 0 ; k < num ; ++ k) {
+    fvec[k] = newSvectorFromSparseColumn (out, k) ;
+  }
+
+  mxDestroyArray (out) ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Evaluate loss function Delta(y, ybar)
  **/
@@ -496,6 +1286,11 @@ loss (LABEL y, LABEL ybar, STRUCT_LEARN_PARM *sparm)
   mxArray* args [4] ;
   int status ;
 
+  if (sparm->plugin) {
+    return sparm->plugin->abi->loss (sparm->plugin->state,
+                                     y.native, ybar.native) ;
+  }
+
   fn_array = mxGetField(sparm->mex, 0, "lossFn") ;
   if (! fn_array) {
     mexErrMsgTxt("Field PARM.LOSSFN not found") ;
@@ -543,6 +1338,7 @@ finalize_iteration (double ceps, int cached_constraint,
 {
   mxArray* fn_array ;
   mxArray* model_array ;
+  MexSmodelSnapshot snapshot ;
   mxArray* out ;
   mxArray* args [3] ;
   int status ;
@@ -555,8 +1351,9 @@ finalize_iteration (double ceps, int cached_constraint,
     mexErrMsgTxt("PARM.ENDITERATIONFN must be a valid function handle") ;
   }
 
-  /* encapsulate sm->w into a Matlab array */
-  model_array = newMxArrayEncapsulatingSmodel (sm) ;
+  /* get the Matlab version of the model */
+  snapshot = retainMexSmodelSnapshot (sm) ;
+  model_array = MexSmodelSnapshotGetArray (snapshot) ;
 
   args[0] = fn_array ;
   args[1] = (mxArray*) sparm->mex ; /* model (discard conts) */
@@ -564,7 +1361,7 @@ finalize_iteration (double ceps, int cached_constraint,
 
   status = mexCallMATLAB (1, &out, 3, args, "feval") ;
 
-  destroyMxArrayEncapsulatingSmodel (model_array) ;
+  releaseMexSmodelSnapshot (snapshot) ;
 
   if (status) {
     mexErrMsgTxt("Error while executing PARM.ENDITERATIONFN") ;
@@ -643,6 +1440,9 @@ free_label (LABEL y)
   if (y.isOwner && y.mex) {
     mxDestroyArray(y.mex) ;
   }
+  if (y.isOwner && y.native && y.plugin->abi->free_label) {
+    y.plugin->abi->free_label(y.plugin->state, y.native) ;
+  }
 }
 
 /** ------------------------------------------------------------------
@@ -654,6 +1454,8 @@ free_struct_model (STRUCTMODEL sm)
 {
   if(sm.svm_model) free_model(sm.svm_model, 1 );
   /* add free calls for user defined data here */
+  releaseMexSmodelSnapshot (sm.snapshot) ;
+  destroyMexSmodelExpansion (sm.expansion) ;
 }
 
 /** ------------------------------------------------------------------
@@ -682,6 +1484,15 @@ print_struct_help ()
   printf("         --* string  -> custom parameters that can be adapted for struct\n");
   printf("                        learning. The * can be replaced by any character\n");
   printf("                        and there can be multiple options starting with --.\n");
+  printf("         --m float   -> size of the memo of CUSTOM kernel values in MB\n");
+  printf("                        (default 40, 0 disables it)\n");
+  printf("         --f int     -> number of worker processes finding the most violated\n");
+  printf("                        constraints with PARM.PLUGIN (default 0, none)\n");
+  printf("         --l [0,1]   -> run the workers of --f as threads (loopback test)\n");
+  printf("         --p int     -> number of passes over the training set (default 10)\n");
+  printf("                        (used with -w 5)\n");
+  printf("         --s [0,1]   -> return the average of the iterates (default 0)\n");
+  printf("                        (used with -w 5)\n");
 }
 
 /** ------------------------------------------------------------------
@@ -699,8 +1510,17 @@ parse_struct_parameters(STRUCT_LEARN_PARM *sparm)
     case 'a': i++; /* strcpy(learn_parm->alphafile,argv[i]); */ break;
     case 'e': i++; /* sparm->epsilon=atof(sparm->custom_argv[i]); */ break;
     case 'k': i++; /* sparm->newconstretrain=atol(sparm->custom_argv[i]); */ break;
-    default: printf("\nUnrecognized option %s!\n\n",sparm->custom_argv[i]);
-      exit(0);
+    case 'm': i++; sparm->kernel_memo_size=atof(sparm->custom_argv[i]); break;
+    case 'f': i++; sparm->farm_size=atol(sparm->custom_argv[i]); break;
+    case 'l': i++; sparm->farm_loopback=atol(sparm->custom_argv[i]); break;
+    case 'p': i++; sparm->ssg_passes=atol(sparm->custom_argv[i]); break;
+    case 's': i++; sparm->ssg_average=atol(sparm->custom_argv[i]); break;
+    default:
+      {
+        char msg [1024+1] ;
+        sprintf(msg, "Unrecognized option '%.1000s'", sparm->custom_argv[i]) ;
+        mexErrMsgTxt(msg) ;
+      }
     }
   }
 }
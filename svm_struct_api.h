@@ -31,6 +31,7 @@ SAMPLE      read_struct_examples(char *file, STRUCT_LEARN_PARM *sparm);
 void        init_struct_model(SAMPLE sample, STRUCTMODEL *sm, 
 			      STRUCT_LEARN_PARM *sparm, LEARN_PARM *lparm, 
 			      KERNEL_PARM *kparm);
+void        update_struct_model(STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
 CONSTSET    init_struct_constraints(SAMPLE sample, STRUCTMODEL *sm, 
 				    STRUCT_LEARN_PARM *sparm);
 LABEL       find_most_violated_constraint_slackrescaling(PATTERN x, LABEL y, 
@@ -39,11 +40,34 @@ LABEL       find_most_violated_constraint_slackrescaling(PATTERN x, LABEL y,
 LABEL       find_most_violated_constraint_marginrescaling(PATTERN x, LABEL y, 
 						     STRUCTMODEL *sm, 
 						     STRUCT_LEARN_PARM *sparm);
+LABEL       find_most_violated_constraint_fused(PATTERN x, LABEL y,
+						SVECTOR **fybar,
+						double *lossval,
+						STRUCTMODEL *sm,
+						STRUCT_LEARN_PARM *sparm);
+void        find_most_violated_constraint_batch(PATTERN *x, LABEL *y,
+						LABEL *ybar, SVECTOR **fybar,
+						double *lossval, long num,
+						STRUCTMODEL *sm,
+						STRUCT_LEARN_PARM *sparm);
+int         has_batch_oracle(STRUCT_LEARN_PARM *sparm);
+int         has_native_oracles(STRUCT_LEARN_PARM *sparm);
+LABEL       find_most_violated_constraint_native(PATTERN x, LABEL y,
+						 double const *w,
+						 STRUCTMODEL *sm,
+						 STRUCT_LEARN_PARM *sparm);
+int         sum_most_violated_constraints(double *lhs_n, double *rhs,
+					  EXAMPLE *ex, long n,
+					  SVECTOR **fycache,
+					  long num_threads, STRUCTMODEL *sm,
+					  STRUCT_LEARN_PARM *sparm);
 LABEL       classify_struct_example(PATTERN x, STRUCTMODEL *sm, 
 				    STRUCT_LEARN_PARM *sparm);
 int         empty_label(LABEL y);
 SVECTOR     *psi(PATTERN x, LABEL y, STRUCTMODEL *sm, 
 	        STRUCT_LEARN_PARM *sparm);
+void        psi_batch(PATTERN *x, LABEL *y, SVECTOR **fvec, long num,
+		      STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
 double      loss(LABEL y, LABEL ybar, STRUCT_LEARN_PARM *sparm);
 int         finalize_iteration(double ceps, int cached_constraint,
 			       SAMPLE sample, STRUCTMODEL *sm,
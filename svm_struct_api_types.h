@@ -22,6 +22,8 @@
 
 # include "svm_light/svm_common.h"
 # include "svm_light/svm_learn.h"
+# include "svm_struct_plugin.h"
+# include "svm_struct_farm.h"
 
 # ifndef WIN
 # include "strings.h"
@@ -36,12 +38,42 @@
 #endif
 
 
+/* A joint kernel which factors as K((x,y),(x',y')) = k_x(x,x') *
+ * k_y(y,y') can be given as the Gram matrix of the training patterns
+ * (PARM.PATTERNGRAM) and either the table of k_y for labels
+ * 1,...,numLabels (PARM.LABELGRAM) or a callback computing it
+ * (PARM.LABELKERNELFN). */
+
+typedef struct MexKernelGram_
+{
+  double const * pattern ;        /* numPatterns x numPatterns */
+  long numPatterns ;
+  double const * label ;          /* numLabels x numLabels or NULL */
+  long numLabels ;
+  mxArray const * labelKernelFn ; /* used if label is NULL */
+} MexKernelGram ;
+
 typedef struct MexKernelInfo_
 {
   mxArray const * structParm ;
   mxArray const * kernelFn ;
+  mxArray const * kernelBlockFn ;
+  struct MexKernelMemoImpl_ * memo ; /* memoized kernel values or NULL */
+  MexKernelGram * gram ;             /* factored kernel or NULL */
 } MexKernelInfo ;
 
+/* The kernel memo caches the values of the CUSTOM kernel between
+ * pairs of phis which have a key (see psi()), i.e. which are made of
+ * a training pattern and a label. It is a set associative table with
+ * a fixed memory budget (--m option) and it is defined in kernel.h */
+
+typedef struct MexKernelMemoImpl_ * MexKernelMemo ;
+
+MexKernelMemo newMexKernelMemo (double sizeMB) ;
+void deleteMexKernelMemo (MexKernelMemo memo) ;
+void MexKernelMemoGetStatistics (MexKernelMemo memo, double * hits,
+                                 double * misses) ;
+
 inline_comm static int
 uIsString(const mxArray* A, int L)
 {
@@ -163,6 +195,8 @@ typedef struct pattern {
   /* this defines the x-part of a training example, e.g. the structure
      for storing a natural language sentence in NLP parsing */
   mxArray* mex ;
+  void* native ;      /* pattern of a native plugin (PARM.PLUGIN) */
+  long index ;        /* index of the training example or -1 */
 } PATTERN;
 
 typedef struct label {
@@ -170,13 +204,40 @@ typedef struct label {
      e.g. the parse tree of the corresponding sentence. */
   mxArray* mex ;
   int isOwner ;
+  void* native ;      /* label of a native plugin (PARM.PLUGIN) */
+  PLUGIN* plugin ;    /* plugin that frees the native label */
 } LABEL;
 
+struct MexSmodelSnapshotImpl_
+{
+  int counter ;
+  mxArray * array ;
+  int borrowsExpansion ; /* alpha, svPatterns, svLabels are borrowed */
+} ;
+
+typedef struct MexSmodelSnapshotImpl_ * MexSmodelSnapshot ;
+
+struct MexSmodelExpansionImpl_
+{
+  long num ;              /* number of exported support vectors */
+  long capacity ;         /* allocated slots */
+  MexPhiCustom * phis ;   /* phis[i] is exported in slot i */
+  mxArray * alpha ;
+  mxArray * svPatterns ;
+  mxArray * svLabels ;
+} ;
+
+typedef struct MexSmodelExpansionImpl_ * MexSmodelExpansion ;
+
 typedef struct structmodel {
   double *w;          /* pointer to the learned weights */
   MODEL  *svm_model;  /* the learned SVM model */
   long   sizePsi;     /* maximum number of weights in w */
   double walpha;
+  MexSmodelSnapshot snapshot; /* MATLAB copy of the model shared by the
+                                 callbacks, NULL if not yet created */
+  MexSmodelExpansion expansion; /* kernel expansion exported to the
+                                   callbacks, NULL if not yet created */
   /* other information that is needed for the stuctural model can be
      added here, e.g. the grammar rules for NLP parsing */
 } STRUCTMODEL;
@@ -193,7 +254,15 @@ typedef struct struct_learn_parm {
   double batch_size;           /* size of the mini batches in percent
 				  of training set size (used in w=4
 				  algorithm) */
+  int    pipeline;             /* if nonzero, find the most violated
+				  constraints of the next batch while
+				  the QP is solved (used in w=4
+				  algorithm with native oracles) */
   double C;                    /* trade-off between margin and loss */
+  double C_path[100];          /* values of C of the regularization
+				  path (-c option with several comma
+				  separated values) */
+  int    C_path_size;          /* number of values in C_path */
   char   custom_argv[50][300]; /* storage for the --* command line options */
   int    custom_argc;          /* number of --* command line options */
   int    slack_norm;           /* norm to use in objective function
@@ -206,8 +275,24 @@ typedef struct struct_learn_parm {
   int    loss_function;        /* select between different loss
 				  functions via -l command line
 				  option */
+  double kernel_memo_size;     /* memory budget of the kernel memo in
+				  MB (--m option), 0 to disable it */
+  int    farm_size;            /* number of oracle worker processes
+				  (--f option), 0 to disable them */
+  int    farm_loopback;        /* run the workers as threads of this
+				  process (--l option), for testing */
+  int    ssg_passes;           /* number of passes over the training
+				  set (--p option, used in w=5
+				  algorithm) */
+  int    ssg_average;          /* if nonzero, return the average of
+				  the iterates (--s option, used in
+				  w=5 algorithm) */
   /* further parameters that are passed to init_struct_model() */
   mxArray const * mex ;
+  PLUGIN * plugin ;            /* native oracles (PARM.PLUGIN) or NULL */
+  FARM * farm ;                /* workers running the plugin or NULL */
+  struct struct_path * path ;  /* state shared by the models of the
+                                  regularization path or NULL */
 } STRUCT_LEARN_PARM ;
 
 typedef struct struct_test_stats {
@@ -320,5 +405,212 @@ destroyMxArrayEncapsulatingSmodel (mxArray * array)
   }
 }
 
+/* The expansion is the kernel part of the snapshot (ALPHA, SVPATTERNS
+ * and SVLABELS). Rather than being rebuilt every time the model
+ * changes, it persists for the whole training and it is patched in
+ * place: the coefficients of the support vectors sharing the same phi
+ * are summed into a single slot, slots of new phis are appended and
+ * slots of phis that left the model (e.g. because of
+ * remove_inactive_constraints()) are filled by moving the last
+ * one. Only the coefficients are rewritten for the phis that stay. */
+
+inline_comm static void
+growMexSmodelExpansion (MexSmodelExpansion ex)
+{
+  long i, capacity = 2 * ex -> capacity + 16 ;
+  mxArray * svPatterns_array = mxCreateCellMatrix (1, capacity) ;
+  mxArray * svLabels_array = mxCreateCellMatrix (1, capacity) ;
+  for (i = 0 ; i < ex -> num ; ++ i) {
+    mxSetCell (svPatterns_array, i, mxGetCell (ex -> svPatterns, i)) ;
+    mxSetCell (svLabels_array, i, mxGetCell (ex -> svLabels, i)) ;
+    mxSetCell (ex -> svPatterns, i, NULL) ;
+    mxSetCell (ex -> svLabels, i, NULL) ;
+  }
+  mxDestroyArray (ex -> svPatterns) ;
+  mxDestroyArray (ex -> svLabels) ;
+  ex -> svPatterns = svPatterns_array ;
+  ex -> svLabels = svLabels_array ;
+  mxSetPr (ex -> alpha, mxRealloc (mxGetPr (ex -> alpha),
+                                   sizeof(double) * capacity)) ;
+  ex -> phis = mxRealloc (ex -> phis, sizeof(MexPhiCustom) * capacity) ;
+  ex -> capacity = capacity ;
+}
+
+inline_comm static void
+updateMexSmodelExpansion (STRUCTMODEL * smodel)
+{
+  MexSmodelExpansion ex = smodel -> expansion ;
+  MODEL * model = smodel -> svm_model ;
+  MexPhiCustom phi ;
+  SVECTOR * sv ;
+  double * alpha ;
+  long i, svi ;
+
+  if (! ex) {
+    ex = mxCalloc (1, sizeof(struct MexSmodelExpansionImpl_)) ;
+    ex -> alpha = mxCreateDoubleMatrix (0, 1, mxREAL) ;
+    ex -> svPatterns = mxCreateCellMatrix (1, 0) ;
+    ex -> svLabels = mxCreateCellMatrix (1, 0) ;
+    smodel -> expansion = ex ;
+  }
+
+  /* accumulate the coefficients, appending the new phis */
+  alpha = mxGetPr (ex -> alpha) ;
+  for (i = 0 ; i < ex -> num ; ++ i) alpha [i] = 0 ;
+  for (svi = 1 ; svi < model -> sv_num ; ++ svi) {
+    for (sv = model -> supvec[svi] -> fvec ; sv ; sv = sv -> next) {
+      phi = sv -> userdefined ;
+      if (! phi) continue ;
+      if (phi -> slot < 0) {
+        if (ex -> num == ex -> capacity) {
+          growMexSmodelExpansion (ex) ;
+          alpha = mxGetPr (ex -> alpha) ;
+        }
+        retainMexPhiCustom (phi) ;
+        phi -> slot = ex -> num ++ ;
+        ex -> phis [phi -> slot] = phi ;
+        alpha [phi -> slot] = 0 ;
+        mxSetCell (ex -> svPatterns, phi -> slot, MexPhiCustomGetPattern (phi)) ;
+        mxSetCell (ex -> svLabels,   phi -> slot, MexPhiCustomGetLabel   (phi)) ;
+      }
+      alpha [phi -> slot] += model -> alpha[svi] * sv -> factor ;
+    }
+  }
+
+  /* drop the phis which do not contribute anymore */
+  for (i = 0 ; i < ex -> num ; ) {
+    long last = ex -> num - 1 ;
+    if (alpha [i] != 0) { ++ i ; continue ; }
+    phi = ex -> phis [i] ;
+    phi -> slot = -1 ;
+    if (i < last) {
+      ex -> phis [i] = ex -> phis [last] ;
+      ex -> phis [i] -> slot = i ;
+      alpha [i] = alpha [last] ;
+      mxSetCell (ex -> svPatterns, i, mxGetCell (ex -> svPatterns, last)) ;
+      mxSetCell (ex -> svLabels,   i, mxGetCell (ex -> svLabels,   last)) ;
+    }
+    mxSetCell (ex -> svPatterns, last, NULL) ;
+    mxSetCell (ex -> svLabels,   last, NULL) ;
+    releaseMexPhiCustom (phi) ;
+    ex -> num = last ;
+  }
+
+  mxSetM (ex -> alpha, ex -> num) ;
+  mxSetN (ex -> svPatterns, ex -> num) ;
+  mxSetN (ex -> svLabels, ex -> num) ;
+}
+
+inline_comm static void
+destroyMexSmodelExpansion (MexSmodelExpansion ex)
+{
+  long i ;
+  if (! ex) return ;
+  for (i = 0 ; i < ex -> num ; ++ i) {
+    mxSetCell (ex -> svPatterns, i, NULL) ;
+    mxSetCell (ex -> svLabels, i, NULL) ;
+    ex -> phis [i] -> slot = -1 ;
+    releaseMexPhiCustom (ex -> phis [i]) ;
+  }
+  mxDestroyArray (ex -> alpha) ;
+  mxDestroyArray (ex -> svPatterns) ;
+  mxDestroyArray (ex -> svLabels) ;
+  mxFree (ex -> phis) ;
+  mxFree (ex) ;
+}
+
+/* The snapshot is a MATLAB version of the model which is built on
+ * demand and then shared by all callbacks until the model changes
+ * (see update_struct_model()). It is reference counted as the model
+ * holds a reference too. */
+
+inline_comm static MexSmodelSnapshot
+retainMexSmodelSnapshot (STRUCTMODEL * smodel)
+{
+  if (! smodel -> snapshot) {
+    smodel -> snapshot = mxMalloc (sizeof(struct MexSmodelSnapshotImpl_)) ;
+    smodel -> snapshot -> counter = 1 ;
+    if (smodel -> svm_model -> kernel_parm .kernel_type == LINEAR) {
+      smodel -> snapshot -> array = newMxArrayEncapsulatingSmodel (smodel) ;
+      smodel -> snapshot -> borrowsExpansion = 0 ;
+    } else {
+      mwSize dims [] = {1, 1} ;
+      char const * fieldNames [] = {
+        "w", "alpha", "svPatterns", "svLabels"
+      } ;
+      mxArray * array = mxCreateStructArray (2, dims, 4, fieldNames) ;
+      updateMexSmodelExpansion (smodel) ;
+      mxSetField (array, 0, "alpha", smodel -> expansion -> alpha) ;
+      mxSetField (array, 0, "svPatterns", smodel -> expansion -> svPatterns) ;
+      mxSetField (array, 0, "svLabels", smodel -> expansion -> svLabels) ;
+      smodel -> snapshot -> array = array ;
+      smodel -> snapshot -> borrowsExpansion = 1 ;
+    }
+  }
+  smodel -> snapshot -> counter ++ ;
+  return smodel -> snapshot ;
+}
+
+inline_comm static void
+releaseMexSmodelSnapshot (MexSmodelSnapshot snapshot)
+{
+  if (snapshot) {
+    snapshot -> counter -- ;
+    if (snapshot -> counter == 0) {
+      if (snapshot -> borrowsExpansion) {
+        mxSetField (snapshot -> array, 0, "alpha", NULL) ;
+        mxSetField (snapshot -> array, 0, "svPatterns", NULL) ;
+        mxSetField (snapshot -> array, 0, "svLabels", NULL) ;
+        mxDestroyArray (snapshot -> array) ;
+      } else {
+        destroyMxArrayEncapsulatingSmodel (snapshot -> array) ;
+      }
+      mxFree (snapshot) ;
+    }
+  }
+}
+
+inline_comm static mxArray *
+MexSmodelSnapshotGetArray (MexSmodelSnapshot snapshot)
+{
+  assert (snapshot) ;
+  return snapshot -> array ;
+}
+
+inline_comm static mxArray *
+newMxArrayEncapsulatingPatterns (PATTERN const * x, long num)
+{
+  long i ;
+  mxArray * array = mxCreateCellMatrix (1, num) ;
+  for (i = 0 ; i < num ; ++ i) {
+    mxSetCell (array, i, x[i].mex) ;
+  }
+  return array ;
+}
+
+inline_comm static mxArray *
+newMxArrayEncapsulatingLabels (LABEL const * y, long num)
+{
+  long i ;
+  mxArray * array = mxCreateCellMatrix (1, num) ;
+  for (i = 0 ; i < num ; ++ i) {
+    mxSetCell (array, i, y[i].mex) ;
+  }
+  return array ;
+}
+
+inline_comm static void
+destroyMxArrayEncapsulatingCell (mxArray * array)
+{
+  if (array) {
+    /* the cell elements are borrowed and must not be freed */
+    int i, n = mxGetNumberOfElements (array) ;
+    for (i = 0 ; i < n ; ++ i) {
+      mxSetCell (array, i, NULL) ;
+    }
+    mxDestroyArray (array) ;
+  }
+}
+
               
 #endif
@@ -0,0 +1,411 @@
+/** file:   svm_struct_farm.c
+ ** brief:  Farm of worker processes running the native oracles
+ ** author: Andrea Vedaldi
+ **/
+
+/*
+ Like svm_struct_plugin.c, this file does not include svm_common.h on
+ purpose: the workers must not use the MATLAB allocator, and the
+ buffers of the farm are owned by it.
+
+ Protocol. For each batch, the weight vector is copied to the shared
+ region farm->w and each worker receives a FARM_REQUEST followed by
+ the indexes of its examples. For each example, in order, the worker
+ sends back a FARM_REPLY followed by the indexes and the values of
+ the non-zero components of psi(x,ybar). The farm is stopped by
+ closing the sockets.
+ */
+
+#include "svm_struct_farm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#else
+#define snprintf _snprintf
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* do not raise SIGPIPE if the other end is gone */
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+typedef struct farm_request {
+  long   num;             /* number of examples that follow */
+  int    loss_type;       /* argmax() loss type */
+} FARM_REQUEST;
+
+typedef struct farm_reply {
+  long   nnz;             /* non-zeros of psi() that follow, or <0 */
+  int    empty;           /* argmax() returned no label */
+  double loss;            /* loss of the label */
+} FARM_REPLY;
+
+#ifndef WIN
+
+typedef struct farm_worker {
+  int    started;         /* the worker is running */
+  pid_t  pid;             /* process id of the worker */
+  pthread_t thread;       /* thread of the worker (loopback) */
+  int    socket;          /* worker end of the socket (loopback) */
+  PLUGIN *plugin;         /* plugin (loopback) */
+  double const *w;        /* shared weight vector (loopback) */
+} FARM_WORKER;
+
+/* serialises the plugin calls of the loopback workers, which share
+   the plugin state and buffers */
+static pthread_mutex_t loopback_lock = PTHREAD_MUTEX_INITIALIZER ;
+
+/** ------------------------------------------------------------------
+ ** @brief Read exactly SIZE bytes from a socket
+ **/
+
+static int
+read_all (int fd, void *data, size_t size)
+{
+  char * p = (char*) data ;
+  while (size > 0) {
+    ssize_t n = recv (fd, p, size, 0) ;
+    if (n < 0 && errno == EINTR) continue ;
+    if (n <= 0) return -1 ;
+    p += n ;
+    size -= n ;
+  }
+  return 0 ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Write exactly SIZE bytes to a socket
+ **/
+
+static int
+write_all (int fd, void const *data, size_t size)
+{
+  char const * p = (char const*) data ;
+  while (size > 0) {
+    ssize_t n = send (fd, p, size, SEND_FLAGS) ;
+    if (n < 0 && errno == EINTR) continue ;
+    if (n <= 0) return -1 ;
+    p += n ;
+    size -= n ;
+  }
+  return 0 ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Serve the requests of the farm
+ **
+ ** Runs in a worker until the socket SOCK is closed or fails. W is
+ ** the weight vector shared with the farm. If LOCK is not NULL, it
+ ** is held while the plugin is called.
+ **/
+
+static void
+serve_farm (PLUGIN *plugin, int sock, double const *w,
+            pthread_mutex_t *lock)
+{
+  SVM_STRUCT_PLUGIN const * abi = plugin->abi ;
+  FARM_REQUEST request ;
+  FARM_REPLY reply ;
+  long * exnum = NULL ;
+  long exnum_capacity = 0 ;
+  long * index = NULL ;
+  double * value = NULL ;
+  long capacity = 0 ;
+  long k ;
+
+  while (read_all (sock, &request, sizeof(request)) == 0) {
+    if (request.num > exnum_capacity) {
+      exnum_capacity = request.num ;
+      exnum = (long*) realloc (exnum, sizeof(long) * exnum_capacity) ;
+      if (! exnum) break ;
+    }
+    if (read_all (sock, exnum, sizeof(long) * request.num)) break ;
+
+    for (k = 0 ; k < request.num ; ++ k) {
+      void * x ;
+      void * y ;
+      void * ybar ;
+      if (lock) pthread_mutex_lock (lock) ;
+      abi->example (plugin->state, exnum[k], &x, &y) ;
+      ybar = abi->argmax (plugin->state, w, plugin->size_psi,
+                          x, y, request.loss_type) ;
+      reply.nnz = 0 ;
+      reply.empty = (ybar == NULL) ;
+      reply.loss = 0 ;
+      if (ybar) {
+        reply.loss = abi->loss (plugin->state, y, ybar) ;
+        for (;;) {
+          reply.nnz = abi->psi (plugin->state, x, ybar,
+                                index, value, capacity) ;
+          if (reply.nnz < 0 || reply.nnz <= capacity) break ;
+          capacity = reply.nnz ;
+          index = (long*) realloc (index, sizeof(long) * capacity) ;
+          value = (double*) realloc (value, sizeof(double) * capacity) ;
+          if (! index || ! value) { reply.nnz = -1 ; break ; }
+        }
+        if (abi->free_label) abi->free_label (plugin->state, ybar) ;
+      }
+      if (lock) pthread_mutex_unlock (lock) ;
+      if (write_all (sock, &reply, sizeof(reply))) goto done ;
+      if (reply.nnz > 0 &&
+          (write_all (sock, index, sizeof(long) * reply.nnz) ||
+           write_all (sock, value, sizeof(double) * reply.nnz))) {
+        goto done ;
+      }
+    }
+  }
+
+ done:
+  free (exnum) ;
+  free (index) ;
+  free (value) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Body of a loopback worker
+ **/
+
+static void *
+loopback_worker (void *data)
+{
+  FARM_WORKER * worker = (FARM_WORKER*) data ;
+  serve_farm (worker->plugin, worker->socket, worker->w, &loopback_lock) ;
+  close (worker->socket) ;
+  return NULL ;
+}
+
+#endif
+
+/** ------------------------------------------------------------------
+ ** @brief Start a farm
+ **
+ ** Starts NUM_WORKERS workers running PLUGIN, which must be loaded
+ ** and not in use by other threads. The workers are forked, or are
+ ** threads of this process if LOOPBACK is true. Returns NULL and
+ ** writes a message to ERROR on failure.
+ **/
+
+FARM *
+start_farm (PLUGIN *plugin, int num_workers, int loopback,
+            char *error, int error_size)
+{
+#ifndef WIN
+  FARM * farm ;
+  FARM_WORKER * workers ;
+  int t, s ;
+
+  farm = (FARM*) calloc (1, sizeof(FARM)) ;
+  farm->plugin = plugin ;
+  farm->num_workers = num_workers ;
+  farm->loopback = loopback ;
+  farm->sockets = (int*) malloc (sizeof(int) * num_workers) ;
+  farm->num_sent = (long*) calloc (num_workers, sizeof(long)) ;
+  farm->workers = workers =
+    (FARM_WORKER*) calloc (num_workers, sizeof(FARM_WORKER)) ;
+  for (t = 0 ; t < num_workers ; ++ t) farm->sockets[t] = -1 ;
+
+  farm->w = (double*) mmap (NULL, sizeof(double) * plugin->size_psi,
+                            PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0) ;
+  if (farm->w == (double*) MAP_FAILED) {
+    farm->w = NULL ;
+    snprintf (error, error_size, "Could not map the memory of the farm: %s",
+              strerror (errno)) ;
+    goto fail ;
+  }
+
+  for (t = 0 ; t < num_workers ; ++ t) {
+    int fds [2] ;
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds)) {
+      snprintf (error, error_size, "Could not create a socket: %s",
+                strerror (errno)) ;
+      goto fail ;
+    }
+#ifdef SO_NOSIGPIPE
+    {
+      int one = 1 ;
+      setsockopt (fds[0], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one)) ;
+      setsockopt (fds[1], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one)) ;
+    }
+#endif
+    farm->sockets[t] = fds[0] ;
+
+    if (loopback) {
+      workers[t].socket = fds[1] ;
+      workers[t].plugin = plugin ;
+      workers[t].w = farm->w ;
+      if (pthread_create (&workers[t].thread, NULL,
+                          loopback_worker, &workers[t])) {
+        close (fds[1]) ;
+        snprintf (error, error_size, "Could not start a worker thread") ;
+        goto fail ;
+      }
+    } else {
+      pid_t pid = fork () ;
+      if (pid < 0) {
+        close (fds[1]) ;
+        snprintf (error, error_size, "Could not fork a worker: %s",
+                  strerror (errno)) ;
+        goto fail ;
+      }
+      if (pid == 0) {
+        /* worker: drop the sockets of the other workers */
+        for (s = 0 ; s <= t ; ++ s) close (farm->sockets[s]) ;
+        serve_farm (plugin, fds[1], farm->w, NULL) ;
+        _exit (0) ;
+      }
+      close (fds[1]) ;
+      workers[t].pid = pid ;
+    }
+    workers[t].started = 1 ;
+  }
+  return farm ;
+
+ fail:
+  stop_farm (farm) ;
+  return NULL ;
+#else
+  snprintf (error, error_size, "Farms of workers are not supported on Windows") ;
+  return NULL ;
+#endif
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Stop a farm
+ **
+ ** Closes the sockets, waits for the workers to quit and frees the
+ ** farm. Unanswered requests are discarded.
+ **/
+
+void
+stop_farm (FARM *farm)
+{
+#ifndef WIN
+  FARM_WORKER * workers ;
+  int t ;
+  if (! farm) return ;
+  workers = (FARM_WORKER*) farm->workers ;
+  for (t = 0 ; t < farm->num_workers ; ++ t) {
+    if (farm->sockets[t] >= 0) close (farm->sockets[t]) ;
+  }
+  for (t = 0 ; t < farm->num_workers ; ++ t) {
+    if (! workers[t].started) continue ;
+    if (farm->loopback) {
+      pthread_join (workers[t].thread, NULL) ;
+    } else {
+      while (waitpid (workers[t].pid, NULL, 0) < 0 && errno == EINTR) ;
+    }
+  }
+  if (farm->w) munmap (farm->w, sizeof(double) * farm->plugin->size_psi) ;
+  free (farm->sockets) ;
+  free (farm->num_sent) ;
+  free (farm->workers) ;
+  free (farm->index) ;
+  free (farm->value) ;
+  free (farm) ;
+#endif
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Send a batch of examples to the farm
+ **
+ ** Asks the workers for the most violated labels of the examples
+ ** EXNUM[0], ..., EXNUM[NUM-1] for the weight vector W (with
+ ** plugin->size_psi components) and LOSS_TYPE (see the argmax()
+ ** function of the plugin). The examples are split evenly among the
+ ** workers. All the replies to the previous batch must have been
+ ** received. Returns a negative number on failure.
+ **/
+
+int
+farm_send (FARM *farm, double const *w, long const *exnum,
+           long num, int loss_type)
+{
+#ifndef WIN
+  FARM_REQUEST request ;
+  long begin = 0, end ;
+  int t ;
+
+  memcpy (farm->w, w, sizeof(double) * farm->plugin->size_psi) ;
+  for (t = 0 ; t < farm->num_workers ; ++ t) {
+    end = (num * (t + 1)) / farm->num_workers ;
+    request.num = end - begin ;
+    request.loss_type = loss_type ;
+    farm->num_sent[t] = request.num ;
+    if (write_all (farm->sockets[t], &request, sizeof(request)) ||
+        write_all (farm->sockets[t], exnum + begin,
+                   sizeof(long) * request.num)) {
+      return -1 ;
+    }
+    begin = end ;
+  }
+  farm->worker = 0 ;
+  farm->num_received = 0 ;
+  return 0 ;
+#else
+  return -1 ;
+#endif
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Receive the next reply of the farm
+ **
+ ** The replies are received in the same order as the examples passed
+ ** to farm_send(). Sets EMPTY if no label was found and LOSS to the
+ ** loss of the label. Returns the number of non-zero components of
+ ** psi(x,ybar), which are stored in farm->index (0,...,size_psi-1)
+ ** and farm->value, or a negative number on failure.
+ **/
+
+long
+farm_receive (FARM *farm, int *empty, double *loss)
+{
+#ifndef WIN
+  FARM_REPLY reply ;
+  int sock ;
+
+  while (farm->worker < farm->num_workers &&
+         farm->num_received >= farm->num_sent[farm->worker]) {
+    farm->worker ++ ;
+    farm->num_received = 0 ;
+  }
+  if (farm->worker >= farm->num_workers) return -1 ;
+  sock = farm->sockets[farm->worker] ;
+
+  if (read_all (sock, &reply, sizeof(reply))) return -1 ;
+  farm->num_received ++ ;
+  if (reply.nnz < 0) return -1 ;
+  if (reply.nnz > farm->capacity) {
+    farm->capacity = reply.nnz ;
+    farm->index = (long*) realloc (farm->index, sizeof(long) * reply.nnz) ;
+    farm->value = (double*) realloc (farm->value, sizeof(double) * reply.nnz) ;
+    if (! farm->index || ! farm->value) return -1 ;
+  }
+  if (reply.nnz > 0 &&
+      (read_all (sock, farm->index, sizeof(long) * reply.nnz) ||
+       read_all (sock, farm->value, sizeof(double) * reply.nnz))) {
+    return -1 ;
+  }
+  *empty = reply.empty ;
+  *loss = reply.loss ;
+  return reply.nnz ;
+#else
+  return -1 ;
+#endif
+}
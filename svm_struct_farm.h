@@ -0,0 +1,68 @@
+/** file:   svm_struct_farm.h
+ ** brief:  Farm of worker processes running the native oracles
+ ** author: Andrea Vedaldi
+ **/
+
+/*
+ A farm is a set of worker processes that find the most violated
+ constraints of a native plugin (see svm_struct_plugin.h) in
+ parallel. It is started by the --f option. The workers are forked
+ from the process that loaded the plugin, so that they share its code,
+ state and training examples, and each of them calls the plugin
+ sequentially. Therefore, unlike the -j option, the plugin does not
+ need to be thread safe.
+
+ For each batch of examples, the weight vector w is written to a
+ memory region shared with the workers and the indexes of the
+ examples are sent to them over UNIX-domain sockets. Each worker
+ replies with the loss and the feature map psi(x,ybar) of the most
+ violated label ybar of each example. The labels themselves never
+ leave the workers.
+
+ In loopback mode (--l option) the workers are threads of the calling
+ process instead, which speak the same protocol over the same
+ sockets. As these threads share the plugin, they take turns to call
+ it, so that the plugin still does not need to be thread safe. This
+ is meant for testing the farm without forking.
+
+ Farms are not available on Windows.
+ */
+
+#ifndef SVM_STRUCT_FARM_H
+#define SVM_STRUCT_FARM_H
+
+#include "svm_struct_plugin.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a farm of oracle workers */
+typedef struct farm {
+  PLUGIN *plugin;         /* plugin run by the workers */
+  int    num_workers;     /* number of workers */
+  int    loopback;        /* workers are threads of this process */
+  int    *sockets;        /* our end of the socket of each worker */
+  void   *workers;        /* process ids or threads of the workers */
+  double *w;              /* weight vector shared with the workers */
+  long   *num_sent;       /* number of examples sent to each worker */
+  int    worker;          /* worker of the next reply */
+  long   num_received;    /* replies received from that worker */
+  long   capacity;        /* size of the reply buffers */
+  long   *index;          /* reply buffer for the psi() indexes */
+  double *value;          /* reply buffer for the psi() values */
+} FARM;
+
+FARM   *start_farm(PLUGIN *plugin, int num_workers, int loopback,
+                   char *error, int error_size);
+void    stop_farm(FARM *farm);
+int     farm_send(FARM *farm, double const *w, long const *exnum,
+                  long num, int loss_type);
+long    farm_receive(FARM *farm, int *empty, double *loss);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* SVM_STRUCT_FARM_H */
+#endif
@@ -22,6 +22,28 @@
 %       the input PARM structure, MODEL is the a structure
 %       representing the current model, X is an input pattern, and Y
 %       is its ground truth label. YBAR is the most violated labels.
+%       An empty YBAR ([]) means that no violated constraint was
+%       found, and the example contributes no constraint.
+%
+%     BATCHCONSTRAINTFN:: batch constraint callback
+%       The optional callback YBARS = FUNC(PARAM, MODEL, XS, YS) is
+%       the batch version of CONSTRAINTFN. XS and YS are cell arrays
+%       of patterns and ground truth labels and YBARS is a cell array
+%       of the same size containing the corresponding most violated
+%       labels, or [] as for CONSTRAINTFN. If specified, it is used
+%       instead of CONSTRAINTFN whenever the solver needs the most
+%       violated constraints of several examples at once (e.g. -w 2,
+%       3, 4), passing MODEL to MATLAB only once per batch.
+%
+%     FUSEDCONSTRAINTFN:: fused constraint callback
+%       The optional callback [YBAR, PSI, DELTA] = FUNC(PARAM, MODEL,
+%       X, Y) is like CONSTRAINTFN, but it also returns the feature
+%       map PSI = FEATUREFN(PARAM, X, YBAR) and the loss DELTA =
+%       LOSSFN(PARAM, Y, YBAR), which are usually computed anyways
+%       during the search of the most violated label. If specified,
+%       it is used instead of CONSTRAINTFN, saving the calls to
+%       FEATUREFN and LOSSFN. PSI is ignored if kernels are used, and
+%       PSI and DELTA are ignored if YBAR is [].
 %
 %     FEATUREN:: feature map callback
 %       A handle to the feature map. This function has the form PSI =
@@ -30,6 +52,15 @@
 %       dimension PARM.DIMENSION. This handle does not need to be
 %       specified if kernels are used.
 %
+%     BATCHFEATUREFN:: batch feature map callback
+%       The optional callback PSIS = FUNC(PARAM, XS, YS) is the batch
+%       version of FEATUREFN. XS and YS are cell arrays of N patterns
+%       and labels and PSIS is a sparse matrix of dimension
+%       PARM.DIMENSION x N whose columns are the corresponding feature
+%       vectors. If specified, it is used instead of FEATUREFN to
+%       compute the feature maps of several pairs at once. It is
+%       ignored if kernels are used.
+%
 %     ENDITERATIONFN:: end iteration callback
 %       The optional callback CONTINUE = ENDITERATIONFN(PARAM, MODEL)
 %       is called at the end of each cutting plane iteration. This can
@@ -49,6 +80,44 @@
 %       input of the joint kernel. This handle does not need to be
 %       specified if feature maps are used.
 %
+%     KERNELBLOCKFN:: block kernel function callback
+%       The optional callback K = FUNC(PARAM, X1, Y1, X2, Y2) is the
+%       block version of KERNELFN. X1, Y1 and X2, Y2 are cell arrays
+%       of M and N pattern-label pairs and K is the full M x N matrix
+%       of the corresponding joint kernel values. If specified, it is
+%       used to compute whole rows of kernel values at once (e.g. when
+%       the kernel matrix of the constraints is extended). Either
+%       KERNELFN or KERNELBLOCKFN must be specified if kernels are
+%       used, unless PATTERNGRAM is.
+%
+%     PATTERNGRAM:: Gram matrix of the patterns
+%       For a joint kernel of the form K((X,Y),(XP,YP)) = KX(X,XP) *
+%       KY(Y,YP), the optional N x N matrix of the values
+%       KX(PATTERNS{I},PATTERNS{J}), where N = NUMEL(PATTERNS). The
+%       joint kernel is then evaluated without calling KERNELFN,
+%       multiplying this value by KY(Y,YP), which is given by either
+%       LABELGRAM or LABELKERNELFN.
+%
+%     LABELGRAM:: Gram matrix of the labels
+%       The L x L matrix of the values KY(I,J) for labels which are
+%       the integers 1,...,L.
+%
+%     LABELKERNELFN:: label kernel callback
+%       The callback KY = FUNC(PARAM, Y, YP), used if LABELGRAM is not
+%       specified.
+%
+%     PLUGIN:: native oracle plugin
+%       The optional path of a shared library implementing the
+%       examples, the feature map, the loss and the constraint
+%       generation in C (see svm_struct_plugin.h). If specified,
+%       PATTERNS, LABELS, DIMENSION and the callbacks above (except
+%       ENDITERATIONFN) are not used and MATLAB is not called back
+%       during learning. Only the linear kernel is supported.
+%
+%     PLUGINOPTIONS:: native plugin options
+%       An optional string passed to the initialization function of
+%       the plugin.
+%
 %   MODEL is a structure with fields:
 %
 %     W:: weight vector
@@ -58,7 +127,17 @@
 %     ALPHA:: dual variables
 %     SVPATTERNS:: patterns which are support vectors
 %     SVLABELS:: labels which are support vectors
-%       Used with kernels.
+%       Used with kernels. In the model passed to the callbacks during
+%       learning, each pattern-label pair is listed once (with the sum
+%       of its coefficients) and the order of the pairs is arbitrary.
+%
+%   If the -c option lists several values of C, MODEL is a struct
+%   array with one model per value, in the same order. The models are
+%   trained from the smallest to the largest C. With the one-slack
+%   algorithms (-w 2, 3, 4) each model starts from the working set of
+%   the previous one and they share the feature maps of the training
+%   examples and the constraint cache, which saves most of the calls
+%   to the callbacks.
 %
 %   ARGS is a string specifying options in the usual struct
 %   SVM. These are:
@@ -69,7 +148,9 @@
 %
 %   Learning Options::
 %           -c float    -> C: trade-off between training error
-%                          and margin (default 0.01)
+%                          and margin (default 0.01). Several comma
+%                          separated values (e.g. -c 0.1,1,10) train
+%                          one model for each of them
 %           -p [1,2]    -> L-norm to use for slack variables. Use 1 for L1-norm,
 %                          use 2 for squared slacks. (default 1)
 %           -o [1,2]    -> Rescaling method to use for loss.
@@ -86,7 +167,12 @@
 %                          2: 1-slack algorithm (primal) described in [5]
 %                          3: 1-slack algorithm (dual) described in [5]
 %                          4: 1-slack algorithm (dual) with constraint cache [5]
-%                          9: custom algorithm in svm_struct_learn_custom.c
+%                          5: stochastic subgradient descent described in [8]
+%                             (linear kernel only)
+%                          6: 1-slack algorithm (dual) with a line search
+%                             between iterates as in [9] (linear kernel only)
+%                          9: block-coordinate Frank-Wolfe described in [7]
+%                             (linear kernel and margin rescaling only)
 %           -e float    -> epsilon: allow that tolerance for termination
 %                          criterion
 %           -k [1..]    -> number of new constraints to accumulate before
@@ -96,6 +182,16 @@
 %           -b [1..100] -> percentage of training set for which to refresh cache
 %                          when no epsilon violated constraint can be constructed
 %                          from current cache (default 100%%) (used with -w 4)
+%           -z [0,1]    -> find the most violated constraints of the next batch
+%                          with the previous model while solving the QP
+%                          (default 0) (-w 4 with a native PLUGIN only)
+%           -j [1..]    -> number of threads (default 1). Used for the parts of
+%                          learning that do not call MATLAB: finding the most
+%                          violated constraints with a native PLUGIN (which
+%                          must then be thread safe), refreshing the constraint
+%                          cache, updating the gradient of the QP subproblems
+%                          and computing kernel values with the built-in
+%                          kernels
 %
 %  SVM-light Options for Solving QP Subproblems (see [3])::
 %           -n [2..q]   -> number of new variables entering the working set
@@ -121,6 +217,23 @@
 %           -s float    -> parameter s in sigmoid/poly kernel
 %           -r float    -> parameter c in sigmoid/poly kernel
 %           -u string   -> parameter of user defined kernel
+%           --m float   -> size of the memo of user defined kernel values
+%                          in MB (default 40, 0 disables it). Kernel
+%                          values between pairs made of a training
+%                          pattern and a label are remembered, so that
+%                          KERNELFN is not called again for them.
+%           --f int     -> number of worker processes that find the most
+%                          violated constraints with a native PLUGIN
+%                          (default 0, none). The workers are forked from
+%                          MATLAB and receive the examples and the model
+%                          over local sockets (-w 2, 3 and 4 only, not
+%                          available on Windows).
+%           --l [0,1]   -> run the workers of --f as threads of MATLAB
+%                          instead (loopback test, default 0).
+%           --p int     -> number of passes over the training set
+%                          (default 10) (used with -w 5)
+%           --s [0,1]   -> return the average of the iterates instead
+%                          of the last one (default 0) (used with -w 5)
 %
 %  Output Options::
 %           -a string   -> write all alphas to this file after learning
@@ -140,5 +253,13 @@
 %    [5] T. Joachims, T. Finley, Chun-Nam Yu, Cutting-Plane Training of Structural
 %        SVMs, Machine Learning Journal, to appear.
 %    [6] http://svmlight.joachims.org/
+%    [7] S. Lacoste-Julien, M. Jaggi, M. Schmidt, P. Pletscher,
+%        Block-Coordinate Frank-Wolfe Optimization for Structural SVMs,
+%        ICML, 2013.
+%    [8] S. Shalev-Shwartz, Y. Singer, N. Srebro, Pegasos: Primal
+%        Estimated sub-GrAdient SOlver for SVM, ICML, 2007.
+%    [9] C. H. Teo, S. V. N. Vishwanathan, A. Smola, Q. V. Le, Bundle
+%        Methods for Regularized Risk Minimization, JMLR, 11:311-365,
+%        2010.
 
 %  Authors:: Andrea Vedaldi (MATLAB MEX version)
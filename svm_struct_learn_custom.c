@@ -26,6 +26,19 @@
 #include "svm_struct/svm_struct_common.h"
 #include "svm_struct/svm_struct_learn.h"
 
+#define MAX(x,y)      ((x) < (y) ? (y) : (x))
+#define MIN(x,y)      ((x) > (y) ? (y) : (x))
+
+
+static double length_nvector(double *w, long sizePsi)
+     /* computes the length of the weight vector w */
+{
+  long   i;
+  double sum=0;
+  for(i=1;i<=sizePsi;i++)
+    sum+=w[i]*w[i];
+  return(sqrt(sum));
+}
 
 void svm_learn_struct_joint_custom(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 				   LEARN_PARM *lparm, KERNEL_PARM *kparm, 
@@ -35,8 +48,207 @@ void svm_learn_struct_joint_custom(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
                lparm (svm learning parameters)
                kparm (kernel parameters)
 	       Output: sm (learned model) */
+     /* Block-coordinate Frank-Wolfe (Lacoste-Julien et al., ICML
+	2013) for linear models and margin rescaling. It optimizes
+	the dual of the n-slack problem, one example (block) at a
+	time: the most violated constraint of the example gives the
+	Frank-Wolfe corner of its block and the step size is found in
+	closed form, so that no QP is solved. The weight vector is
+	w=C*sum_i u_i, where u_i is a convex combination of the
+	fydelta=(fy-fybar) of example i and l_i the same combination
+	of their rhs=loss/n. The gap of block i is
+	
+	  g_i = (u_i-fydelta)*w - l_i + rhs
+
+	and sum_i g_i bounds (primal-dual)/C. A pass over the examples
+	in random order is an iteration, and learning stops when the
+	sum of the gaps of a pass is smaller than sparm->epsilon. */
 {
-  /* Put your algorithm here. See svm_struct_learn.c for an example of
-     how to access this API. */
-}
+  long        i,k;
+  int         numIt=0;
+  long        argmax_count=0;
+  long        sizePsi;
+  long        n=sample.n;
+  EXAMPLE     *ex=sample.examples;
+  double      *w;
+  SVECTOR     **fycache,*fy,*diff;
+  SVECTOR     **u,*fydelta,*us,*d,*unew;
+  double      *l,*gap,rhs;
+  double      dualgap,lsum,step,dd,modellength;
+  long        *randmapping;
+  long        progress;
+  CONSTSET    cset;
+  double      rt_total=0,rt_viol=0,rt_psi=0,rt_init=0;
+  double      rt1=0;
+
+  rt1=get_runtime();
+
+  if(kparm->kernel_type != LINEAR) {
+    printf("ERROR: The BCFW algorithm is implemented only for linear kernels!\n");
+    fflush(stdout);
+    exit(1);
+  }
+  if(sparm->loss_type != MARGIN_RESCALING) {
+    printf("ERROR: The BCFW algorithm requires margin rescaling!\n");
+    fflush(stdout);
+    exit(1);
+  }
+  if(sparm->slack_norm != 1) {
+    printf("ERROR: The BCFW algorithm applies only to the L1 slack norm!\n");
+    fflush(stdout);
+    exit(1);
+  }
+
+  init_struct_model(sample,sm,sparm,lparm,kparm); 
+  sizePsi=sm->sizePsi;
+
+  /* start from w=0, u_i=0 and l_i=0 */
+  w=create_nvector(sizePsi);
+  clear_nvector(w,sizePsi);
+  sm->svm_model=create_linear_model(w,sizePsi,n,kparm);
+  sm->w=w;
+  update_struct_model(sm,sparm);
+
+  u=(SVECTOR **)my_malloc(sizeof(SVECTOR *)*n);
+  l=(double *)my_malloc(sizeof(double)*n);
+  gap=(double *)my_malloc(sizeof(double)*n);
+  for(i=0;i<n;i++) {
+    u[i]=create_svector_n(NULL,0,NULL,1.0);
+    l[i]=0;
+    gap[i]=0;
+  }
+  lsum=0;
+
+  /* create a cache of the feature vectors for the correct labels */
+  fycache=(SVECTOR **)my_malloc(n*sizeof(SVECTOR *));
+  if(USE_FYCACHE)
+    psi_of_examples(fycache,ex,n,sm,sparm);
+  for(i=0;i<n;i++) {
+    if(USE_FYCACHE) {
+      fy=fycache[i];
+      diff=add_list_sort_ss_r(fy,COMPACT_ROUNDING_THRESH); 
+      free_svector(fy);
+      fy=diff;
+    }
+    else
+      fy=NULL;
+    fycache[i]=fy;
+  }
+
+  rt_init+=MAX(get_runtime()-rt1,0);
+  rt_total+=rt_init;
+
+  cset.m=0;
+  cset.lhs=NULL;
+  cset.rhs=NULL;
 
+    /*****************/
+   /*** main loop ***/
+  /*****************/
+  do { /* one pass over the examples in random order */
+
+    if(struct_verbosity>=1) { 
+      printf("Iter %i: ",++numIt); 
+      fflush(stdout);
+    }
+
+    rt1=get_runtime();
+    randmapping=random_order(n);
+    progress=0;
+    dualgap=0;
+    for(k=0;k<n;k++) {
+      i=randmapping[k];
+      if(struct_verbosity>=1) 
+	print_percent_progress(&progress,n,10,".");
+
+      /* Frank-Wolfe corner of block i */
+      find_most_violated_constraint(&fydelta,&rhs,&ex[i],fycache[i],n,
+				    sm,sparm,&rt_viol,&rt_psi,
+				    &argmax_count);
+
+      us=add_list_sort_ss_r(fydelta,COMPACT_ROUNDING_THRESH);
+      free_svector(fydelta);
+
+      /* block gap and closed form line search */
+      d=sub_ss_r(u[i],us,COMPACT_ROUNDING_THRESH);
+      gap[i]=sprod_ns(w,d)-l[i]+rhs;
+      dualgap+=gap[i];
+      dd=sparm->C*sprod_ss(d,d);
+      if(dd > 0)
+	step=MAX(0,MIN(1,gap[i]/dd));
+      else                  /* linear in the step: move only uphill */
+	step=(gap[i] > 0) ? 1 : 0;
+
+      /* update block i and w */
+      if(step > 0) {
+	unew=multadd_ss_r(u[i],d,1.0,-step,COMPACT_ROUNDING_THRESH);
+	free_svector(u[i]);
+	u[i]=unew;
+	add_vector_ns(w,d,-step*sparm->C);
+	lsum-=l[i];
+	l[i]-=step*(l[i]-rhs);
+	lsum+=l[i];
+	update_struct_model(sm,sparm);
+      }
+      free_svector(d);
+      free_svector(us);
+    }
+    free(randmapping);
+    rt_total+=MAX(get_runtime()-rt1,0);
+
+    if(struct_verbosity>=1) {
+      modellength=length_nvector(w,sizePsi);
+      printf("(Gap=%.5f, Dual=%.5f)\n",dualgap,
+	     sparm->C*lsum-0.5*modellength*modellength);
+    }
+
+  } while(((dualgap > sparm->epsilon) && (numIt < lparm->maxiter))
+	  | finalize_iteration(dualgap,0,sample,sm,cset,NULL,sparm));
+
+  if(struct_verbosity>=1) {
+    modellength=length_nvector(w,sizePsi);
+    printf("Upper bound on duality gap: %.5f\n",sparm->C*dualgap);
+    printf("Dual objective value: dval=%.5f\n",
+	   sparm->C*lsum-0.5*modellength*modellength);
+    printf("Number of iterations: %d\n",numIt);
+    printf("Number of calls to 'find_most_violated_constraint': %ld\n",argmax_count);
+    printf("Norm of weight vector: |w|=%.5f\n",modellength);
+    if(struct_verbosity>=2) {
+      /* the blocks with the largest gap are the examples which are
+	 the farthest from their optimum */
+      for(k=0,i=0;i<n;i++)
+	if(gap[i] > gap[k])
+	  k=i;
+      printf("Largest gap of a block: %.5f (example %ld)\n",gap[k],k);
+    }
+    if(struct_verbosity>=2) 
+      printf("Runtime in cpu-seconds: %.2f (%.2f%% for Argmax, %.2f%% for Psi, %.2f%% for init)\n",
+	     rt_total/100.0, (100.0*rt_viol)/rt_total, 
+	     (100.0*rt_psi)/rt_total, (100.0*rt_init)/rt_total);
+    else if(struct_verbosity==1) 
+      printf("Runtime in cpu-seconds: %.2f\n",rt_total/100.0);
+  }
+  if(struct_verbosity>=4)
+    printW(sm->w,sizePsi+1,n,sparm->C);
+
+  /* store w also as the only support vector, so that the model can
+     be written and read back like the ones of the other algorithms */
+  sm->svm_model->supvec[1]=create_example(-1,0,0,0,
+			     create_svector_n_r(w,sizePsi,NULL,1.0,
+						COMPACT_ROUNDING_THRESH));
+  sm->svm_model->alpha[1]=1;
+  sm->svm_model->sv_num=2;
+  update_struct_model(sm,sparm);
+
+  print_struct_learning_stats(sample,sm,cset,NULL,sparm);
+
+  for(i=0;i<n;i++) {
+    free_svector(u[i]);
+    if(fycache[i])
+      free_svector(fycache[i]);
+  }
+  free(u);
+  free(l);
+  free(gap);
+  free(fycache);
+}
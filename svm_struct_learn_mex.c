@@ -42,8 +42,12 @@ void read_input_parameters (int, char **,
                             int *);
 
 void arg_split (char *string, int *argc, char ***argv) ;
-void init_qp_solver() ;
-void free_qp_solver() ;
+
+void read_C_path (STRUCT_LEARN_PARM *, char const *) ;
+
+/* the farm of the running call, stopped by the next call if this
+   one fails with an error */
+static FARM * runningFarm = NULL ;
 
 /** ------------------------------------------------------------------
  ** @brief MEX entry point
@@ -58,6 +62,8 @@ mexFunction (int nout, mxArray ** out, int nin, mxArray const ** in)
   STRUCT_LEARN_PARM struct_parm;
   STRUCTMODEL structmodel;
   int alg_type;
+  int modelOrder [sizeof(struct_parm.C_path) / sizeof(double)] ;
+  int numModels, mi, mj ;
 
   enum {IN_ARGS=0, IN_SPARM} ;
   enum {OUT_W=0} ;
@@ -70,11 +76,20 @@ mexFunction (int nout, mxArray ** out, int nin, mxArray const ** in)
   mxArray const * patterns_array ;
   mxArray const * labels_array ;
   mxArray const * kernelFn_array ;
+  mxArray const * kernelBlockFn_array ;
+  mxArray const * patternGram_array ;
+  mxArray const * labelGram_array ;
+  mxArray const * labelKernelFn_array ;
+  mxArray const * plugin_array ;
+  mxArray const * pluginOptions_array ;
   int numExamples, ei ;
   mxArray * model_array;
+  char const * modelFieldNames [] = {
+    "w", "alpha", "svPatterns", "svLabels"
+  } ;
 
-  /* SVM-light is not fully reentrant, so we need to run this patch first */
-  init_qp_solver() ;
+  stop_farm (runningFarm) ;
+  runningFarm = NULL ;
   verbosity = 0 ;
   kernel_cache_statistic = 0 ;
 
@@ -112,88 +127,257 @@ mexFunction (int nout, mxArray ** out, int nin, mxArray const ** in)
   }
   struct_parm.mex = sparm_array ;
 
-  patterns_array = mxGetField(sparm_array, 0, "patterns") ;
-  if (! patterns_array ||
-      ! mxIsCell(patterns_array)) {
-    mexErrMsgTxt("SPARM.PATTERNS must be a cell array") ;
-  }
+  plugin_array = mxGetField(sparm_array, 0, "plugin") ;
+  struct_parm.plugin = NULL ;
 
-  numExamples = mxGetNumberOfElements(patterns_array) ;
+  if (plugin_array) {
+    /* native oracles: the plugin also provides the examples */
+    char path [1024 + 1] ;
+    char options [1024 + 1] = "" ;
+    char msg [1024 + 1] ;
 
-  labels_array = mxGetField(sparm_array, 0, "labels") ;
-  if (! labels_array ||
-      ! mxIsCell(labels_array) ||
-      ! mxGetNumberOfElements(labels_array) == numExamples) {
-    mexErrMsgTxt("SPARM.LABELS must be a cell array "
-                 "with the same number of elements of "
-                 "SPARM.PATTERNS") ;
-  }
+    if (! uIsString(plugin_array, -1)) {
+      mexErrMsgTxt("SPARM.PLUGIN must be a string") ;
+    }
+    if (kernel_parm.kernel_type != LINEAR) {
+      mexErrMsgTxt("SPARM.PLUGIN requires the LINEAR kernel") ;
+    }
+    mxGetString(plugin_array, path, sizeof(path) / sizeof(char)) ;
+
+    pluginOptions_array = mxGetField(sparm_array, 0, "pluginOptions") ;
+    if (pluginOptions_array) {
+      if (! uIsString(pluginOptions_array, -1)) {
+        mexErrMsgTxt("SPARM.PLUGINOPTIONS must be a string") ;
+      }
+      mxGetString(pluginOptions_array, options, sizeof(options) / sizeof(char)) ;
+    }
+
+    struct_parm.plugin = load_plugin (path, options, msg, sizeof(msg)) ;
+    if (! struct_parm.plugin) {
+      mexErrMsgTxt(msg) ;
+    }
+
+    numExamples = struct_parm.plugin -> num_examples ;
+    sample.n = numExamples ;
+    sample.examples = (EXAMPLE *) my_malloc (sizeof(EXAMPLE) * numExamples) ;
+    for (ei = 0 ; ei < numExamples ; ++ ei) {
+      EXAMPLE * ex = sample.examples + ei ;
+      struct_parm.plugin -> abi -> example (struct_parm.plugin -> state, ei,
+                                            &ex->x.native, &ex->y.native) ;
+      ex->x.mex = NULL ;
+      ex->x.index = ei ;
+      ex->y.mex = NULL ;
+      ex->y.isOwner = 0 ;
+      ex->y.plugin = struct_parm.plugin ;
+    }
+  } else {
+    patterns_array = mxGetField(sparm_array, 0, "patterns") ;
+    if (! patterns_array ||
+        ! mxIsCell(patterns_array)) {
+      mexErrMsgTxt("SPARM.PATTERNS must be a cell array") ;
+    }
 
-  sample.n = numExamples ;
-  sample.examples = (EXAMPLE *) my_malloc (sizeof(EXAMPLE) * numExamples) ;
-  for (ei = 0 ; ei < numExamples ; ++ ei) {
-    sample.examples[ei].x.mex = mxGetCell(patterns_array, ei) ;
-    sample.examples[ei].y.mex = mxGetCell(labels_array,   ei) ;
-    sample.examples[ei].y.isOwner = 0 ;
+    numExamples = mxGetNumberOfElements(patterns_array) ;
+
+    labels_array = mxGetField(sparm_array, 0, "labels") ;
+    if (! labels_array ||
+        ! mxIsCell(labels_array) ||
+        ! mxGetNumberOfElements(labels_array) == numExamples) {
+      mexErrMsgTxt("SPARM.LABELS must be a cell array "
+                   "with the same number of elements of "
+                   "SPARM.PATTERNS") ;
+    }
+
+    sample.n = numExamples ;
+    sample.examples = (EXAMPLE *) my_malloc (sizeof(EXAMPLE) * numExamples) ;
+    for (ei = 0 ; ei < numExamples ; ++ ei) {
+      sample.examples[ei].x.mex = mxGetCell(patterns_array, ei) ;
+      sample.examples[ei].x.native = NULL ;
+      sample.examples[ei].x.index = ei ;
+      sample.examples[ei].y.mex = mxGetCell(labels_array,   ei) ;
+      sample.examples[ei].y.isOwner = 0 ;
+      sample.examples[ei].y.native = NULL ;
+      sample.examples[ei].y.plugin = NULL ;
+    }
   }
 
   if (struct_verbosity >= 1) {
     mexPrintf("There are %d training examples\n", numExamples) ;
   }
 
-  kernelFn_array = mxGetField(sparm_array, 0, "kernelFn") ;
-  if (! kernelFn_array && kernel_parm.kernel_type == CUSTOM) {
-    mexErrMsgTxt("SPARM.KERNELFN must be defined for CUSTOM kernels") ;
+  struct_parm.farm = NULL ;
+  if (struct_parm.farm_size > 0) {
+    char msg [1024 + 1] ;
+    if (! struct_parm.plugin) {
+      mexErrMsgTxt("The --f option requires SPARM.PLUGIN") ;
+    }
+    struct_parm.farm = start_farm (struct_parm.plugin,
+                                   struct_parm.farm_size,
+                                   struct_parm.farm_loopback,
+                                   msg, sizeof(msg)) ;
+    if (! struct_parm.farm) {
+      mexErrMsgTxt(msg) ;
+    }
+    runningFarm = struct_parm.farm ;
   }
-  if (kernelFn_array) {
+
+  kernelFn_array = mxGetField(sparm_array, 0, "kernelFn") ;
+  kernelBlockFn_array = mxGetField(sparm_array, 0, "kernelBlockFn") ;
+  patternGram_array = mxGetField(sparm_array, 0, "patternGram") ;
+  labelGram_array = mxGetField(sparm_array, 0, "labelGram") ;
+  labelKernelFn_array = mxGetField(sparm_array, 0, "labelKernelFn") ;
+  if (kernel_parm.kernel_type == CUSTOM) {
     MexKernelInfo * info ;
-    if (mxGetClassID(kernelFn_array) != mxFUNCTION_CLASS) {
+    if (! kernelFn_array && ! kernelBlockFn_array && ! patternGram_array) {
+      mexErrMsgTxt("SPARM.KERNELFN, SPARM.KERNELBLOCKFN or SPARM.PATTERNGRAM "
+                   "must be defined for CUSTOM kernels") ;
+    }
+    if (kernelFn_array &&
+        mxGetClassID(kernelFn_array) != mxFUNCTION_CLASS) {
       mexErrMsgTxt("SPARM.KERNELFN must be a valid function handle") ;
     }
+    if (kernelBlockFn_array &&
+        mxGetClassID(kernelBlockFn_array) != mxFUNCTION_CLASS) {
+      mexErrMsgTxt("SPARM.KERNELBLOCKFN must be a valid function handle") ;
+    }
+    /* the information is stored in kernel_parm.custom */
+    assert (sizeof(MexKernelInfo) <= sizeof(kernel_parm.custom)) ;
     info = (MexKernelInfo*) kernel_parm.custom ;
-    info -> structParm = sparm_array ;
-    info -> kernelFn   = kernelFn_array ;
+    info -> structParm    = sparm_array ;
+    info -> kernelFn      = kernelFn_array ;
+    info -> kernelBlockFn = kernelBlockFn_array ;
+    info -> memo          = newMexKernelMemo (struct_parm.kernel_memo_size) ;
+    info -> gram          = NULL ;
+
+    if (patternGram_array) {
+      MexKernelGram * gram ;
+      if (! uIsReal(patternGram_array) ||
+          mxIsSparse(patternGram_array) ||
+          mxGetM(patternGram_array) != numExamples ||
+          mxGetN(patternGram_array) != numExamples) {
+        mexErrMsgTxt("SPARM.PATTERNGRAM must be a full real matrix of size "
+                     "numel(SPARM.PATTERNS) x numel(SPARM.PATTERNS)") ;
+      }
+      if (labelGram_array &&
+          (! uIsReal(labelGram_array) ||
+           mxIsSparse(labelGram_array) ||
+           mxGetM(labelGram_array) != mxGetN(labelGram_array))) {
+        mexErrMsgTxt("SPARM.LABELGRAM must be a full real square matrix") ;
+      }
+      if (labelKernelFn_array &&
+          mxGetClassID(labelKernelFn_array) != mxFUNCTION_CLASS) {
+        mexErrMsgTxt("SPARM.LABELKERNELFN must be a valid function handle") ;
+      }
+      if (! labelGram_array && ! labelKernelFn_array) {
+        mexErrMsgTxt("SPARM.LABELGRAM or SPARM.LABELKERNELFN must be "
+                     "defined with SPARM.PATTERNGRAM") ;
+      }
+      gram = mxMalloc (sizeof(MexKernelGram)) ;
+      gram -> pattern = mxGetPr(patternGram_array) ;
+      gram -> numPatterns = numExamples ;
+      gram -> label = labelGram_array ? mxGetPr(labelGram_array) : NULL ;
+      gram -> numLabels = labelGram_array ? mxGetM(labelGram_array) : 0 ;
+      gram -> labelKernelFn = labelKernelFn_array ;
+      info -> gram = gram ;
+    }
   }
 
   /* Learning  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
-  switch (alg_type) {
-  case 0:
-    svm_learn_struct(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,NSLACK_ALG) ;
-    break ;
-  case 1:
-    svm_learn_struct(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,NSLACK_SHRINK_ALG);
-    break ;
-  case 2:
-    svm_learn_struct_joint(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,ONESLACK_PRIMAL_ALG);
-    break ;
-  case 3:
-    svm_learn_struct_joint(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,ONESLACK_DUAL_ALG);
-    break ;
-  case 4:
-    svm_learn_struct_joint(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,ONESLACK_DUAL_CACHE_ALG);
-    break  ;
-  case 9:
-    svm_learn_struct_joint_custom(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel);
-    break ;
-  default:
-    mexErrMsgTxt("Unknown algorithm type") ;
-  }
-
-  /* Write output  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
-
-  /* Warning: The model contains references to the original data 'docs'.
-     If you want to free the original data, and only keep the model, you
-     have to make a deep copy of 'model'. */
-
-  // jk change
-  model_array = newMxArrayEncapsulatingSmodel (&structmodel) ;
-  out[OUT_W] = mxDuplicateArray (model_array) ;
-  destroyMxArrayEncapsulatingSmodel (model_array) ;
+
+  /* With several values of C, the models are trained from the
+     smallest C (largest slack) to the largest one, each starting
+     from the working set of the previous one and sharing the cache
+     of psi(x_i,y_i) and the constraint cache with it. The models are
+     returned in the order of the values. */
+  numModels = struct_parm.C_path_size ;
+  for (mi = 0 ; mi < numModels ; ++ mi) {
+    for (mj = mi ;
+         mj > 0 && struct_parm.C_path[modelOrder[mj-1]] > struct_parm.C_path[mi] ;
+         -- mj) {
+      modelOrder[mj] = modelOrder[mj-1] ;
+    }
+    modelOrder[mj] = mi ;
+  }
+  struct_parm.path = (numModels > 1) ? create_struct_path () : NULL ;
+  out[OUT_W] = mxCreateStructMatrix (1, numModels, 4, modelFieldNames) ;
+
+  /* the state of the QP solver is shared by all the QP problems of
+     this training, and only by them */
+  learn_parm.qp_solver = create_qp_solver () ;
+
+  for (mi = 0 ; mi < numModels ; ++ mi) {
+    struct_parm.C = struct_parm.C_path[modelOrder[mi]] ;
+    if (struct_verbosity >= 1 && numModels > 1) {
+      mexPrintf("Training with C=%g (%d of %d)\n", struct_parm.C, mi + 1, numModels) ;
+    }
+    switch (alg_type) {
+    case 0:
+      svm_learn_struct(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,NSLACK_ALG) ;
+      break ;
+    case 1:
+      svm_learn_struct(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,NSLACK_SHRINK_ALG);
+      break ;
+    case 2:
+      svm_learn_struct_joint(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,ONESLACK_PRIMAL_ALG);
+      break ;
+    case 3:
+      svm_learn_struct_joint(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,ONESLACK_DUAL_ALG);
+      break ;
+    case 4:
+      svm_learn_struct_joint(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel,ONESLACK_DUAL_CACHE_ALG);
+      break  ;
+    case 5:
+      svm_learn_struct_ssg(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel);
+      break ;
+    case 6:
+      svm_learn_struct_bmrm(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel);
+      break ;
+    case 9:
+      svm_learn_struct_joint_custom(sample,&struct_parm,&learn_parm,&kernel_parm,&structmodel);
+      break ;
+    default:
+      mexErrMsgTxt("Unknown algorithm type") ;
+    }
+
+    /* Write output  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+    /* Warning: The model contains references to the original data 'docs'.
+       If you want to free the original data, and only keep the model, you
+       have to make a deep copy of 'model'. */
+
+    // jk change
+    model_array = newMxArrayEncapsulatingSmodel (&structmodel) ;
+    for (ei = 0 ; ei < 4 ; ++ ei) {
+      mxArray const * field = mxGetField (model_array, 0, modelFieldNames[ei]) ;
+      if (field) {
+        mxSetField (out[OUT_W], modelOrder[mi], modelFieldNames[ei],
+                    mxDuplicateArray (field)) ;
+      }
+    }
+    destroyMxArrayEncapsulatingSmodel (model_array) ;
+    free_struct_model (structmodel) ;
+  }
   
+  if (kernel_parm.kernel_type == CUSTOM) {
+    MexKernelInfo * info = (MexKernelInfo*) kernel_parm.custom ;
+    if (struct_verbosity >= 2 && info -> memo) {
+      double hits, misses ;
+      MexKernelMemoGetStatistics (info -> memo, &hits, &misses) ;
+      mexPrintf("Kernel memo: %.0f hits, %.0f misses\n", hits, misses) ;
+    }
+    deleteMexKernelMemo (info -> memo) ;
+    if (info -> gram) mxFree (info -> gram) ;
+  }
+
+  if (struct_parm.path) {
+    free_struct_path (struct_parm.path, sample.n) ;
+  }
   free_struct_sample (sample) ;
-  free_struct_model (structmodel) ;
+  stop_farm (struct_parm.farm) ;
+  runningFarm = NULL ;
+  unload_plugin (struct_parm.plugin) ;
   svm_struct_learn_api_exit () ;
-  free_qp_solver () ;
+  free_qp_solver (learn_parm.qp_solver) ;
 }
 
 /** ------------------------------------------------------------------
@@ -215,6 +399,8 @@ read_input_parameters (int argc,char *argv[],
   (*struct_verbosity)=1;
 
   struct_parm->C=-0.01;
+  struct_parm->C_path_size=0;
+  struct_parm->path=NULL;
   struct_parm->slack_norm=1;
   struct_parm->epsilon=DEFAULT_EPS;
   struct_parm->custom_argc=0;
@@ -223,6 +409,12 @@ read_input_parameters (int argc,char *argv[],
   struct_parm->newconstretrain=100;
   struct_parm->ccache_size=5;
   struct_parm->batch_size=100;
+  struct_parm->pipeline=0;
+  struct_parm->kernel_memo_size=40;
+  struct_parm->farm_size=0;
+  struct_parm->farm_loopback=0;
+  struct_parm->ssg_passes=10;
+  struct_parm->ssg_average=0;
 
   /* SVM light options */
   (*verbosity)=0;
@@ -248,6 +440,9 @@ read_input_parameters (int argc,char *argv[],
   learn_parm->compute_loo=0;
   learn_parm->rho=1.0;
   learn_parm->xa_depth=0;
+  learn_parm->num_threads=1;
+  learn_parm->qp_solver=NULL;
+  learn_parm->qp_state=NULL;
 
   kernel_parm->kernel_type=0;
   kernel_parm->poly_degree=3;
@@ -261,11 +456,12 @@ read_input_parameters (int argc,char *argv[],
     switch ((argv[i])[1])
       {
       case 'a': i++; strcpy(learn_parm->alphafile,argv[i]); break;
-      case 'c': i++; struct_parm->C=atof(argv[i]); break;
+      case 'c': i++; read_C_path(struct_parm,argv[i]); break;
       case 'p': i++; struct_parm->slack_norm=atol(argv[i]); break;
       case 'e': i++; struct_parm->epsilon=atof(argv[i]); break;
       case 'k': i++; struct_parm->newconstretrain=atol(argv[i]); break;
       case 'h': i++; learn_parm->svm_iter_to_shrink=atol(argv[i]); break;
+      case 'j': i++; learn_parm->num_threads=atol(argv[i]); break;
       case '#': i++; learn_parm->maxiter=atol(argv[i]); break;
       case 'm': i++; learn_parm->kernel_cache_size=atol(argv[i]); break;
       case 'w': i++; (*alg_type)=atol(argv[i]); break;
@@ -275,6 +471,7 @@ read_input_parameters (int argc,char *argv[],
       case 'l': i++; struct_parm->loss_function=atol(argv[i]); break;
       case 'f': i++; struct_parm->ccache_size=atol(argv[i]); break;
       case 'b': i++; struct_parm->batch_size=atof(argv[i]); break;
+      case 'z': i++; struct_parm->pipeline=atol(argv[i]); break;
       case 't': i++; kernel_parm->kernel_type=atol(argv[i]); break;
       case 'd': i++; kernel_parm->poly_degree=atol(argv[i]); break;
       case 'g': i++; kernel_parm->rbf_gamma=atof(argv[i]); break;
@@ -372,8 +569,8 @@ read_input_parameters (int argc,char *argv[],
   if(struct_parm->C<0) {
     mexErrMsgTxt("You have to specify a value for the parameter '-c' (C>0)!");
   }
-  if(((*alg_type) < 0) || (((*alg_type) > 5) && ((*alg_type) != 9))) {
-    mexErrMsgTxt("Algorithm type must be either '0', '1', '2', '3', '4', or '9'!");
+  if(((*alg_type) < 0) || (((*alg_type) > 6) && ((*alg_type) != 9))) {
+    mexErrMsgTxt("Algorithm type must be either '0', '1', '2', '3', '4', '5', '6', or '9'!");
   }
   if(learn_parm->transduction_posratio>1) {
     mexErrMsgTxt("The fraction of unlabeled examples to classify as positives must "
@@ -392,6 +589,19 @@ read_input_parameters (int argc,char *argv[],
      && ((*alg_type) == 4)) {
     mexErrMsgTxt("The batch size must be in the interval ]0,100]!");
   }
+  if(((*alg_type) == 9) && ((kernel_parm->kernel_type != LINEAR)
+                             || (struct_parm->loss_type != MARGIN_RESCALING)
+                             || (struct_parm->slack_norm != 1))) {
+    mexErrMsgTxt("The algorithm '-w 9' requires the LINEAR kernel, margin rescaling and the L1-norm of the slacks!");
+  }
+  if(((*alg_type) == 5) && ((kernel_parm->kernel_type != LINEAR)
+                             || (struct_parm->slack_norm != 1))) {
+    mexErrMsgTxt("The algorithm '-w 5' requires the LINEAR kernel and the L1-norm of the slacks!");
+  }
+  if(((*alg_type) == 6) && ((kernel_parm->kernel_type != LINEAR)
+                             || (struct_parm->slack_norm != 1))) {
+    mexErrMsgTxt("The algorithm '-w 6' requires the LINEAR kernel and the L1-norm of the slacks!");
+  }
   if((struct_parm->slack_norm<1) || (struct_parm->slack_norm>2)) {
     mexErrMsgTxt("The norm of the slacks must be either 1 (L1-norm) or 2 (L2-norm)!");
   }
@@ -399,6 +609,9 @@ read_input_parameters (int argc,char *argv[],
      && (struct_parm->loss_type != MARGIN_RESCALING)) {
     mexErrMsgTxt("The loss type must be either 1 (slack rescaling) or 2 (margin rescaling)!");
   }
+  if(learn_parm->num_threads<1) {
+    mexErrMsgTxt("The number of threads must be at least 1!");
+  }
   if(learn_parm->rho<0) {
     mexErrMsgTxt("The parameter rho for xi/alpha-estimates and leave-one-out pruning must"
                  " be greater than zero (typically 1.0 or 2.0, see T. Joachims, Estimating the"
@@ -446,3 +659,33 @@ arg_split (char *string, int *argc, char ***argv)
     }
   }
 }
+
+/** ------------------------------------------------------------------
+ ** @brief Parse the comma separated values of the -c option
+ **/
+
+void
+read_C_path (STRUCT_LEARN_PARM *struct_parm, char const *string)
+{
+  int maxSize = sizeof(struct_parm->C_path) / sizeof(double) ;
+  char const *p = string ;
+  char *end ;
+
+  struct_parm->C_path_size = 0 ;
+  for (;;) {
+    double C = strtod (p, &end) ;
+    if (end == p || (*end && *end != ',')) {
+      mexErrMsgTxt("The values of '-c' must be numbers separated by commas") ;
+    }
+    if (struct_parm->C_path_size >= maxSize) {
+      mexErrMsgTxt("Too many values of '-c'") ;
+    }
+    struct_parm->C_path[struct_parm->C_path_size++] = C ;
+    /* the smallest value is checked by read_input_parameters() */
+    if (struct_parm->C_path_size == 1 || C < struct_parm->C) {
+      struct_parm->C = C ;
+    }
+    if (*end == 0) break ;
+    p = end + 1 ;
+  }
+}
@@ -0,0 +1,156 @@
+/** file:   svm_struct_plugin.c
+ ** brief:  Loader of native C oracle plugins
+ ** author: Andrea Vedaldi
+ **/
+
+/*
+ This file does not include svm_common.h on purpose: the buffers
+ below are allocated with the C library allocator rather than the
+ MATLAB one, as they are owned by the plugin and live as long as it
+ is loaded.
+ */
+
+#include "svm_struct_plugin.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN
+#include <dlfcn.h>
+#else
+#include <windows.h>
+#define snprintf _snprintf
+#endif
+
+/** ------------------------------------------------------------------
+ ** @brief Load a plugin
+ **
+ ** Loads the shared library PATH, looks up the plugin function table
+ ** and initializes the plugin with the string OPTIONS. Returns NULL
+ ** and writes a message to ERROR on failure.
+ **/
+
+PLUGIN *
+load_plugin (char const *path, char const *options,
+             char *error, int error_size)
+{
+  PLUGIN * plugin ;
+  void * library ;
+  SVM_STRUCT_PLUGIN const * abi ;
+
+#ifndef WIN
+  library = dlopen (path, RTLD_NOW | RTLD_LOCAL) ;
+  if (! library) {
+    snprintf (error, error_size, "Could not load plugin '%s': %s",
+              path, dlerror()) ;
+    return NULL ;
+  }
+  abi = (SVM_STRUCT_PLUGIN const *) dlsym (library, SVM_STRUCT_PLUGIN_SYMBOL) ;
+#else
+  library = (void*) LoadLibraryA (path) ;
+  if (! library) {
+    snprintf (error, error_size, "Could not load plugin '%s'", path) ;
+    return NULL ;
+  }
+  abi = (SVM_STRUCT_PLUGIN const *)
+    GetProcAddress ((HMODULE) library, SVM_STRUCT_PLUGIN_SYMBOL) ;
+#endif
+
+  if (! abi) {
+    snprintf (error, error_size, "Plugin '%s' does not export '%s'",
+              path, SVM_STRUCT_PLUGIN_SYMBOL) ;
+    goto fail ;
+  }
+  if (abi->abi_version != SVM_STRUCT_PLUGIN_ABI_VERSION) {
+    snprintf (error, error_size,
+              "Plugin '%s' has ABI version %d, but %d is required",
+              path, abi->abi_version, SVM_STRUCT_PLUGIN_ABI_VERSION) ;
+    goto fail ;
+  }
+  if (! abi->init || ! abi->example || ! abi->psi ||
+      ! abi->loss || ! abi->argmax) {
+    snprintf (error, error_size, "Plugin '%s' is incomplete", path) ;
+    goto fail ;
+  }
+
+  plugin = (PLUGIN*) calloc (1, sizeof(PLUGIN)) ;
+  plugin->library = library ;
+  plugin->abi = abi ;
+  plugin->state = abi->init (options, &plugin->num_examples,
+                             &plugin->size_psi) ;
+  if (! plugin->state) {
+    snprintf (error, error_size, "Could not initialize plugin '%s'", path) ;
+    free (plugin) ;
+    goto fail ;
+  }
+  if (plugin->num_examples < 1 || plugin->size_psi < 1) {
+    snprintf (error, error_size,
+              "Plugin '%s' returned an invalid number of examples "
+              "or feature dimension", path) ;
+    unload_plugin (plugin) ;
+    return NULL ;
+  }
+  return plugin ;
+
+ fail:
+#ifndef WIN
+  dlclose (library) ;
+#else
+  FreeLibrary ((HMODULE) library) ;
+#endif
+  return NULL ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Unload a plugin
+ **/
+
+void
+unload_plugin (PLUGIN *plugin)
+{
+  if (! plugin) return ;
+  if (plugin->abi->exit) {
+    plugin->abi->exit (plugin->state) ;
+  }
+#ifndef WIN
+  dlclose (plugin->library) ;
+#else
+  FreeLibrary ((HMODULE) plugin->library) ;
+#endif
+  free (plugin->index) ;
+  free (plugin->value) ;
+  free (plugin) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Evaluate the plugin feature map
+ **
+ ** Calls the plugin psi() function, growing plugin->index and
+ ** plugin->value as needed. Returns the number of non-zero
+ ** components stored there, or a negative number on failure.
+ **/
+
+long
+plugin_psi (PLUGIN *plugin, void const *x, void const *y)
+{
+  long nnz ;
+  long * index ;
+  double * value ;
+  for (;;) {
+    nnz = plugin->abi->psi (plugin->state, x, y,
+                            plugin->index, plugin->value,
+                            plugin->capacity) ;
+    if (nnz < 0 || nnz <= plugin->capacity) break ;
+    /* on failure, keep the old buffers, which are still at least
+       plugin->capacity long */
+    index = (long*) realloc (plugin->index, sizeof(long) * nnz) ;
+    if (! index) return -1 ;
+    plugin->index = index ;
+    value = (double*) realloc (plugin->value, sizeof(double) * nnz) ;
+    if (! value) return -1 ;
+    plugin->value = value ;
+    plugin->capacity = nnz ;
+  }
+  return nnz ;
+}
@@ -0,0 +1,109 @@
+/** file:   svm_struct_plugin.h
+ ** brief:  Native C oracle plugins for the MATLAB SVM-struct interface
+ ** author: Andrea Vedaldi
+ **/
+
+/*
+ A plugin is a shared library (.so, .dylib, .dll) implementing the
+ SVM-struct oracles in C. It is selected by setting PARM.PLUGIN to the
+ path of the library (and optionally PARM.PLUGINOPTIONS to a string
+ passed to the plugin init function). In this case the training
+ examples, the feature map, the loss and the most violated constraint
+ are all obtained from the plugin and MATLAB is not called back at
+ all. Plugins work only with the linear kernel.
+
+ The library must export a symbol named SVM_STRUCT_PLUGIN_SYMBOL of
+ type SVM_STRUCT_PLUGIN, e.g.
+
+   SVM_STRUCT_PLUGIN svm_struct_plugin = {
+     SVM_STRUCT_PLUGIN_ABI_VERSION,
+     my_init, my_exit, my_example, my_psi, my_loss, my_argmax,
+     my_free_label } ;
+
+ Patterns and labels are opaque pointers owned by the plugin. The
+ training examples returned by example() must remain valid until
+ exit() is called. Labels returned by argmax() are released by
+ free_label().
+
+ If learning uses several threads (-j option) or pipelining (-z
+ option), psi(), loss(), argmax() and free_label() may be called
+ concurrently and must be thread safe. With a farm of workers (--f
+ option, see svm_struct_farm.h) they are called instead in copies of
+ the process forked after init(), or one at a time by the threads of
+ a loopback farm (--l option).
+
+ This header does not depend on MATLAB and can be included as is by
+ the plugin sources.
+ */
+
+#ifndef SVM_STRUCT_PLUGIN_H
+#define SVM_STRUCT_PLUGIN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SVM_STRUCT_PLUGIN_ABI_VERSION 1
+#define SVM_STRUCT_PLUGIN_SYMBOL "svm_struct_plugin"
+
+typedef struct svm_struct_plugin {
+  int    abi_version;     /* must be SVM_STRUCT_PLUGIN_ABI_VERSION */
+
+  /* creates the plugin state from the string PARM.PLUGINOPTIONS and
+     returns the number of training examples and the dimension of
+     the feature map. Returns NULL on failure. */
+  void * (*init) (char const *options, long *num_examples, long *size_psi);
+
+  /* destroys the plugin state */
+  void   (*exit) (void *state);
+
+  /* returns the pattern and label of the i-th training example,
+     i=0,...,num_examples-1 */
+  void   (*example) (void *state, long i, void **x, void **y);
+
+  /* computes the feature map psi(x,y). Writes the indexes
+     (0,...,size_psi-1, in increasing order) and values of the
+     non-zero components to index and value and returns their
+     number. If this is larger than capacity, nothing needs to be
+     written and the function is called again with larger
+     buffers. Returns a negative number on failure. */
+  long   (*psi) (void *state, void const *x, void const *y,
+                 long *index, double *value, long capacity);
+
+  /* returns the loss Delta(y,ybar) */
+  double (*loss) (void *state, void const *y, void const *ybar);
+
+  /* returns the label ybar maximising the score <w,psi(x,ybar)>
+     (loss_type=0, used for prediction; y is then NULL) or the most
+     violated constraint for slack rescaling (loss_type=1) or margin
+     rescaling (loss_type=2). w has size_psi components. */
+  void * (*argmax) (void *state, double const *w, long size_psi,
+                    void const *x, void const *y, int loss_type);
+
+  /* releases a label returned by argmax() */
+  void   (*free_label) (void *state, void *y);
+} SVM_STRUCT_PLUGIN;
+
+/* a plugin loaded by the MEX interface */
+typedef struct plugin {
+  void   *library;        /* handle of the shared library */
+  SVM_STRUCT_PLUGIN const *abi; /* exported function table */
+  void   *state;          /* plugin state returned by init() */
+  long   num_examples;    /* number of training examples */
+  long   size_psi;        /* dimension of the feature map */
+  long   capacity;        /* size of the psi() buffers */
+  long   *index;          /* psi() buffer for the indexes */
+  double *value;          /* psi() buffer for the values */
+} PLUGIN;
+
+PLUGIN *load_plugin(char const *path, char const *options,
+                    char *error, int error_size);
+void    unload_plugin(PLUGIN *plugin);
+long    plugin_psi(PLUGIN *plugin, void const *x, void const *y);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* SVM_STRUCT_PLUGIN_H */
+#endif